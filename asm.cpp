@@ -0,0 +1,313 @@
+//
+// Inline assembler for a MACRO-11 subset
+//
+// A line starting with an instruction mnemonic is assembled in place of octal words, e.g.
+//
+//      mov     #1, @#flag          ; comments start with ";" or "//"
+//      jsr     pc, sub
+//      bne     loop
+//      sob     r1, 1036
+//
+// Instructions: those of the disassembler (see dis.cpp), plus the bhis/blo synonyms of bcc/bcs.
+// Registers: r0-r7, sp, pc, %0-%7. Mnemonics and registers may be upper or lower case.
+// Addressing modes: r, (r), @r, (r)+, @(r)+, -(r), @-(r), x(r), @x(r), #x, @#x, x (pc-relative), @x
+// Values: octal, decimal with a trailing "." (e.g. 10.), a leading "-", or a label name (see label.cpp)
+// but no expressions.
+// Branch and sob targets, and the x of the pc-relative modes, are addresses: the offsets are
+// computed from the pc the instruction is placed at.
+//
+// A line is assembled once when parsed into one to three L_WORDS words, so it costs about the
+// same as a line of octal words and everything downstream (listing, --check-only, --lsp, --prov)
+// sees ordinary words. Only the pc-dependent parts (the flags in line_t) are completed when the
+// pc is known. The mnemonics are looked up in a hash table built once from the disassembler's
+// opcode table, so the two can't disagree.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "txt2abs.h"
+
+#define N_OPS_HASH 256
+
+// synonyms not in the disassembler's table
+static const op_t syn_ops[] = {
+    { 0103000, 0177400, "bhis",  F_BR },
+    { 0103400, 0177400, "blo",   F_BR },
+    { 0, 0, NULL, F_NONE }
+};
+
+static const op_t *ops_hash[N_OPS_HASH];
+static pthread_once_t ops_once = PTHREAD_ONCE_INIT;
+
+static u4_t op_hash(const char *name, int len)
+{
+    u4_t h = 0;
+    for (int i = 0; i < len; i++) h = h * 31 + tolower(name[i]);
+    return h & (N_OPS_HASH - 1);
+}
+
+static void ops_add(const op_t *op)
+{
+    u4_t h = op_hash(op->name, strlen(op->name));
+    while (ops_hash[h]) h = (h + 1) & (N_OPS_HASH - 1);
+    ops_hash[h] = op;
+}
+
+static void ops_init()
+{
+    for (const op_t *op = pdp11_ops; op->name; op++) ops_add(op);
+    for (const op_t *op = syn_ops; op->name; op++) ops_add(op);
+}
+
+static const op_t *op_find(const char *name, int len)
+{
+    pthread_once(&ops_once, ops_init);
+    for (u4_t h = op_hash(name, len); ops_hash[h]; h = (h + 1) & (N_OPS_HASH - 1))
+        if (strncasecmp(ops_hash[h]->name, name, len) == 0 && ops_hash[h]->name[len] == '\0') return ops_hash[h];
+    return NULL;
+}
+
+
+// operands
+
+static bool name_char(int ch)
+{
+    return isalnum(ch) || ch == '_' || ch == '.' || ch == '$';
+}
+
+static const char *skip(const char *cp)
+{
+    while (*cp == ' ' || *cp == '\t') cp++;
+    return cp;
+}
+
+// register number, or -1
+static int reg(const char *cp, const char **ep)
+{
+    int r = -1;
+    if (cp[0] == '%' && cp[1] >= '0' && cp[1] <= '7') r = cp[1] - '0'; else
+    if (tolower(cp[0]) == 'r' && cp[1] >= '0' && cp[1] <= '7') r = cp[1] - '0'; else
+    if (strncasecmp(cp, "sp", 2) == 0) r = 6; else
+    if (strncasecmp(cp, "pc", 2) == 0) r = 7;
+    if (r < 0 || name_char(cp[2])) return -1;
+    *ep = cp + 2;
+    return r;
+}
+
+// a value: number or label
+struct val_t {
+    u4_t v;
+    bool ref;
+};
+
+static const char *value(const char *cp, val_t *vp)
+{
+    const char *ep;
+    cp = skip(cp);
+    vp->ref = false;
+    if (isalpha(*cp) || *cp == '_' || *cp == '.' || *cp == '$') {
+        if (reg(cp, &ep) >= 0) return NULL;
+        for (ep = cp; name_char(*ep); ep++)
+            ;
+        if (ep - cp == 1 && *cp == '.') return NULL;    // "." (the current location) isn't supported
+        vp->v = lab_sym(cp, ep - cp);
+        vp->ref = true;
+        return ep;
+    }
+
+    bool neg = (*cp == '-');
+    if (neg) cp++;
+    if (!isdigit(*cp)) return NULL;
+    u4_t n8 = 0, n10 = 0;
+    bool dec = false;
+    for (ep = cp; isdigit(*ep); ep++) {
+        if (ep - cp == 6) return NULL;
+        if (*ep > '7') dec = true;
+        n8 = n8 * 8 + (*ep - '0');
+        n10 = n10 * 10 + (*ep - '0');
+    }
+    if (*ep == '.') { ep++; n8 = n10; } else
+    if (dec) return NULL;
+    if (n8 > 0177777 || name_char(*ep)) return NULL;
+    vp->v = (neg? -n8 : n8) & 0177777;
+    return ep;
+}
+
+// word following the instruction for an operand
+struct ext_t {
+    val_t x;
+    bool rel;
+};
+
+// Parses one operand, returning the 6-bit mode/register and any extra word.
+static const char *operand(const char *cp, int *mr, ext_t *ext, bool *has_ext)
+{
+    const char *ep;
+    int r, def = 0;
+    *has_ext = false;
+    cp = skip(cp);
+
+    if (cp[0] == '#') {
+        if ((cp = value(cp + 1, &ext->x)) == NULL) return NULL;
+        ext->rel = false;
+        *has_ext = true;
+        *mr = 027;
+        return cp;
+    }
+    if (cp[0] == '@') {
+        if (cp[1] == '#') {
+            if ((cp = value(cp + 2, &ext->x)) == NULL) return NULL;
+            ext->rel = false;
+            *has_ext = true;
+            *mr = 037;
+            return cp;
+        }
+        def = 010;
+        cp = skip(cp + 1);
+        if ((r = reg(cp, &ep)) >= 0) { *mr = 010 | r; return ep; }     // @r is (r)
+    }
+    if ((r = reg(cp, &ep)) >= 0) {
+        if (def) return NULL;
+        *mr = r;
+        return ep;
+    }
+    if (cp[0] == '(' && (r = reg(skip(cp + 1), &ep)) >= 0 && *(ep = skip(ep)) == ')') {
+        if (ep[1] == '+') { *mr = def | 020 | r; return ep + 2; }
+        if (def) return NULL;
+        *mr = 010 | r;
+        return ep + 1;
+    }
+    if (cp[0] == '-' && cp[1] == '(' && (r = reg(skip(cp + 2), &ep)) >= 0 && *(ep = skip(ep)) == ')') {
+        *mr = def | 040 | r;
+        return ep + 1;
+    }
+
+    // x(r) or x
+    if ((cp = value(cp, &ext->x)) == NULL) return NULL;
+    *has_ext = true;
+    ep = skip(cp);
+    if (ep[0] == '(' && (r = reg(skip(ep + 1), &ep)) >= 0 && *(ep = skip(ep)) == ')') {
+        ext->rel = false;
+        *mr = def | 060 | r;
+        return ep + 1;
+    }
+    ext->rel = true;
+    *mr = def | 067;
+    return cp;
+}
+
+static const char *comma(const char *cp)
+{
+    cp = skip(cp);
+    return (*cp == ',')? cp + 1 : NULL;
+}
+
+static const char *reg_op(const char *cp, int *r)
+{
+    const char *ep;
+    cp = skip(cp);
+    if ((*r = reg(cp, &ep)) < 0) return NULL;
+    return ep;
+}
+
+static bool at_end(const char *cp)
+{
+    cp = skip(cp);
+    return (*cp == '\0' || *cp == ';' || strncmp(cp, "//", 2) == 0);
+}
+
+// Assembles the instruction on line bp (leading whitespace removed) into lp.
+// Returns false if the line doesn't start with a mnemonic.
+bool asm_line(const char *bp, line_t *lp)
+{
+    const char *cp;
+    for (cp = bp; isalpha(*cp); cp++)
+        ;
+    const op_t *op = op_find(bp, cp - bp);
+    if (op == NULL || name_char(*cp)) return false;
+
+    int mr, mr2, r, n = 0;
+    ext_t ext[2];
+    bool has_ext, has_ext2;
+    val_t t;
+    u4_t w = op->code;
+    lp->type = L_SYNTAX;
+    lp->n = 0;
+    lp->refs = lp->rel = lp->br = 0;
+
+    switch (op->fmt) {
+    case F_NONE:
+        break;
+
+    case F_DD:
+        if ((cp = operand(cp, &mr, &ext[0], &has_ext)) == NULL) return true;
+        w |= mr;
+        n = has_ext;
+        break;
+
+    case F_SSDD:
+    case F_SSR:
+        if ((cp = operand(cp, &mr, &ext[0], &has_ext)) == NULL || (cp = comma(cp)) == NULL) return true;
+        if (op->fmt == F_SSR) {
+            if ((cp = reg_op(cp, &r)) == NULL) return true;
+            w |= (r << 6) | mr;
+            n = has_ext;
+            break;
+        }
+        if ((cp = operand(cp, &mr2, &ext[has_ext], &has_ext2)) == NULL) return true;
+        w |= (mr << 6) | mr2;
+        n = has_ext + has_ext2;
+        break;
+
+    case F_R:
+        if ((cp = reg_op(cp, &r)) == NULL) return true;
+        w |= r;
+        break;
+
+    case F_RDD:
+    case F_RDD2:
+        if ((cp = reg_op(cp, &r)) == NULL || (cp = comma(cp)) == NULL) return true;
+        if ((cp = operand(cp, &mr, &ext[0], &has_ext)) == NULL) return true;
+        w |= (r << 6) | mr;
+        n = has_ext;
+        break;
+
+    case F_BR:
+    case F_SOB:
+        r = 0;
+        if (op->fmt == F_SOB && ((cp = reg_op(cp, &r)) == NULL || (cp = comma(cp)) == NULL)) return true;
+        if ((cp = value(cp, &t)) == NULL) return true;
+        lp->br = (op->fmt == F_BR)? BR_8 : BR_SOB;
+        lp->opc = w | (r << 6);
+        lp->v[0] = t.v;
+        if (t.ref) lp->refs |= 1;
+        break;
+
+    case F_N3:
+    case F_N6:
+    case F_N8:
+        t.v = 0;
+        if (!at_end(cp) && ((cp = value(cp, &t)) == NULL || t.ref)) return true;
+        if (t.v > (u4_t) ((op->fmt == F_N3)? 07 : ((op->fmt == F_N6)? 077 : 0377))) return true;
+        w |= t.v;
+        break;
+    }
+    if (!at_end(cp)) return true;
+
+    if (!lp->br) lp->v[0] = w;
+    for (int i = 0; i < n; i++) {
+        lp->v[i+1] = ext[i].x.v;
+        if (ext[i].x.ref) lp->refs |= 2 << i;
+        if (ext[i].rel) lp->rel |= 2 << i;
+    }
+    lp->n = 1 + n;
+    lp->type = L_WORDS;
+    return true;
+}
@@ -0,0 +1,270 @@
+//
+// Corpus batch mode (txt2abs --batch dir)
+//
+// Converts every listing dir/xxx.txt in one process on a pool of threads (one per cpu unless
+// "--jobs n" is given). Each listing may have a companion dir/xxx.var naming the variants to
+// build, one per line as a list of defines (a line containing just "-" is a variant without
+// any defines). Without a .var file the listing is converted once. Each variant of xxx.txt
+// is written to dir/xxx_<defines>.abs (just dir/xxx.abs for a variant without defines), with
+// "/" in define names replaced by "_". The "--def xxx" arguments apply to every variant.
+//
+// Conversions are independent: each worker thread owns a conv_t (and so its arena) and the
+// messages of each conversion are captured separately, so a listing with errors affects only
+// its own outputs. A summary table is printed at the end, followed by the messages of any
+// conversion that had errors.
+//
+// With "--check-only" the listings are only checked by the --check-only validator (check.cpp),
+// no image is built and no .abs files are written or removed. Combined with "--run", "--loader"
+// or "--index", which need the image, they are converted but still not written.
+// With "--run K" each successful conversion is also run for K passes on the interpreter and
+// the summary gets the outcome (see run.cpp); a variant that fails its run counts as failed.
+// With "--loader file" each successful conversion is also loaded through that absolute loader
+// (see ldr.cpp); a variant that doesn't conform counts as failed.
+// With "--index corpus.idx" a pc index of all the successful conversions is written as well
+// (see index.cpp).
+//
+// Included fragments shouldn't be in dir itself (they would be converted as listings),
+// use a subdirectory.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "txt2abs.h"
+
+struct job_t {
+    char *fn_in, *fn_out, *name;
+    int n_defs;
+    char *defs[N_IFDEFS];
+    char *variant;          // for the summary
+    const char *text;       // listing, shared by the variants of a file
+
+    int errs, n_blks, img_len;
+    double ms;
+    char *log;
+    size_t log_len;
+    idx_ent_t *ents;
+    int n_ents;
+    run_t run;
+    bool ran;
+    ldr_res_t lres;
+    bool loaded;
+};
+
+static job_t *jobs;
+static int n_jobs, next_job;
+static bool build_index, check_only;
+static const run_opt_t *run_opt;
+static const ldr_t *ldr;
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void *worker(void *)
+{
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    int i;
+
+    while ((i = __sync_fetch_and_add(&next_job, 1)) < n_jobs) {
+        job_t *j = &jobs[i];
+        double t0 = now_ms();
+
+        if (check_only && !run_opt && !ldr && !build_index) {
+            FILE *fp = open_memstream(&j->log, &j->log_len);
+            char *text = strdup(j->text);       // split in place, and shared by the variants
+            j->errs = check_text(fp, j->fn_in, text, j->n_defs, j->defs, false, false);
+            free(text);
+            fclose(fp);
+            j->ms = now_ms() - t0;
+            continue;
+        }
+
+        c->fmsg = open_memstream(&j->log, &j->log_len);
+        c->fn_in = j->fn_in;
+        c->prov = build_index;
+        conv_begin(c, j->n_defs, j->defs, IMG_SIZE);
+        j->errs = conv_text(c, j->text);
+        fclose(c->fmsg);
+
+        // count blocks by walking the headers
+        for (int off = 0; off + HDR_LEN <= c->img_len; j->n_blks++)
+            off += (c->img[off+2] | (c->img[off+3] << 8)) + CKSUM_LEN;
+        j->img_len = c->img_len;
+
+        if (j->errs == 0 && build_index) j->n_ents = idx_build(c, &j->ents);
+        if (j->errs == 0 && run_opt) {
+            run_image(c->img, c->img_len, run_opt, &j->run);
+            j->ran = true;
+        }
+        if (j->errs == 0 && ldr) {
+            ldr_check(ldr, c->img, c->img_len, &j->lres);
+            j->loaded = true;
+        }
+
+        if (!check_only && j->errs == 0) {
+            FILE *fp = fopen(j->fn_out, "w");
+            if (fp == NULL || fwrite(c->img, 1, c->img_len, fp) != (size_t) c->img_len) j->errs++;
+            if (fp) fclose(fp);
+        } else
+        if (!check_only) {
+            unlink(j->fn_out);
+        }
+        j->ms = now_ms() - t0;
+    }
+
+    conv_free(c);
+    return NULL;
+}
+
+static void add_job(const char *dir, const char *name, const char *text, char *var, int n_defs, char **defs)
+{
+    job_t *j;
+    jobs = (job_t *) realloc(jobs, sizeof(job_t) * (n_jobs + 1));
+    j = &jobs[n_jobs++];
+    memset(j, 0, sizeof(*j));
+    asprintf(&j->fn_in, "%s/%s.txt", dir, name);
+    j->name = strdup(name);
+    j->text = text;
+
+    for (int i = 0; i < n_defs; i++) j->defs[j->n_defs++] = defs[i];
+
+    // variant defines, and output file name suffix from them
+    char suffix[NPATH] = "";
+    int sl = 0;
+    char *sv, *tok;
+    j->variant = strdup(var);
+    for (tok = strtok_r(var, " \t", &sv); tok; tok = strtok_r(NULL, " \t", &sv)) {
+        if (strcmp(tok, "-") == 0) continue;
+        if (j->n_defs < N_IFDEFS) j->defs[j->n_defs++] = strdup(tok);
+        sl += snprintf(suffix + sl, sizeof(suffix) - sl, "_%s", tok);
+    }
+    for (char *cp = suffix; *cp; cp++) if (*cp == '/') *cp = '_';
+    asprintf(&j->fn_out, "%s/%s%s.abs", dir, name, suffix);
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+int batch_main(const char *dir, int n_defs, char **defs, int n_threads, const char *fn_index, bool check, const run_opt_t *run,
+    const ldr_t *loader)
+{
+    DIR *dp;
+    struct dirent *de;
+    if ((dp = opendir(dir)) == NULL) { printf("opendir %s\n", dir); return -1; }
+
+    int n_names = 0, i;
+    char **names = NULL;
+    while ((de = readdir(dp)) != NULL) {
+        int len = strlen(de->d_name);
+        if (len <= 4 || strcmp(de->d_name + len - 4, ".txt") != 0) continue;
+        names = (char **) realloc(names, sizeof(char *) * (n_names + 1));
+        names[n_names++] = strndup(de->d_name, len - 4);
+    }
+    closedir(dp);
+    qsort(names, n_names, sizeof(char *), name_cmp);
+
+    for (i = 0; i < n_names; i++) {
+        char fn[NPATH];
+        FILE *fp;
+        snprintf(fn, sizeof(fn), "%s/%s.txt", dir, names[i]);
+        char *text = file_read(fn, NULL);
+        if (text == NULL) { printf("fopen R %s\n", fn); continue; }
+
+        snprintf(fn, sizeof(fn), "%s/%s.var", dir, names[i]);
+        int n_var = 0;
+        if ((fp = fopen(fn, "r")) != NULL) {
+            char buf[NBUF];
+            while (fgets(buf, NBUF, fp)) {
+                buf[strcspn(buf, "\r\n")] = '\0';
+                char *bp = buf + strspn(buf, " \t");
+                if (*bp == '\0' || strncmp(bp, "//", 2) == 0) continue;
+                add_job(dir, names[i], text, bp, n_defs, defs);
+                n_var++;
+            }
+            fclose(fp);
+        }
+        if (n_var == 0) {
+            char none[] = "-";
+            add_job(dir, names[i], text, none, n_defs, defs);
+        }
+    }
+
+    if (n_threads <= 0) n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > n_jobs) n_threads = n_jobs;
+    if (n_threads < 1) n_threads = 1;
+
+    build_index = (fn_index != NULL);
+    check_only = check;
+    run_opt = run;
+    ldr = loader;
+    double t0 = now_ms();
+    pthread_t *tids = (pthread_t *) malloc(sizeof(pthread_t) * n_threads);
+    for (i = 0; i < n_threads; i++) pthread_create(&tids[i], NULL, worker, NULL);
+    for (i = 0; i < n_threads; i++) pthread_join(tids[i], NULL);
+    double ms = now_ms() - t0;
+
+    int failed = 0;
+    printf("%-32s %-24s %5s %6s %6s %8s", "listing", "variant", "errs", "blocks", "bytes", "ms");
+    if (run) printf(" %-8s %6s %6s %6s", "run", "passes", "calls", "pc");
+    if (loader) printf(" %-8s", "loader");
+    printf("\n");
+    for (i = 0; i < n_jobs; i++) {
+        job_t *j = &jobs[i];
+        printf("%-32s %-24s %5d %6d %6d %8.2f", j->name, j->variant, j->errs, j->n_blks, j->img_len, j->ms);
+        if (j->ran) printf(" %-8s %6d %6d %06o", run_result(&j->run), j->run.passes, j->run.errs,
+            j->run.errs? j->run.err_pc : j->run.stop_pc);
+        if (j->loaded) printf(" %-8s", j->lres.why? "fails" : "conforms");
+        printf("\n");
+        if (j->errs || (j->ran && !RUN_PASSED(&j->run)) || (j->loaded && j->lres.why)) failed++;
+    }
+    printf("%d listing%s, %d conversion%s, %d failed, %.1f ms on %d thread%s\n",
+        n_names, (n_names != 1)? "s":"", n_jobs, (n_jobs != 1)? "s":"", failed, ms, n_threads, (n_threads != 1)? "s":"");
+
+    if (fn_index) {
+        idx_img_t *imgs = (idx_img_t *) calloc(n_jobs + 1, sizeof(idx_img_t));
+        idx_ent_t **ents = (idx_ent_t **) malloc(sizeof(idx_ent_t *) * (n_jobs + 1));
+        int n_imgs = 0;
+        for (i = 0; i < n_jobs; i++) {
+            job_t *j = &jobs[i];
+            if (j->errs) continue;
+            snprintf(imgs[n_imgs].name, N_NAME, "%s", j->name);
+            snprintf(imgs[n_imgs].variant, N_NAME, "%s", j->variant);
+            imgs[n_imgs].n_ents = j->n_ents;
+            ents[n_imgs++] = j->ents;
+        }
+        if (idx_write(fn_index, imgs, ents, n_imgs) == 0)
+            printf("%s: %d image%s indexed\n", fn_index, n_imgs, (n_imgs != 1)? "s":"");
+        free(imgs);
+        free(ents);
+    }
+
+    for (i = 0; i < n_jobs; i++) {
+        job_t *j = &jobs[i];
+        if (j->errs) printf("\n%s [%s]:\n%s", j->fn_in, j->variant, j->log? j->log : "");
+        if (j->ran && !RUN_PASSED(&j->run)) {
+            printf("\n%s [%s] run: ", j->fn_in, j->variant);
+            run_report(stdout, &j->run);
+        }
+        if (j->loaded && j->lres.why) {
+            printf("\n%s [%s] loader: ", j->fn_in, j->variant);
+            ldr_report(stdout, &j->lres);
+        }
+    }
+
+    return failed? -1 : 0;
+}
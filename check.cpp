@@ -0,0 +1,451 @@
+//
+// Validation without output (txt2abs --check-only)
+//
+// Usage: txt2abs [--def xxx] --check-only [--first-error] --in infile.txt
+//        txt2abs [--def xxx] --check-only --batch dir      (no .abs files written, see batch.cpp)
+//
+// Reports the same errors as a conversion (consistency checks, ranges, odd pc, syntax, #error,
+// conditional structure) plus any #if left open at the end of the file, without producing any
+// output. The exit status is non-zero if there were errors, for use in a CI or pre-commit hook.
+//
+// Works in three phases:
+// 1) the lines are parsed, in parallel chunks for a large listing
+// 2) one sequential pass evaluates the conditionals (and #include, #define, #error), producing
+//    the sequence of active lines that affect the pc
+// 3) that sequence is split at each "=" origin: as the pc is reset there each segment can be
+//    checked independently, so the segments are validated in parallel
+// Label definitions and references are then matched up in one sequential walk.
+//
+// With --first-error only the first error in file order is reported, and work past a known
+// error is skipped.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "txt2abs.h"
+
+#define N_PAR_LINES 4096        // below this many lines work is done inline, not on threads
+#define N_CHUNK 1024            // lines per parse task
+
+struct cerr_t {
+    int seq;                    // order in the file (including #include files)
+    int ord;                    // order among errors of the same line
+    const char *fn;             // #include file, NULL at top level
+    int lnum;
+    char *msg;
+};
+
+// an active line that affects the pc
+struct act_t {
+    const line_t *l;
+    const char *line, *fn;
+    int lnum, seq;
+    u4_t pc;                    // of a label definition or reference, set in phase 3
+};
+
+struct seg_t {
+    int a0, n;                  // entries of act[]
+    cerr_t *errs;
+    int n_errs;
+};
+
+struct chk_t {
+    bool first;
+    volatile int first_seq;     // lowest seq with an error so far (with --first-error)
+
+    // conditional pass
+    u4_t lvl, inside_if, ignore_input, taken;
+    u4_t def_set[N_SYMS / 32];
+    int n_defs, seq, depth;
+    cerr_t *errs;
+    int n_errs, alloc_errs;
+    act_t *act;
+    int n_act, alloc_act;
+
+    // top-level listing
+    char **lines;
+    line_t *parsed;
+    int n;
+
+    seg_t *segs;
+    int n_segs;
+};
+
+static void add_err(cerr_t **errs, int *n, int *alloc, int seq, const char *fn, int lnum, const char *fmt, ...)
+{
+    if (*n == *alloc) {
+        *alloc = *alloc * 2 + 16;
+        *errs = (cerr_t *) realloc(*errs, sizeof(cerr_t) * *alloc);
+    }
+    cerr_t *e = &(*errs)[(*n)++];
+    e->seq = seq;
+    e->ord = *n;
+    e->fn = fn;
+    e->lnum = lnum;
+    va_list ap;
+    va_start(ap, fmt);
+    vasprintf(&e->msg, fmt, ap);
+    va_end(ap);
+}
+
+static void first_at(chk_t *ck, int seq)
+{
+    int cur;
+    while (seq < (cur = ck->first_seq))
+        if (__sync_bool_compare_and_swap(&ck->first_seq, cur, seq)) break;
+}
+
+
+// simple thread pool: calls fn(arg, i) for i in [0, n)
+
+struct pool_t {
+    void (*fn)(void *, int);
+    void *arg;
+    int n, next;
+};
+
+static void *pool_worker(void *a)
+{
+    pool_t *p = (pool_t *) a;
+    int i;
+    while ((i = __sync_fetch_and_add(&p->next, 1)) < p->n) p->fn(p->arg, i);
+    return NULL;
+}
+
+static void pool_run(int n, bool par, void (*fn)(void *, int), void *arg)
+{
+    pool_t p = { fn, arg, n, 0 };
+    int nt = par? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    if (nt > n) nt = n;
+    if (nt <= 1) { pool_worker(&p); return; }
+
+    pthread_t *tids = (pthread_t *) malloc(sizeof(pthread_t) * nt);
+    for (int i = 0; i < nt; i++) pthread_create(&tids[i], NULL, pool_worker, &p);
+    for (int i = 0; i < nt; i++) pthread_join(tids[i], NULL);
+    free(tids);
+}
+
+
+// phase 1
+
+static void parse_chunk(void *arg, int k)
+{
+    chk_t *ck = (chk_t *) arg;
+    int end = (k + 1) * N_CHUNK;
+    if (end > ck->n) end = ck->n;
+    for (int i = k * N_CHUNK; i < end; i++) {
+        const char *bp = ck->lines[i];
+        while (*bp != '\0' && isspace(*bp)) bp++;
+        parse_line(bp, &ck->parsed[i]);
+    }
+}
+
+
+// phase 2, mirrors the conditional handling of conv_parsed()
+
+#define CERR(fmt, ...) { \
+    add_err(&ck->errs, &ck->n_errs, &ck->alloc_errs, ck->seq, fn, lnum, fmt, ##__VA_ARGS__); \
+    if (ck->first) first_at(ck, ck->seq); }
+
+static void cond_pass(chk_t *ck, const char *fn_from, const char *fn, char **lines, const line_t *parsed, int n)
+{
+    for (int i = 0; i < n; i++) {
+        const line_t *l = &parsed[i];
+        const char *line = lines[i];
+        int lnum = i + 1;
+        bool t;
+        ck->seq++;
+        if (ck->first && ck->seq > ck->first_seq) return;
+
+        switch (l->type) {
+
+        case L_BLANK: case L_PAGE:
+            continue;
+
+        case L_ELSE:
+            if (!(ck->inside_if & ck->lvl)) { CERR("#else not inside #if"); continue; }
+            if (ck->taken & ck->lvl) ck->ignore_input |= ck->lvl; else ck->ignore_input &= ~ck->lvl;
+            ck->taken |= ck->lvl;
+            continue;
+
+        case L_ELIF:
+            if (!(ck->inside_if & ck->lvl)) { CERR("#elif not inside #if"); continue; }
+            if ((ck->taken & ck->lvl) || !cond_eval(l->v[0], ck->def_set)) { ck->ignore_input |= ck->lvl; continue; }
+            ck->ignore_input &= ~ck->lvl;
+            ck->taken |= ck->lvl;
+            continue;
+
+        case L_ENDIF:
+            ck->inside_if &= ~ck->lvl;
+            ck->ignore_input &= ~ck->lvl;
+            ck->taken &= ~ck->lvl;
+            ck->lvl >>= 1;
+            if (ck->lvl == 0) { CERR("#endif without corresponding #if"); ck->lvl = 1; }
+            continue;
+
+        case L_IF1: case L_IF0: case L_IF: case L_IFDEF:
+            if (l->type == L_IFDEF) {
+                int s = cond_sym(l->name);
+                t = (s >= 0) && ((ck->def_set[s >> 5] >> (s & 31)) & 1);
+            } else
+                t = (l->type == L_IF)? cond_eval(l->v[0], ck->def_set) : (l->type == L_IF1);
+            ck->lvl <<= 1;
+            ck->inside_if |= ck->lvl;
+            if (t) { ck->ignore_input &= ~ck->lvl; ck->taken |= ck->lvl; } else { ck->ignore_input |= ck->lvl; ck->taken &= ~ck->lvl; }
+            continue;
+
+        default: break;
+        }
+
+        if (ck->ignore_input) continue;
+
+        switch (l->type) {
+
+        case L_DEFINE:
+            if (ck->n_defs >= N_IFDEFS || !cond_set_add(ck->def_set, l->name)) CERR("too many defines") else ck->n_defs++;
+            continue;
+
+        case L_ERROR: CERR("\"%s\"", line + strspn(line, " \t")); continue;
+        case L_WARNING: continue;
+
+        case L_INCLUDE: {
+            char path[NPATH];
+            inc_path(path, fn_from, l->name);
+            if (ck->depth >= N_INC_DEPTH) { CERR("#include nested too deeply \"%s\"", path); continue; }
+            inc_t *inc = inc_load(path);
+            if (inc == NULL) { CERR("can't open #include file \"%s\"", path); continue; }
+            ck->depth++;
+            cond_pass(ck, inc->path, inc->path, inc->lines, inc->parsed, inc->n);
+            ck->depth--;
+            continue;
+        }
+
+        default: break;
+        }
+
+        if (ck->n_act == ck->alloc_act) {
+            ck->alloc_act = ck->alloc_act * 2 + 1024;
+            ck->act = (act_t *) realloc(ck->act, sizeof(act_t) * ck->alloc_act);
+        }
+        act_t *a = &ck->act[ck->n_act++];
+        a->l = l;
+        a->line = line;
+        a->fn = fn;
+        a->lnum = lnum;
+        a->seq = ck->seq;
+    }
+}
+
+
+// phase 3, mirrors the pc handling of conv_parsed()
+
+#define SERR(fmt, ...) { \
+    add_err(&sg->errs, &sg->n_errs, &alloc, a->seq, a->fn, a->lnum, fmt, ##__VA_ARGS__); \
+    if (ck->first) { first_at(ck, a->seq); return; } }
+
+static void check_seg(void *arg, int k)
+{
+    chk_t *ck = (chk_t *) arg;
+    seg_t *sg = &ck->segs[k];
+    u4_t pc = 0, chk;
+    int alloc = 0;
+
+    for (int i = sg->a0; i < sg->a0 + sg->n; i++) {
+        act_t *a = &ck->act[i];
+        const line_t *l = a->l;
+        if (ck->first && a->seq > ck->first_seq) return;
+
+        switch (l->type) {
+
+        case L_ORG:
+            if (l->v[0] > 0177777) SERR("range norg=%06o", l->v[0]);
+            pc = l->v[0];
+            break;
+
+        case L_CHK_CUR:
+            chk = l->v[0];
+            if (chk > 0177777) SERR("'::' range chk=%06o", chk);
+            if (pc != chk) SERR("consistency check, expecting pc=%06o but \":: %06o\" specified", pc, chk);
+            break;
+
+        case L_CHK_PREV:
+            chk = l->v[0];
+            if (chk > 0177777) SERR("':' range chk=%06o", chk);
+            if ((int) pc - 2 != (int) chk) SERR("consistency check, expecting (pc-2)=%06o but \": %06o\" specified", pc - 2, chk);
+            break;
+
+        case L_BYTE:
+            if (l->v[0] > 0377) SERR("range b=%04o", l->v[0]);
+            pc += 1;
+            break;
+
+        case L_LABEL:
+            a->pc = pc;
+            break;
+
+        case L_WORDS:
+            for (int j = 0; j < l->n; j++)
+                if (!((l->refs >> j) & 1) && l->v[j] > 0177777) SERR("range w%d=%06o", j, l->v[j]);
+            if (pc & 1) SERR("odd pc=%06o", pc);
+            a->pc = pc;
+            if (l->br && !(l->refs & 1) && lab_word(l, 0, pc, l->v[0]) < 0) SERR("branch to %06o out of range", l->v[0]);
+            pc += l->n * 2;
+            break;
+
+        default:
+            SERR("syntax error \"%s\"", a->line);
+            break;
+        }
+    }
+}
+
+// mirrors lab_define() and lab_end(): duplicates where defined, branches out of range where
+// both are known, undefined references at the end
+static void check_labels(chk_t *ck, int seq_end)
+{
+    int i, j, n_labs = lab_count();
+    int *def = NULL;
+
+    for (i = 0; i < ck->n_act; i++) {
+        act_t *a = &ck->act[i];
+        const line_t *l = a->l;
+        if (l->type != L_LABEL && !(l->type == L_WORDS && l->refs)) continue;
+        if (ck->first && a->seq > ck->first_seq) break;
+        if (def == NULL) {
+            def = (int *) malloc(sizeof(int) * n_labs);
+            for (j = 0; j < n_labs; j++) def[j] = -1;
+        }
+        if (l->type == L_LABEL) {
+            int d = def[l->v[0]];
+            if (d >= 0)
+                add_err(&ck->errs, &ck->n_errs, &ck->alloc_errs, a->seq, a->fn, a->lnum,
+                    "label \"%s\" already defined as %06o", lab_name(l->v[0]), ck->act[d].pc);
+            else
+                def[l->v[0]] = i;
+        }
+    }
+    if (def == NULL) return;
+
+    for (i = 0; i < ck->n_act; i++) {
+        act_t *a = &ck->act[i];
+        const line_t *l = a->l;
+        if (l->type != L_WORDS || l->refs == 0) continue;
+        if (ck->first && a->seq > ck->first_seq) break;
+        if ((l->refs & 1) && l->br && def[l->v[0]] >= 0) {
+            act_t *d = &ck->act[def[l->v[0]]];
+            if (lab_word(l, 0, a->pc, d->pc) < 0)
+                add_err(&ck->errs, &ck->n_errs, &ck->alloc_errs, (d < a)? a->seq : d->seq, a->fn, a->lnum,
+                    "branch to %06o out of range", d->pc);
+        }
+        for (j = 0; j < l->n; j++)
+            if (((l->refs >> j) & 1) && def[l->v[j]] < 0)
+                add_err(&ck->errs, &ck->n_errs, &ck->alloc_errs, seq_end, a->fn, a->lnum,
+                    "undefined label \"%s\"", lab_name(l->v[j]));
+    }
+    free(def);
+}
+
+static int err_cmp(const void *a, const void *b)
+{
+    const cerr_t *ea = (const cerr_t *) a, *eb = (const cerr_t *) b;
+    return (ea->seq != eb->seq)? ea->seq - eb->seq : ea->ord - eb->ord;
+}
+
+// Checks one listing held in text (modified). Prints the errors to fp, returns the count. Unless
+// par, everything is done on the calling thread (--batch already has a thread per listing).
+int check_text(FILE *fp, const char *fn_in, char *text, int n_defs, char **defs, bool first, bool par)
+{
+    chk_t chk, *ck = &chk;
+    int i, n = 0;
+    memset(ck, 0, sizeof(*ck));
+    ck->first = first;
+    ck->first_seq = 0x7fffffff;
+    ck->lvl = 1;
+    for (i = 0; i < n_defs; i++) {
+        if (ck->n_defs < N_IFDEFS && cond_set_add(ck->def_set, defs[i])) ck->n_defs++;
+    }
+
+    // split as conv_text() does (lines longer than NBUF are truncated)
+    for (char *cp = text; *cp; n++) {
+        char *e = strchr(cp, '\n');
+        cp = e? e+1 : cp + strlen(cp);
+    }
+    ck->lines = (char **) malloc(sizeof(char *) * (n + 1));
+    ck->parsed = (line_t *) malloc(sizeof(line_t) * (n + 1));
+    char *cp = text;
+    for (i = 0; i < n; i++) {
+        char *e = strchr(cp, '\n');
+        if (e) *e = '\0';
+        if (strlen(cp) >= NBUF) cp[NBUF-1] = '\0';
+        ck->lines[i] = cp;
+        cp = e? e+1 : cp + strlen(cp);
+    }
+    ck->n = n;
+    par = par && (n >= N_PAR_LINES);
+
+    pool_run((n + N_CHUNK - 1) / N_CHUNK, par, parse_chunk, ck);
+
+    cond_pass(ck, fn_in, NULL, ck->lines, ck->parsed, n);
+    if (ck->lvl != 1 && !(first && ck->n_errs))
+        add_err(&ck->errs, &ck->n_errs, &ck->alloc_errs, ck->seq + 1, NULL, n, "#if without corresponding #endif");
+
+    // segments start at each origin
+    ck->segs = (seg_t *) calloc(ck->n_act + 1, sizeof(seg_t));
+    for (i = 0; i < ck->n_act; i++) {
+        if (i == 0 || ck->act[i].l->type == L_ORG) ck->segs[ck->n_segs++].a0 = i;
+        ck->segs[ck->n_segs - 1].n++;
+    }
+    pool_run(ck->n_segs, par, check_seg, ck);
+    check_labels(ck, ck->seq + 2);
+
+    // all errors in file order
+    int n_errs = ck->n_errs;
+    for (i = 0; i < ck->n_segs; i++) n_errs += ck->segs[i].n_errs;
+    cerr_t *all = (cerr_t *) malloc(sizeof(cerr_t) * (n_errs + 1));
+    memcpy(all, ck->errs, sizeof(cerr_t) * ck->n_errs);
+    n = ck->n_errs;
+    for (i = 0; i < ck->n_segs; i++) {
+        memcpy(&all[n], ck->segs[i].errs, sizeof(cerr_t) * ck->segs[i].n_errs);
+        n += ck->segs[i].n_errs;
+        free(ck->segs[i].errs);
+    }
+    qsort(all, n_errs, sizeof(cerr_t), err_cmp);
+    if (first && n_errs > 1) n_errs = 1;
+
+    for (i = 0; i < n; i++) {
+        if (i < n_errs) {
+            if (all[i].fn) fprintf(fp, "%s ", all[i].fn);
+            fprintf(fp, "line %d ERROR: %s\n", all[i].lnum, all[i].msg);
+        }
+        free(all[i].msg);
+    }
+
+    free(all);
+    free(ck->errs);
+    free(ck->act);
+    free(ck->segs);
+    free(ck->lines);
+    free(ck->parsed);
+    return n_errs;
+}
+
+int check_main(const char *fn_in, int n_defs, char **defs, bool first)
+{
+    if (!conv_is_listing(fn_in)) { printf("%s: --check-only needs the listing (.txt)\n", fn_in); return -1; }
+    char *text = file_read(fn_in, NULL);
+    if (text == NULL) { printf("fopen R %s\n", fn_in); return -1; }
+
+    int errs = check_text(stdout, fn_in, text, n_defs, defs, first, true);
+    printf("%d error%s\n", errs, (errs != 1)? "s":"");
+    free(text);
+    return errs? 1 : 0;
+}
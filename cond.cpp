@@ -0,0 +1,255 @@
+//
+// #if / #elif expressions
+//
+// Syntax:  expr := and { "||" and }
+//          and  := unary { "&&" unary }
+//          unary := "!" unary | "(" expr ")" | "defined(" name ")" | "defined" name | number
+//
+// A name is any run of characters other than whitespace and "()!&|", so "defined(11/34)"
+// works as expected. A bare name is a syntax error rather than silently false.
+// A trailing "// comment" is allowed.
+//
+// Each distinct expression is compiled once per run into a few bytes of stack code with
+// short-circuit jumps, referring to defines by an interned symbol number. A conversion keeps
+// its define set as a bitmap over symbol numbers, so evaluating an expression for a variant
+// is a handful of bit tests with no string compares. The tables are shared by all
+// conversions (and threads) of a run, like the #include cache.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "txt2abs.h"
+
+enum op_e { OP_END, OP_DEF, OP_CONST, OP_NOT, OP_JZ, OP_JNZ, OP_POP };
+
+#define N_CODE (64 * 1024)
+#define N_PROGS 4096
+#define N_PROG_CODE 256
+#define N_DEPTH 32
+
+static pthread_mutex_t cond_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// symbols: open addressing, N_SYMS*2 slots
+static char *syms[N_SYMS];
+static int n_syms;
+static short sym_slot[N_SYMS * 2];
+
+// programs: code offset, keyed by expression text
+static u1_t code[N_CODE];
+static int n_code;
+static struct { char *text; int off; } progs[N_PROGS];
+static int n_progs;
+static short prog_slot[N_PROGS * 2];
+
+static int sym_locked(const char *name, int len)
+{
+    u4_t h = hash_mem(name, len) % (N_SYMS * 2);
+    for (;; h = (h + 1) % (N_SYMS * 2)) {
+        int s = sym_slot[h] - 1;
+        if (s < 0) break;
+        if (strncmp(syms[s], name, len) == 0 && syms[s][len] == '\0') return s;
+    }
+    if (n_syms == N_SYMS) return -1;
+    syms[n_syms] = strndup(name, len);
+    sym_slot[h] = ++n_syms;
+    return n_syms - 1;
+}
+
+// interned number of a define name, -1 if the table is full
+int cond_sym(const char *name)
+{
+    pthread_mutex_lock(&cond_lock);
+    int s = sym_locked(name, strlen(name));
+    pthread_mutex_unlock(&cond_lock);
+    return s;
+}
+
+
+// compiler
+
+struct comp_t {
+    const char *cp;
+    u1_t pc[N_PROG_CODE];
+    int n, depth;
+    bool err;
+};
+
+static void emit(comp_t *cm, int b)
+{
+    if (cm->n < N_PROG_CODE) cm->pc[cm->n++] = b; else cm->err = true;
+}
+
+static void skip_ws(comp_t *cm)
+{
+    while (*cm->cp == ' ' || *cm->cp == '\t') cm->cp++;
+}
+
+static bool is_name(int ch)
+{
+    return ch != '\0' && !isspace(ch) && strchr("()!&|", ch) == NULL;
+}
+
+static void comp_or(comp_t *cm);
+
+static void comp_unary(comp_t *cm)
+{
+    skip_ws(cm);
+    if (++cm->depth > N_DEPTH) { cm->err = true; return; }
+
+    if (*cm->cp == '!') {
+        cm->cp++;
+        comp_unary(cm);
+        emit(cm, OP_NOT);
+    } else
+    if (*cm->cp == '(') {
+        cm->cp++;
+        comp_or(cm);
+        skip_ws(cm);
+        if (*cm->cp++ != ')') cm->err = true;
+    } else
+    if (isdigit(*cm->cp)) {
+        char *ep;
+        long v = strtol(cm->cp, &ep, 0);
+        cm->cp = ep;
+        emit(cm, OP_CONST);
+        emit(cm, v != 0);
+    } else
+    if (strncmp(cm->cp, "defined", 7) == 0 && !is_name(cm->cp[7])) {
+        cm->cp += 7;
+        skip_ws(cm);
+        bool paren = (*cm->cp == '(');
+        if (paren) { cm->cp++; skip_ws(cm); }
+        const char *name = cm->cp;
+        while (is_name(*cm->cp)) cm->cp++;
+        int s = (cm->cp > name)? sym_locked(name, cm->cp - name) : -1;
+        if (s < 0) { cm->err = true; return; }
+        if (paren) {
+            skip_ws(cm);
+            if (*cm->cp++ != ')') cm->err = true;
+        }
+        emit(cm, OP_DEF);
+        emit(cm, s & 0xff);
+        emit(cm, s >> 8);
+    } else
+        cm->err = true;
+
+    cm->depth--;
+}
+
+// "a && b": a, JZ end, POP, b, end:   (and likewise "||" with JNZ)
+static void comp_binary(comp_t *cm, int op, void (*operand)(comp_t *))
+{
+    const char *tok = (op == OP_JZ)? "&&" : "||";
+    operand(cm);
+    for (skip_ws(cm); !cm->err && strncmp(cm->cp, tok, 2) == 0; skip_ws(cm)) {
+        cm->cp += 2;
+        emit(cm, op);
+        int fix = cm->n;
+        emit(cm, 0);
+        emit(cm, OP_POP);
+        operand(cm);
+        if (cm->n - fix > 255) { cm->err = true; return; }
+        if (!cm->err) cm->pc[fix] = cm->n - fix;
+    }
+}
+
+static void comp_and(comp_t *cm) { comp_binary(cm, OP_JZ, comp_unary); }
+static void comp_or(comp_t *cm) { comp_binary(cm, OP_JNZ, comp_and); }
+
+// Program number of expression text (compiled on first use), or -1 on a syntax error.
+int cond_compile(const char *expr)
+{
+    int len = strlen(expr);
+    while (len > 0 && isspace(expr[len-1])) len--;
+    const char *cmt = strstr(expr, "//");
+    if (cmt && cmt - expr < len) {
+        len = cmt - expr;
+        while (len > 0 && isspace(expr[len-1])) len--;
+    }
+
+    pthread_mutex_lock(&cond_lock);
+    int p = -1;
+    u4_t h = hash_mem(expr, len) % (N_PROGS * 2);
+    for (;; h = (h + 1) % (N_PROGS * 2)) {
+        int i = prog_slot[h] - 1;
+        if (i < 0) break;
+        if (strncmp(progs[i].text, expr, len) == 0 && progs[i].text[len] == '\0') { p = i; goto done; }
+    }
+
+    {
+        comp_t cm;
+        char *text = strndup(expr, len);
+        memset(&cm, 0, sizeof(cm));
+        cm.cp = text;
+        comp_or(&cm);
+        skip_ws(&cm);
+        if (*cm.cp != '\0') cm.err = true;
+        emit(&cm, OP_END);
+
+        if (cm.err || n_progs == N_PROGS || n_code + cm.n > N_CODE) { free(text); goto done; }
+        memcpy(&code[n_code], cm.pc, cm.n);
+        progs[n_progs].text = text;
+        progs[n_progs].off = n_code;
+        n_code += cm.n;
+        p = n_progs++;
+        prog_slot[h] = n_progs;
+    }
+
+done:
+    pthread_mutex_unlock(&cond_lock);
+    return p;
+}
+
+// Evaluates program p against a define set (bitmap over symbol numbers).
+bool cond_eval(int p, const u4_t *set)
+{
+    const u1_t *pc = &code[progs[p].off];
+    int stk[N_DEPTH * 2], sp = 0, s;
+
+    for (;;) {
+        switch (*pc++) {
+        case OP_END: return stk[sp-1];
+        case OP_DEF: s = pc[0] | (pc[1] << 8); pc += 2; stk[sp++] = (set[s >> 5] >> (s & 31)) & 1; break;
+        case OP_CONST: stk[sp++] = *pc++; break;
+        case OP_NOT: stk[sp-1] = !stk[sp-1]; break;
+        case OP_JZ: if (!stk[sp-1]) pc += pc[0]; else pc++; break;
+        case OP_JNZ: if (stk[sp-1]) pc += pc[0]; else pc++; break;
+        case OP_POP: sp--; break;
+        }
+    }
+}
+
+// the symbols program p tests, returns the count
+int cond_syms(int p, int *syms, int max)
+{
+    const u1_t *pc = &code[progs[p].off];
+    int n = 0;
+    for (; *pc != OP_END; pc++) {
+        switch (*pc) {
+        case OP_DEF: if (n < max) syms[n++] = pc[1] | (pc[2] << 8); pc += 2; break;
+        case OP_CONST: case OP_JZ: case OP_JNZ: pc++; break;
+        default: break;
+        }
+    }
+    return n;
+}
+
+const char *cond_name(int s)
+{
+    return syms[s];
+}
+
+bool cond_set_add(u4_t *set, const char *name)
+{
+    int s = cond_sym(name);
+    if (s < 0) return false;
+    set[s >> 5] |= 1 << (s & 31);
+    return true;
+}
@@ -0,0 +1,751 @@
+//
+// txt2abs conversion core
+//
+// All state of a conversion lives in a conv_t so several conversions can run in one process.
+// Everything a conversion allocates (define names, the block buffer, an in-memory output image,
+// provenance records)
+// comes from a bump-pointer arena owned by the conv_t and is released in one shot by the next
+// conv_begin(). The arena starts with one ARENA_CHUNK and grows by chunks while a conversion needs
+// more; the release then replaces them with a single chunk holding them all, so re-using a conv_t
+// for further conversions does no malloc at all once it has seen the largest.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "txt2abs.h"
+
+
+// arena
+
+// header of each malloc()ed chunk, the memory handed out follows
+struct arena_chunk_t {
+    arena_chunk_t *prev;
+    int size;
+};
+
+static bool arena_chunk(arena_t *a, int size)
+{
+    arena_chunk_t *ch = (arena_chunk_t *) malloc(sizeof(arena_chunk_t) + size);
+    if (ch == NULL) return false;
+    ch->prev = a->chunk;
+    ch->size = size;
+    a->chunk = ch;
+    a->base = (u1_t *) (ch + 1);
+    a->size = size;
+    a->used = 0;
+    a->total += size;
+    return true;
+}
+
+// mem NULL: malloc()ed chunks of at least size bytes, as needed
+void arena_init(arena_t *a, void *mem, int size)
+{
+    memset(a, 0, sizeof(*a));
+    if (mem) {
+        a->base = (u1_t *) mem;
+        a->size = size;
+    } else {
+        a->grow = true;
+        arena_chunk(a, size);
+    }
+}
+
+// Releases everything allocated. A grown arena is replaced by one chunk the size of all of it.
+void arena_release(arena_t *a)
+{
+    a->used = 0;
+    if (!a->grow || (a->chunk && a->chunk->prev == NULL)) return;
+    int total = a->total;
+    arena_free(a);
+    arena_chunk(a, total);
+}
+
+void arena_free(arena_t *a)
+{
+    if (!a->grow) return;
+    for (arena_chunk_t *ch = a->chunk, *prev; ch; ch = prev) {
+        prev = ch->prev;
+        free(ch);
+    }
+    a->chunk = NULL;
+    a->base = NULL;
+    a->size = a->used = a->total = 0;
+}
+
+// returns NULL when the arena is full (and can't grow)
+void *arena_alloc(arena_t *a, int n)
+{
+    int used = (a->used + 7) & ~7;
+    if (used + n > a->size) {
+        if (!a->grow || !arena_chunk(a, (n > a->size)? n : a->size)) return NULL;
+        used = 0;
+    }
+    a->used = used + n;
+    return a->base + used;
+}
+
+char *arena_strdup(arena_t *a, const char *s)
+{
+    int n = strlen(s) + 1;
+    char *d = (char *) arena_alloc(a, n);
+    if (d) memcpy(d, s, n);
+    return d;
+}
+
+
+// messages
+
+static void cprintf(conv_t *c, const char *fmt, ...)
+{
+    if (c->fmsg == NULL) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(c->fmsg, fmt, ap);
+    va_end(ap);
+}
+
+static void vmsg(conv_t *c, const char *type, const char *fmt, va_list ap)
+{
+    if (c->fmsg == NULL) return;
+    if (c->fn_cur)
+        fprintf(c->fmsg, "%s ", c->fn_cur);     // inside #include
+    if (c->list)
+        fprintf(c->fmsg, "line #%d:              | %s: ", c->lnum, type);
+    else
+        fprintf(c->fmsg, "line %d %s: ", c->lnum, type);
+    vfprintf(c->fmsg, fmt, ap);
+    fprintf(c->fmsg, "\n");
+}
+
+void error(conv_t *c, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vmsg(c, "ERROR", fmt, ap);
+	c->errs++;
+	va_end(ap);
+
+	if (!c->rm && c->fn_out) {
+	    unlink(c->fn_out);
+	    c->rm = true;
+	}
+}
+
+void note(conv_t *c, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vmsg(c, "NOTE", fmt, ap);
+	va_end(ap);
+}
+
+
+// absolute format output
+
+#define write_le(sp, w) *sp++ = (w) & 0xff; *sp++ = ((w) >> 8) & 0xff;
+#define writeHL_le(sp, w) sp ## L = (w) & 0xff; sp ## H = ((w) >> 8) & 0xff;
+
+void write_abs(conv_t *c, abs_t type)
+{
+    blk_t *blk = c->blk;
+
+    if (type == ABS_BLK) {
+        if (!c->have_blk) return;
+    } else
+    if (type == ABS_HALT) {
+        c->org = 1;    // halt if addr of block is odd
+    }
+
+    writeHL_le(blk->sig, ABS_SIG);
+    int len = (int) (c->sp - blk->data);
+    int tlen = len + HDR_LEN + CKSUM_LEN;
+    writeHL_le(blk->len, tlen - CKSUM_LEN)
+    writeHL_le(blk->addr, c->org)
+
+    u4_t cksum = ABS_SIG + blk->lenL + blk->lenH + blk->addrL + blk->addrH;
+    for (int i = 0; i < len; i++) cksum += blk->data[i];
+    cksum = (0x100 - (cksum & 0xff)) & 0xff;
+    *c->sp = cksum;
+
+    if (c->fwp) {
+        if (fwrite(blk, 1, tlen, c->fwp) != (size_t) tlen) cprintf(c, "write error\n");
+    } else
+    if (c->img) {
+        if (c->img_len + tlen > c->img_size) {
+            error(c, "image overflow, more than %d bytes", c->img_size);
+        } else {
+            memcpy(c->img + c->img_len, blk, tlen);
+            c->img_len += tlen;
+        }
+    }
+    lab_blk_written(c, c->abs_off, tlen, cksum);
+    if (c->list)
+        cprintf(c, "wrote %s org %06o len %06o cksum %04o(0x%02x)\n\n",
+            (type == ABS_BLK)? "BLK" : "HALT", c->org, len, cksum, cksum);
+
+    if (c->prov && type == ABS_BLK) {
+        if (c->n_pblks == N_PROV_BLKS) {
+            error(c, "more than %d blocks for provenance", N_PROV_BLKS);
+        } else {
+            prov_blk_t *pb = &c->pblks[c->n_pblks++];
+            pb->off = c->abs_off;
+            pb->org = c->org;
+            pb->len = len;
+            pb->run0 = c->blk_run0;
+            pb->n_runs = c->n_runs - c->blk_run0;
+        }
+        c->blk_run0 = c->n_runs;
+    }
+    c->abs_off += tlen;
+
+    c->have_blk = false;
+    c->sp = blk->data;
+    c->org = c->pc;
+}
+
+// Writes a single block of n data bytes (n = 0 for the final block, whose addr is the start
+// address, odd to halt).
+int abs_block(FILE *fp, u4_t addr, const u1_t *data, int n)
+{
+    u1_t hdr[HDR_LEN];
+    u1_t *sp = hdr;
+    write_le(sp, ABS_SIG);
+    write_le(sp, n + HDR_LEN);
+    write_le(sp, addr);
+    u4_t cksum = 0;
+    for (int i = 0; i < HDR_LEN; i++) cksum += hdr[i];
+    for (int i = 0; i < n; i++) cksum += data[i];
+    u1_t ck = (0x100 - (cksum & 0xff)) & 0xff;
+    if (fwrite(hdr, 1, HDR_LEN, fp) != HDR_LEN || fwrite(data, 1, n, fp) != (size_t) n || fwrite(&ck, 1, 1, fp) != 1) return -1;
+    return 0;
+}
+
+// Loads an image in absolute format into mem[ABS_MEM], setting loaded[] for each byte written
+// (either may be NULL). Returns the start address of the final block (odd: halt), -1 if
+// there isn't one, or -2 on a bad signature or checksum.
+int abs_load(const u1_t *img, int len, u1_t *mem, u1_t *loaded)
+{
+    int off = 0;
+    while (off + HDR_LEN + CKSUM_LEN <= len) {
+        const u1_t *bp = &img[off];
+        int blen = bp[2] | (bp[3] << 8);
+        u4_t addr = bp[4] | (bp[5] << 8);
+        if (bp[0] != ABS_SIG || bp[1] != 0 || blen < HDR_LEN || off + blen + CKSUM_LEN > len) return -2;
+        u4_t cksum = 0;
+        for (int i = 0; i <= blen; i++) cksum += bp[i];
+        if (cksum & 0xff) return -2;
+        if (blen == HDR_LEN) return addr;
+        for (int i = HDR_LEN; i < blen; i++, addr++) {
+            if (addr >= ABS_MEM) break;
+            if (mem) mem[addr] = bp[i];
+            if (loaded) loaded[addr] = 1;
+        }
+        off += blen + CKSUM_LEN;
+    }
+    return -1;
+}
+
+// Records that n bytes at the current pc came from the current line. Consecutive bytes from
+// the same line extend the previous run.
+void prov_add(conv_t *c, int n)
+{
+    if (!c->prov) return;
+    prov_run_t *r = c->n_runs? &c->runs[c->n_runs - 1] : NULL;
+    if (r && c->n_runs > c->blk_run0 && r->line == c->lnum && r->addr + r->n == c->pc) {
+        r->n += n;
+        return;
+    }
+    if (c->n_runs == N_PROV_RUNS) { error(c, "more than %d runs for provenance", N_PROV_RUNS); return; }
+    r = &c->runs[c->n_runs++];
+    r->addr = c->pc;
+    r->n = n;
+    r->line = c->lnum;
+    r->page = c->page;
+    r->blk = c->n_pblks;
+}
+
+
+// input
+
+// same as sscanf(cp, "%o", v), returns pointer past the number or NULL if none
+static const char *octal(const char *cp, u4_t *v)
+{
+    const char *dp = cp;
+    while (*dp == ' ' || *dp == '\t') dp++;
+
+    // plain digits that can't overflow don't need the generality of strtoul()
+    u4_t n = 0;
+    int nd;
+    for (nd = 0; nd < 10 && *dp >= '0' && *dp <= '7'; nd++) n = (n << 3) | (*dp++ - '0');
+    if (nd > 0 && nd < 10 && !(*dp >= '0' && *dp <= '9')) { *v = n; return dp; }
+
+    char *ep;
+    *v = strtoul(cp, &ep, 8);
+    return (ep != cp)? ep : NULL;
+}
+
+static bool lab_start(int ch)
+{
+    return isalpha(ch) || ch == '_' || ch == '.' || ch == '$';
+}
+
+static const char *lab_end_of(const char *cp)
+{
+    while (isalnum(*cp) || *cp == '_' || *cp == '.' || *cp == '$') cp++;
+    return cp;
+}
+
+// one word value: octal or a label reference
+static const char *word(const char *cp, line_t *lp)
+{
+    const char *dp = cp;
+    while (*dp == ' ' || *dp == '\t') dp++;
+    if ((*dp == '&' || *dp == '%') && lab_start(dp[1])) {
+        const char *ep = lab_end_of(dp + 1);
+        lp->v[lp->n] = lab_sym(dp + 1, ep - dp - 1);
+        lp->refs |= 1 << lp->n;
+        if (*dp == '%') lp->rel |= 1 << lp->n;
+        return ep;
+    }
+    return octal(cp, &lp->v[lp->n]);
+}
+
+// "name:" alone on a line (optionally followed by a comment)
+static bool label_def(const char *bp, line_t *lp)
+{
+    if (!lab_start(*bp)) return false;
+    const char *ep = lab_end_of(bp);
+    if (*ep != ':') return false;
+    const char *cp = ep + 1;
+    while (*cp == ' ' || *cp == '\t') cp++;
+    if (*cp != '\0' && strncmp(cp, "//", 2) != 0 && *cp != ';') return false;
+    lp->type = L_LABEL;
+    lp->v[0] = lab_sym(bp, ep - bp);
+    snprintf(lp->name, N_NAME, "%.*s", (int) (ep - bp), bp);
+    return true;
+}
+
+// Dispatches on the first character: apart from a line of words (which can't start with any
+// of these characters) each kind of line is recognized by exactly one first character.
+void parse_line(const char *bp, line_t *lp)
+{
+    lp->n = 0;
+    lp->refs = lp->rel = lp->br = 0;
+    lp->name[0] = '\0';
+
+    switch (*bp) {
+
+    case '\0': lp->type = L_BLANK; return;
+
+    case '/':
+        if (bp[1] != '/') break;
+        const char *cp;
+        for (cp = bp + 2; isspace(*cp); cp++)
+            ;
+        lp->type = (*cp == 'p' && sscanf(bp, "// page %u", &lp->v[0]) == 1)? L_PAGE : L_BLANK;
+        return;
+
+    case '#':
+        if (strcmp(bp, "#else") == 0) { lp->type = L_ELSE; return; }
+        if (strcmp(bp, "#endif") == 0) { lp->type = L_ENDIF; return; }
+        if (strcmp(bp, "#if 1") == 0) { lp->type = L_IF1; return; }
+        if (strcmp(bp, "#if 0") == 0) { lp->type = L_IF0; return; }
+        if (strncmp(bp, "#if", 3) == 0 && isspace(bp[3])) {
+            int p = cond_compile(bp + 4);
+            lp->v[0] = p;
+            lp->type = (p >= 0)? L_IF : L_SYNTAX;
+            return;
+        }
+        if (strncmp(bp, "#elif", 5) == 0 && isspace(bp[5])) {
+            int p = cond_compile(bp + 6);
+            lp->v[0] = p;
+            lp->type = (p >= 0)? L_ELIF : L_SYNTAX;
+            return;
+        }
+        if (sscanf(bp, "#ifdef %63s", lp->name) == 1) { lp->type = L_IFDEF; return; }
+        if (sscanf(bp, "#define %63s", lp->name) == 1) { lp->type = L_DEFINE; return; }
+        if (sscanf(bp, "#include \"%63[^\"]\"", lp->name) == 1) { lp->type = L_INCLUDE; return; }
+        if (strncmp(bp, "#error", 6) == 0) { lp->type = L_ERROR; return; }
+        if (strncmp(bp, "#warning", 8) == 0) { lp->type = L_WARNING; return; }
+        break;
+
+    case '=':
+        if (octal(bp + 1, &lp->v[0])) { lp->type = L_ORG; return; }
+        break;
+
+    case ':':
+        if (bp[1] == ':' && octal(bp + 2, &lp->v[0])) { lp->type = L_CHK_CUR; return; }
+        if (octal(bp + 1, &lp->v[0])) { lp->type = L_CHK_PREV; return; }
+        break;
+
+    case 'b': {
+        // only when the value ends the line or is followed by whitespace, so "b7:" is a label
+        const char *ep = octal(bp + 1, &lp->v[0]);
+        if (ep && (*ep == '\0' || isspace(*ep))) { lp->type = L_BYTE; return; }
+        break;
+    }
+
+    default:
+        const char *wp;
+        for (wp = bp, lp->n = 0; lp->n < 3 && (wp = word(wp, lp)) != NULL; lp->n++)
+            ;
+        if (lp->n) { lp->type = L_WORDS; return; }
+        break;
+    }
+
+    if (!label_def(bp, lp) && !asm_line(bp, lp)) lp->type = L_SYNTAX;
+}
+
+static void add_def(conv_t *c, const char *name)
+{
+    char *s = arena_strdup(&c->arena, name);
+    if (s == NULL || c->n_defs >= N_IFDEFS || !cond_set_add(c->def_set, name)) { error(c, "too many defines"); return; }
+    c->defs[c->n_defs++] = s;
+}
+
+// mem NULL: the arena is malloc()ed, starting with ARENA_CHUNK bytes
+void conv_init(conv_t *c, void *mem, int size)
+{
+    memset(c, 0, sizeof(*c));
+    arena_init(&c->arena, mem, mem? size : ARENA_CHUNK);
+    c->fmsg = stdout;
+}
+
+void conv_free(conv_t *c)
+{
+    arena_free(&c->arena);
+}
+
+// Starts a conversion: releases everything from the previous one. If img_size is non-zero
+// and no output file is set the image is written to an arena buffer of that size instead.
+// If the arena can't supply the buffers the conversion has a single error and converts nothing.
+void conv_begin(conv_t *c, int n_defs, char **defs, int img_size)
+{
+    arena_release(&c->arena);
+    c->lnum = c->errs = 0;
+    c->blk = (blk_t *) arena_alloc(&c->arena, sizeof(blk_t));
+    c->img = (img_size && !c->fwp)? (u1_t *) arena_alloc(&c->arena, img_size) : NULL;
+    c->img_size = c->img? img_size : 0;
+    c->img_len = 0;
+    c->abs_off = 0;
+
+    c->runs = NULL;
+    c->pblks = NULL;
+    if (c->prov) {
+        c->runs = (prov_run_t *) arena_alloc(&c->arena, sizeof(prov_run_t) * N_PROV_RUNS);
+        c->pblks = (prov_blk_t *) arena_alloc(&c->arena, sizeof(prov_blk_t) * N_PROV_BLKS);
+    }
+    c->n_runs = c->blk_run0 = c->n_pblks = 0;
+
+    if (c->blk == NULL || (img_size && !c->fwp && c->img == NULL) || (c->prov && (c->runs == NULL || c->pblks == NULL))) {
+        error(c, "no memory for the conversion");
+        c->blk = NULL;
+        return;
+    }
+
+    c->sp = c->blk->data;
+    c->have_blk = false;
+    c->org = c->pc = 0;
+    c->page = 0;
+    c->rm = false;
+    c->lvl = 1;
+    c->inside_if = c->ignore_input = c->taken = 0;
+    c->fn_cur = NULL;
+    c->inc_depth = c->n_deps = 0;
+    c->labs = NULL;
+    c->n_labs = c->n_fix = 0;
+    c->blk_fix = NULL;
+
+    c->n_defs = 0;
+    memset(c->def_set, 0, sizeof(c->def_set));
+    for (int i = 0; i < n_defs; i++) add_def(c, defs[i]);
+}
+
+static void conv_list(conv_t *c, const char *line);
+static void conv_parsed(conv_t *c, const char *line, const char *bp, line_t l);
+
+// Processes one line of infile.txt (without the \n).
+void conv_line(conv_t *c, const char *line)
+{
+    if (c->blk == NULL) return;     // conv_begin() failed
+    const char *bp = line;
+    c->lnum++;
+    conv_list(c, line);
+    while (*bp != '\0' && isspace(*bp)) bp++;   // remove leading whitespace
+    line_t l;
+    parse_line(bp, &l);
+    conv_parsed(c, line, bp, l);
+}
+
+// Converts the lines of an included file, already parsed once for all conversions by inc_load().
+static void conv_include(conv_t *c, const char *name)
+{
+    char path[NPATH];
+    inc_path(path, c->fn_cur? c->fn_cur : c->fn_in, name);
+    if (c->inc_depth >= N_INC_DEPTH) { error(c, "#include nested too deeply \"%s\"", path); return; }
+    inc_t *inc = inc_load(path);
+    if (inc == NULL) { error(c, "can't open #include file \"%s\"", path); return; }
+
+    int i;
+    for (i = 0; i < c->n_deps && c->deps[i] != inc; i++)
+        ;
+    if (i == c->n_deps && c->n_deps < N_DEPS) c->deps[c->n_deps++] = inc;
+
+    int lnum = c->lnum;
+    const char *fn_cur = c->fn_cur;
+    c->fn_cur = inc->path;
+    c->inc_depth++;
+    c->lnum = 0;
+
+    for (i = 0; i < inc->n; i++) {
+        const char *line = inc->lines[i];
+        c->lnum++;
+        conv_list(c, line);
+        conv_parsed(c, line, line + strspn(line, " \t\n\v\f\r"), inc->parsed[i]);
+    }
+
+    c->inc_depth--;
+    c->fn_cur = fn_cur;
+    c->lnum = lnum;
+}
+
+static void conv_list(conv_t *c, const char *line)
+{
+    if (!c->list) return;
+    if (c->dbg_cond)
+        cprintf(c, "line #%04d: %06o %01x %01x %01x %c %s\n", c->lnum, c->pc,
+            c->lvl, c->inside_if, c->ignore_input, c->ignore_input? 'X':'|', line);
+    else
+        cprintf(c, "line #%04d: %06o %c %s\n", c->lnum, c->pc, c->ignore_input? 'X':'|', line);
+}
+
+// line: the whole line, bp: line without leading whitespace, l: its classification
+static void conv_parsed(conv_t *c, const char *line, const char *bp, line_t l)
+{
+    int i, n;
+    u4_t chk, b;
+
+    if (l.type == L_PAGE)
+        c->page = l.v[0];
+    if (l.type == L_BLANK || l.type == L_PAGE)
+        return;
+
+    if (l.type == L_ELSE) {
+        if (!(c->inside_if & c->lvl))
+            error(c, "#else not inside #if lvl=%x inside_if=%x ignore_input=%x", c->lvl, c->inside_if, c->ignore_input);
+        else {
+            if (c->taken & c->lvl) c->ignore_input |= c->lvl; else c->ignore_input &= ~c->lvl;
+            c->taken |= c->lvl;
+        }
+        if (c->dbg_cond)
+            note(c, "#else  lvl=%x inside_if=%x ignore_input=%x", c->lvl, c->inside_if, c->ignore_input);
+        return;
+    }
+
+    if (l.type == L_ENDIF) {
+        c->inside_if &= ~c->lvl;
+        c->ignore_input &= ~c->lvl;
+        c->taken &= ~c->lvl;
+        c->lvl >>= 1;
+        if (c->lvl == 0) error(c, "#endif without corresponding #if");
+        if (c->dbg_cond)
+            note(c, "#endif lvl=%x inside_if=%x ignore_input=%x", c->lvl, c->inside_if, c->ignore_input);
+        return;
+    }
+
+    if (l.type == L_IF1 || l.type == L_IF0 || l.type == L_IF || l.type == L_IFDEF) {
+        bool t;
+        if (l.type == L_IFDEF) {
+            for (i = 0; i < c->n_defs; i++) {
+                if (strcmp(l.name, c->defs[i]) == 0) {
+                    break;
+                }
+            }
+            t = (i != c->n_defs);
+        } else
+            t = (l.type == L_IF)? cond_eval(l.v[0], c->def_set) : (l.type == L_IF1);
+        c->lvl <<= 1;
+        c->inside_if |= c->lvl;
+        if (t) { c->ignore_input &= ~c->lvl; c->taken |= c->lvl; } else { c->ignore_input |= c->lvl; c->taken &= ~c->lvl; }
+        if (c->dbg_cond && l.type == L_IFDEF)
+            note(c, "#ifdef lvl=%x inside_if=%x ignore_input=%x %s", c->lvl, c->inside_if, c->ignore_input, l.name);
+        if (c->dbg_cond && l.type == L_IF)
+            note(c, "#if    lvl=%x inside_if=%x ignore_input=%x %s", c->lvl, c->inside_if, c->ignore_input, bp + 4);
+        return;
+    }
+
+    if (l.type == L_ELIF) {
+        if (!(c->inside_if & c->lvl))
+            error(c, "#elif not inside #if lvl=%x inside_if=%x ignore_input=%x", c->lvl, c->inside_if, c->ignore_input);
+        else
+        if ((c->taken & c->lvl) || !cond_eval(l.v[0], c->def_set))
+            c->ignore_input |= c->lvl;
+        else {
+            c->ignore_input &= ~c->lvl;
+            c->taken |= c->lvl;
+        }
+        if (c->dbg_cond)
+            note(c, "#elif  lvl=%x inside_if=%x ignore_input=%x %s", c->lvl, c->inside_if, c->ignore_input, bp + 6);
+        return;
+    }
+
+    if (c->ignore_input) return;    // i.e. ignore if ignoring on any level
+
+    switch (l.type) {
+
+    case L_DEFINE:
+        cprintf(c, "#define %s\n", l.name);
+        add_def(c, l.name);
+        break;
+
+    case L_INCLUDE: conv_include(c, l.name); break;
+    case L_LABEL: lab_define(c, l.v[0]); break;
+
+    case L_ERROR: error(c, "\"%s\"", bp); break;
+    case L_WARNING: note(c, "\"%s\"", bp); break;
+
+    case L_ORG:
+        write_abs(c, ABS_BLK);
+        if (l.v[0] > 0177777) error(c, "range norg=%06o", l.v[0]);
+        c->pc = c->org = l.v[0];
+        break;
+
+    case L_CHK_CUR:
+        chk = l.v[0];
+        if (chk > 0177777) error(c, "'::' range chk=%06o", chk);
+        if (c->pc != chk) error(c, "consistency check, expecting pc=%06o but \":: %06o\" specified", c->pc, chk);
+        write_abs(c, ABS_BLK);
+        break;
+
+    case L_CHK_PREV: {
+        chk = l.v[0];
+        if (chk > 0177777) error(c, "':' range chk=%06o", chk);
+        int pcm2 = c->pc - 2;
+        if ((u4_t) pcm2 != chk) error(c, "consistency check, expecting (pc-2)=%06o but \": %06o\" specified", pcm2, chk);
+        write_abs(c, ABS_BLK);
+        break;
+    }
+
+    case L_BYTE:
+        b = l.v[0];
+        if (b > 0377) error(c, "range b=%04o", b);
+        prov_add(c, 1);
+        *c->sp++ = b; c->pc += 1;
+        c->have_blk = true;
+        break;
+
+    case L_WORDS:
+        n = l.n;
+        if (!(l.refs & 1) && l.v[0] > 0177777) error(c, "range w0=%06o", l.v[0]);
+        if (n >= 2 && !(l.refs & 2) && l.v[1] > 0177777) error(c, "range w1=%06o", l.v[1]);
+        if (n >= 3 && !(l.refs & 4) && l.v[2] > 0177777) error(c, "range w2=%06o", l.v[2]);
+        if (c->pc & 1) error(c, "odd pc=%06o", c->pc);
+        prov_add(c, n*2);
+        for (i = 0; i < n; i++) {
+            int w = l.v[i];
+            if ((l.refs >> i) & 1)
+                w = lab_ref(c, &l, i);
+            else
+            if (((l.rel >> i) & 1) || (i == 0 && l.br)) {
+                if ((w = lab_word(&l, i, c->pc, l.v[i])) < 0) { error(c, "branch to %06o out of range", l.v[i]); w = l.opc; }
+            }
+            write_le(c->sp, w);
+            c->pc += 2;
+        }
+        c->have_blk = true;
+        break;
+
+    default:
+        error(c, "syntax error \"%s\"", line);
+        break;
+    }
+}
+
+// Flushes the last block and writes the halt block. Returns the error count.
+int conv_end(conv_t *c)
+{
+    if (c->blk == NULL) return c->errs;
+    lab_end(c);
+    write_abs(c, ABS_BLK);
+    write_abs(c, ABS_HALT);
+    return c->errs;
+}
+
+// Converts a whole in-memory listing.
+int conv_text(conv_t *c, const char *text)
+{
+    char buf[NBUF];
+    while (*text) {
+        const char *e = strchr(text, '\n');
+        int len = e? (e - text) : strlen(text);
+        if (len >= NBUF) len = NBUF - 1;
+        memcpy(buf, text, len);
+        buf[len] = '\0';
+        conv_line(c, buf);
+        text = e? e+1 : text + strlen(text);
+    }
+    return conv_end(c);
+}
+
+// Reads a whole file, with a '\0' after it. Returns NULL if it can't.
+char *file_read(const char *fn, long *len)
+{
+    FILE *fp;
+    if ((fp = fopen(fn, "r")) == NULL) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long n = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *s = (n >= 0)? (char *) malloc(n + 1) : NULL;
+    if (s) {
+        n = fread(s, 1, n, fp);
+        if (ferror(fp)) { free(s); s = NULL; } else s[n] = '\0';
+    }
+    fclose(fp);
+    if (s && len) *len = n;
+    return s;
+}
+
+bool conv_is_listing(const char *fn)
+{
+    int n = strlen(fn);
+    return n > 4 && strcmp(fn + n - 4, ".txt") == 0;
+}
+
+// Reads an image: a listing (".txt") converted with the defines, or an absolute format image.
+// *img and *len are then c->img and c->img_len, valid until the next conv_begin() or conv_free().
+// Returns the number of conversion errors (already reported), -1 if the file can't be read, or
+// -2 if it isn't in absolute format (reported, *img and *len still set).
+int conv_file(conv_t *c, const char *fn, int n_defs, char **defs, const u1_t **img, long *len)
+{
+    long n;
+    char *s = file_read(fn, &n);
+    *img = NULL;
+    *len = 0;
+    if (s == NULL) { printf("fopen R %s\n", fn); return -1; }
+
+    int errs;
+    c->fn_in = fn;
+    if (conv_is_listing(fn)) {
+        conv_begin(c, n_defs, defs, IMG_SIZE);
+        errs = conv_text(c, s);
+    } else {
+        conv_begin(c, 0, NULL, n + 1);
+        if ((errs = c->errs) == 0) {
+            memcpy(c->img, s, n);
+            c->img_len = n;
+            if (abs_load(c->img, n, NULL, NULL) == -2) { printf("%s: not an absolute format image\n", fn); errs = -2; }
+        }
+    }
+    free(s);
+    *img = c->img;
+    *len = c->img_len;
+    return errs;
+}
@@ -0,0 +1,137 @@
+//
+// Base image plus per-variant delta overlays (txt2abs --delta)
+//
+// Usage: txt2abs [--def xxx] --delta "11/34" [--delta "11/20 PB_11/04" ...] --in infile.txt --out base.abs
+//
+// Converts infile.txt with the --def set into base.abs as usual, then once per --delta with its
+// defines added, and writes base_<defines>.delta.abs holding only the bytes in which the variant's
+// memory image differs from the base's. Loading the delta over a board already holding base.abs
+// gives the variant. Differing bytes closer together than a block header's worth are sent in one
+// block; the final block carries the variant's start address.
+//
+// Bytes the base loads but the variant doesn't are left alone (the variant never relies on them).
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "txt2abs.h"
+
+// a gap shorter than this is cheaper to send than to start a new block
+#define GAP_MAX (HDR_LEN + CKSUM_LEN)
+
+struct dimg_t {
+    u1_t mem[ABS_MEM], loaded[ABS_MEM];
+    int start, len, errs;
+};
+
+static void convert(conv_t *c, const char *fn_in, int n_defs, char **defs, dimg_t *im)
+{
+    const u1_t *img;
+    long len;
+    im->errs = conv_file(c, fn_in, n_defs, defs, &img, &len);
+    if (im->errs < 0) im->errs = 1;
+    memset(im->loaded, 0, ABS_MEM);
+    im->start = abs_load(img, len, im->mem, im->loaded);
+    im->len = len;
+}
+
+static int write_delta(const char *fn, dimg_t *base, dimg_t *var, int *n_blks, int *n_bytes, int *n_orphan)
+{
+    FILE *fp;
+    *n_blks = *n_bytes = *n_orphan = 0;
+    if ((fp = fopen(fn, "w")) == NULL) { printf("fopen W %s\n", fn); return -1; }
+    int a, e, g, err = 0;
+
+    #define DIFF(a) (var->loaded[a] && (!base->loaded[a] || var->mem[a] != base->mem[a]))
+
+    for (a = 0; a < ABS_MEM; a++) {
+        if (base->loaded[a] && !var->loaded[a]) (*n_orphan)++;
+        if (!DIFF(a)) continue;
+
+        // extend over short gaps of bytes the variant loads
+        for (e = a + 1; e < ABS_MEM; ) {
+            if (DIFF(e)) { e++; continue; }
+            for (g = e; g < ABS_MEM && g - e < GAP_MAX && var->loaded[g] && !DIFF(g); g++)
+                ;
+            if (g < ABS_MEM && g - e < GAP_MAX && DIFF(g)) e = g; else break;
+        }
+
+        if (abs_block(fp, a, &var->mem[a], e - a) < 0) err = -1;
+        (*n_blks)++;
+        *n_bytes += e - a + HDR_LEN + CKSUM_LEN;
+        a = e - 1;      // the variant loads every byte up to e, so none of them are orphans
+    }
+
+    if (abs_block(fp, (var->start >= 0)? var->start : 1, NULL, 0) < 0) err = -1;
+    *n_bytes += HDR_LEN + CKSUM_LEN;
+    if (fclose(fp) != 0) err = -1;
+    if (err) printf("write error %s\n", fn);
+    return err;
+}
+
+int delta_main(const char *fn_in, const char *fn_out, int n_defs, char **defs, int n_deltas, char **deltas)
+{
+    if (!conv_is_listing(fn_in)) { printf("%s: --delta needs the listing (.txt)\n", fn_in); return -1; }
+    FILE *fp;
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    dimg_t *base = (dimg_t *) malloc(sizeof(dimg_t)), *var = (dimg_t *) malloc(sizeof(dimg_t));
+    int errs = 0;
+
+    // the variants only once the base is written
+    convert(c, fn_in, n_defs, defs, base);
+    errs += base->errs;
+    bool ok = (base->errs == 0);
+    if (ok) {
+        if ((fp = fopen(fn_out, "w")) == NULL) {
+            printf("fopen W %s\n", fn_out);
+            ok = false;
+        } else {
+            int err = fwrite(c->img, 1, c->img_len, fp) != (size_t) c->img_len;
+            if (fclose(fp) != 0 || err) { printf("write error %s\n", fn_out); ok = false; }
+        }
+        if (ok) printf("%-24s %5d bytes\n", fn_out, base->len); else errs++;
+    }
+
+    // base name without .abs
+    char stem[NPATH];
+    snprintf(stem, sizeof(stem), "%s", fn_out);
+    int sl = strlen(stem);
+    if (sl > 4 && strcmp(stem + sl - 4, ".abs") == 0) stem[sl - 4] = '\0';
+
+    for (int i = 0; ok && i < n_deltas; i++) {
+        char *dv[N_IFDEFS], *sv, *tok, suffix[NPATH] = "";
+        char *spec = strdup(deltas[i]);
+        int nd = 0, n = 0;
+        for (int j = 0; j < n_defs && nd < N_IFDEFS; j++) dv[nd++] = defs[j];
+        for (tok = strtok_r(spec, " \t", &sv); tok; tok = strtok_r(NULL, " \t", &sv)) {
+            if (nd < N_IFDEFS) dv[nd++] = tok;
+            n += snprintf(suffix + n, sizeof(suffix) - n, "_%s", tok);
+        }
+        for (char *cp = suffix; *cp; cp++) if (*cp == '/') *cp = '_';
+
+        convert(c, fn_in, nd, dv, var);
+        errs += var->errs;
+        if (var->errs == 0) {
+            char fn[2*NPATH + 16];
+            int n_blks, n_bytes, n_orphan;
+            snprintf(fn, sizeof(fn), "%s%s.delta.abs", stem, suffix);
+            if (write_delta(fn, base, var, &n_blks, &n_bytes, &n_orphan) < 0) { errs++; free(spec); continue; }
+            printf("%-24s %5d bytes, %d block%s (variant image %d bytes)", fn, n_bytes, n_blks, (n_blks != 1)? "s":"", var->len);
+            if (n_orphan) printf(", %d base byte%s not loaded by variant", n_orphan, (n_orphan != 1)? "s":"");
+            printf("\n");
+        }
+        free(spec);
+    }
+
+    if (errs) printf("%d error%s\n", errs, (errs != 1)? "s":"");
+    free(base);
+    free(var);
+    conv_free(c);
+    return errs? -1 : 0;
+}
@@ -0,0 +1,217 @@
+//
+// PDP-11 disassembler (11/04 /05 /20 /34 /40 /45 instruction set, plus EIS and FIS)
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "txt2abs.h"
+
+// also the encoding table of the assembler (asm.cpp)
+const op_t pdp11_ops[] = {
+    { 0000000, 0177777, "halt",  F_NONE },
+    { 0000001, 0177777, "wait",  F_NONE },
+    { 0000002, 0177777, "rti",   F_NONE },
+    { 0000003, 0177777, "bpt",   F_NONE },
+    { 0000004, 0177777, "iot",   F_NONE },
+    { 0000005, 0177777, "reset", F_NONE },
+    { 0000006, 0177777, "rtt",   F_NONE },
+    { 0000100, 0177700, "jmp",   F_DD },
+    { 0000200, 0177770, "rts",   F_R },
+    { 0000230, 0177770, "spl",   F_N3 },
+    { 0000240, 0177777, "nop",   F_NONE },
+    { 0000241, 0177777, "clc",   F_NONE },
+    { 0000242, 0177777, "clv",   F_NONE },
+    { 0000244, 0177777, "clz",   F_NONE },
+    { 0000250, 0177777, "cln",   F_NONE },
+    { 0000257, 0177777, "ccc",   F_NONE },
+    { 0000261, 0177777, "sec",   F_NONE },
+    { 0000262, 0177777, "sev",   F_NONE },
+    { 0000264, 0177777, "sez",   F_NONE },
+    { 0000270, 0177777, "sen",   F_NONE },
+    { 0000277, 0177777, "scc",   F_NONE },
+    { 0000300, 0177700, "swab",  F_DD },
+    { 0000400, 0177400, "br",    F_BR },
+    { 0001000, 0177400, "bne",   F_BR },
+    { 0001400, 0177400, "beq",   F_BR },
+    { 0002000, 0177400, "bge",   F_BR },
+    { 0002400, 0177400, "blt",   F_BR },
+    { 0003000, 0177400, "bgt",   F_BR },
+    { 0003400, 0177400, "ble",   F_BR },
+    { 0004000, 0177000, "jsr",   F_RDD },
+    { 0005000, 0177700, "clr",   F_DD },
+    { 0005100, 0177700, "com",   F_DD },
+    { 0005200, 0177700, "inc",   F_DD },
+    { 0005300, 0177700, "dec",   F_DD },
+    { 0005400, 0177700, "neg",   F_DD },
+    { 0005500, 0177700, "adc",   F_DD },
+    { 0005600, 0177700, "sbc",   F_DD },
+    { 0005700, 0177700, "tst",   F_DD },
+    { 0006000, 0177700, "ror",   F_DD },
+    { 0006100, 0177700, "rol",   F_DD },
+    { 0006200, 0177700, "asr",   F_DD },
+    { 0006300, 0177700, "asl",   F_DD },
+    { 0006400, 0177700, "mark",  F_N6 },
+    { 0006500, 0177700, "mfpi",  F_DD },
+    { 0006600, 0177700, "mtpi",  F_DD },
+    { 0006700, 0177700, "sxt",   F_DD },
+    { 0010000, 0170000, "mov",   F_SSDD },
+    { 0020000, 0170000, "cmp",   F_SSDD },
+    { 0030000, 0170000, "bit",   F_SSDD },
+    { 0040000, 0170000, "bic",   F_SSDD },
+    { 0050000, 0170000, "bis",   F_SSDD },
+    { 0060000, 0170000, "add",   F_SSDD },
+    { 0070000, 0177000, "mul",   F_SSR },
+    { 0071000, 0177000, "div",   F_SSR },
+    { 0072000, 0177000, "ash",   F_SSR },
+    { 0073000, 0177000, "ashc",  F_SSR },
+    { 0074000, 0177000, "xor",   F_RDD2 },
+    { 0075000, 0177770, "fadd",  F_R },
+    { 0075010, 0177770, "fsub",  F_R },
+    { 0075020, 0177770, "fmul",  F_R },
+    { 0075030, 0177770, "fdiv",  F_R },
+    { 0077000, 0177000, "sob",   F_SOB },
+    { 0100000, 0177400, "bpl",   F_BR },
+    { 0100400, 0177400, "bmi",   F_BR },
+    { 0101000, 0177400, "bhi",   F_BR },
+    { 0101400, 0177400, "blos",  F_BR },
+    { 0102000, 0177400, "bvc",   F_BR },
+    { 0102400, 0177400, "bvs",   F_BR },
+    { 0103000, 0177400, "bcc",   F_BR },
+    { 0103400, 0177400, "bcs",   F_BR },
+    { 0104000, 0177400, "emt",   F_N8 },
+    { 0104400, 0177400, "trap",  F_N8 },
+    { 0105000, 0177700, "clrb",  F_DD },
+    { 0105100, 0177700, "comb",  F_DD },
+    { 0105200, 0177700, "incb",  F_DD },
+    { 0105300, 0177700, "decb",  F_DD },
+    { 0105400, 0177700, "negb",  F_DD },
+    { 0105500, 0177700, "adcb",  F_DD },
+    { 0105600, 0177700, "sbcb",  F_DD },
+    { 0105700, 0177700, "tstb",  F_DD },
+    { 0106000, 0177700, "rorb",  F_DD },
+    { 0106100, 0177700, "rolb",  F_DD },
+    { 0106200, 0177700, "asrb",  F_DD },
+    { 0106300, 0177700, "aslb",  F_DD },
+    { 0106400, 0177700, "mtps",  F_DD },
+    { 0106500, 0177700, "mfpd",  F_DD },
+    { 0106600, 0177700, "mtpd",  F_DD },
+    { 0106700, 0177700, "mfps",  F_DD },
+    { 0110000, 0170000, "movb",  F_SSDD },
+    { 0120000, 0170000, "cmpb",  F_SSDD },
+    { 0130000, 0170000, "bitb",  F_SSDD },
+    { 0140000, 0170000, "bicb",  F_SSDD },
+    { 0150000, 0170000, "bisb",  F_SSDD },
+    { 0160000, 0170000, "sub",   F_SSDD },
+    { 0, 0, NULL, F_NONE }
+};
+
+static const char *regs[8] = { "r0", "r1", "r2", "r3", "r4", "r5", "sp", "pc" };
+
+// state while decoding one instruction
+struct dis_t {
+    u4_t pc;
+    const u2_t *w;
+    int nw, wi;
+    char *s;
+    int ns;
+};
+
+static void dis_printf(dis_t *d, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int sl = strlen(d->s);
+    if (sl < d->ns) vsnprintf(d->s + sl, d->ns - sl, fmt, ap);
+    va_end(ap);
+}
+
+// next word of the instruction stream, or -1 if not available
+static int dis_next(dis_t *d)
+{
+    int i = d->wi++;
+    return (i < d->nw)? d->w[i] : -1;
+}
+
+static void dis_operand(dis_t *d, int mr)
+{
+    int mode = (mr >> 3) & 7, r = mr & 7;
+    int x;
+
+    if (r == 7 && (mode == 2 || mode == 3 || mode == 6 || mode == 7)) {
+        x = dis_next(d);
+        if (x < 0) { dis_printf(d, "?"); return; }
+        u4_t ea = (d->pc + d->wi * 2 + x) & 0177777;
+        switch (mode) {
+            case 2: dis_printf(d, "#%o", x); break;
+            case 3: dis_printf(d, "@#%o", x); break;
+            case 6: dis_printf(d, "%o", ea); break;
+            case 7: dis_printf(d, "@%o", ea); break;
+        }
+        return;
+    }
+
+    switch (mode) {
+        case 0: dis_printf(d, "%s", regs[r]); break;
+        case 1: dis_printf(d, "(%s)", regs[r]); break;
+        case 2: dis_printf(d, "(%s)+", regs[r]); break;
+        case 3: dis_printf(d, "@(%s)+", regs[r]); break;
+        case 4: dis_printf(d, "-(%s)", regs[r]); break;
+        case 5: dis_printf(d, "@-(%s)", regs[r]); break;
+        case 6:
+        case 7:
+            x = dis_next(d);
+            if (x < 0) dis_printf(d, "%s?(%s)", (mode == 7)? "@":"", regs[r]);
+            else dis_printf(d, "%s%o(%s)", (mode == 7)? "@":"", x, regs[r]);
+            break;
+    }
+}
+
+int dis_pdp11(u4_t pc, const u2_t *w, int nw, char *s, int ns)
+{
+    dis_t dis = { pc, w, nw, 0, s, ns }, *d = &dis;
+    s[0] = '\0';
+    if (nw < 1) return 1;
+
+    u2_t insn = dis_next(d);
+    const op_t *op;
+    for (op = pdp11_ops; op->name; op++)
+        if ((insn & op->mask) == op->code) break;
+
+    if (op->name == NULL) {
+        dis_printf(d, ".word %06o", insn);
+        return 1;
+    }
+
+    dis_printf(d, "%-6s", op->name);
+    switch (op->fmt) {
+        case F_NONE: break;
+        case F_DD: dis_operand(d, insn); break;
+        case F_SSDD: dis_operand(d, insn >> 6); dis_printf(d, ", "); dis_operand(d, insn); break;
+        case F_R: dis_printf(d, "%s", regs[insn & 7]); break;
+        case F_RDD: case F_RDD2: dis_printf(d, "%s, ", regs[(insn >> 6) & 7]); dis_operand(d, insn); break;
+        case F_SSR: dis_operand(d, insn); dis_printf(d, ", %s", regs[(insn >> 6) & 7]); break;
+        case F_N3: dis_printf(d, "%o", insn & 7); break;
+        case F_N6: dis_printf(d, "%o", insn & 077); break;
+        case F_N8: dis_printf(d, "%o", insn & 0377); break;
+
+        case F_BR: {
+            int off = (signed char) (insn & 0377);
+            dis_printf(d, "%o", (pc + 2 + off * 2) & 0177777);
+            break;
+        }
+
+        case F_SOB:
+            dis_printf(d, "%s, %o", regs[(insn >> 6) & 7], (pc + 2 - (insn & 077) * 2) & 0177777);
+            break;
+    }
+
+    // trim trailing blanks left by the mnemonic padding
+    int sl = strlen(s);
+    while (sl > 0 && s[sl-1] == ' ') s[--sl] = '\0';
+    return d->wi;
+}
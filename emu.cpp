@@ -0,0 +1,895 @@
+//
+// PDP-11 interpreter for running converted images (see run.cpp)
+//
+// Models a PDP-11/40 (KD11-A) without options: no EIS, FIS, memory management or stack limit
+// register. 28K words of memory, the switch/display register, the PSW and a DL11 console
+// (the output is collected in a buffer, there is never any input). When given a tape, a PC11
+// paper tape reader that delivers each character as soon as it is asked for (see ldr.cpp).
+// Everything else in the I/O page times out.
+//
+// Traps follow the KD11-A: odd address, non-existent memory and JMP/JSR to a register trap
+// to 4, reserved instructions (including the EIS, FIS, SPL, MTPS/MFPS) to 10. A kernel stack reference below
+// 400 gives a yellow zone trap to 4 once the instruction completes. The T-bit trap is taken
+// after an instruction that started with T set, immediately after an RTI that sets it, and is
+// cleared by any other trap (as the PSW pushed by that trap carries T). Priorities are those
+// of the processor handbook: bus errors, trap instructions, trace, yellow stack, interrupts.
+// A device request above the processor priority is kept as the lowest of the trap requests,
+// so between instructions there is a single test for anything pending.
+//
+// An abort (bus error) part way through an instruction longjmp()s back to the run loop,
+// leaving any registers already modified, as on the real machine.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+
+#include "txt2abs.h"
+
+// trap requests, highest priority first
+#define TRAP_ODD    0x0001
+#define TRAP_NXM    0x0002
+#define TRAP_PAR    0x0004      // memory parity error (only when injected)
+#define TRAP_PRV    0x0008      // JMP/JSR to a register
+#define TRAP_ILL    0x0010
+#define TRAP_BPT    0x0020
+#define TRAP_IOT    0x0040
+#define TRAP_EMT    0x0080
+#define TRAP_TRAP   0x0100
+#define TRAP_TRC    0x0200
+#define TRAP_YEL    0x0400
+#define N_TRAPS     11
+#define TRAP_INT    0x0800      // an interrupt request above the processor priority (see irq_eval())
+
+static const u2_t trap_vec[N_TRAPS] = { 004, 004, 0114, 004, 010, 014, 020, 030, 034, 014, 004 };
+
+// requests cleared by taking each trap
+static const u4_t trap_clear[N_TRAPS] = {
+    TRAP_ODD | TRAP_PAR | TRAP_YEL | TRAP_TRC, TRAP_NXM | TRAP_PAR | TRAP_YEL | TRAP_TRC, TRAP_PAR | TRAP_TRC,
+    TRAP_PRV | TRAP_TRC, TRAP_ILL | TRAP_TRC, TRAP_BPT | TRAP_TRC, TRAP_IOT | TRAP_TRC, TRAP_EMT | TRAP_TRC,
+    TRAP_TRAP | TRAP_TRC, TRAP_TRC, TRAP_YEL
+};
+
+#define PSW_T   020
+#define CC_N    010
+#define CC_Z    004
+#define CC_V    002
+#define CC_C    001
+
+#define STK_YEL 0400
+
+#define R   e->r
+#define PC  e->r[7]
+#define SP  e->r[6]
+#define PSW e->psw
+
+#define ABORT(t) { e->trap_req |= (t); longjmp(e->jb, 1); }
+
+#define SIGN_W(v) (((v) >> 15) & 1)
+#define SIGN_B(v) (((v) >> 7) & 1)
+
+void emu_init(emu_t *e, u4_t swreg)
+{
+    memset(e, 0, sizeof(*e));
+    e->mem_top = EMU_MEM_TOP;
+    e->swreg = swreg;
+    e->xcsr = XCSR_RDY;
+    e->fault.at = e->fault_next = FAULT_NEVER;
+    e->brk = ~0;
+    e->swr_at = ~0ULL;
+}
+
+// Schedules a fault to inject (see fault.cpp).
+void emu_fault(emu_t *e, const fault_t *f)
+{
+    e->fault = *f;
+    e->fault.fired = 0;
+    e->fault_next = f->at;
+    e->armed = false;
+}
+
+// Loads an absolute format image. Returns its start address (odd if none), or < 0 if malformed.
+int emu_load(emu_t *e, const u1_t *img, int len)
+{
+    u1_t loaded[ABS_MEM];
+    memset(loaded, 0, sizeof(loaded));
+    return abs_load(img, len, e->mem, loaded);
+}
+
+
+// interrupts
+
+// an interrupt request above the processor priority
+static inline bool irq_ready(emu_t *e)
+{
+    int pri = (PSW >> 5) & 7;
+    if ((e->irq & IRQ_FAULT) && e->fault.pri > pri) return true;
+    return (e->irq & (IRQ_TTI | IRQ_TTO | IRQ_PTR)) && pri < 4;
+}
+
+// Keeps TRAP_INT in trap_req up to date. Called wherever the device requests or the priority
+// change, so that the run loop tests trap_req alone between instructions.
+static inline void irq_eval(emu_t *e)
+{
+    if (irq_ready(e)) e->trap_req |= TRAP_INT; else e->trap_req &= ~TRAP_INT;
+}
+
+// I/O page
+
+// console output, less the fill characters
+static void out_char(emu_t *e, int ch)
+{
+    if (ch != 0 && ch != 0177) {
+        if (e->n_out + 1 >= e->alloc_out) {
+            e->alloc_out = e->alloc_out * 2 + 1024;
+            e->out = (char *) realloc(e->out, e->alloc_out);
+        }
+        e->out[e->n_out++] = ch;
+        e->out[e->n_out] = '\0';
+    }
+    if (e->on_out) {
+        e->on_out(e, ch);
+        if (e->stop != EMU_RUN) e->ev_at = 0;
+    }
+}
+
+// console transmitter finishing a character
+static void tto_done(emu_t *e)
+{
+    e->xcsr |= XCSR_RDY;
+    out_char(e, e->xbuf & 0177);
+    if (e->xcsr & CSR_IE) e->irq |= IRQ_TTO;
+    irq_eval(e);
+}
+
+// reader enable: the next character is there at once
+static void ptr_read(emu_t *e)
+{
+    if (e->ptr_pos < e->ptr_len) {
+        e->prb = e->ptr[e->ptr_pos++];
+        e->prs = (e->prs & ~PRS_ERR) | PRS_DONE;
+    } else
+        e->prs |= PRS_ERR;
+    if (e->prs & CSR_IE) e->irq |= IRQ_PTR;
+    irq_eval(e);
+}
+
+static void dev_reset(emu_t *e)
+{
+    e->prs = 0;
+    e->rcsr = 0;
+    e->xcsr = XCSR_RDY;
+    if (e->x_busy) { e->x_busy = 0; tto_done(e); }
+    e->irq = 0;
+    irq_eval(e);
+}
+
+static int io_rd(emu_t *e, u4_t a)
+{
+    switch (a & ~1) {
+        case 0177776: return PSW & 0377;
+        case 0177570:
+            // lockstep (see sweep.cpp): abandon the instruction, emu_run() restarts it from the state saved
+            if (e->swr_stop && e->n_insns != e->swr_at) { e->stop = EMU_SWR; longjmp(e->jb, 1); }
+            return e->swreg;
+        case 0177560: return e->rcsr;
+        case 0177562: e->rcsr &= ~RCSR_DONE; e->irq &= ~IRQ_TTI; irq_eval(e); return 0;
+        case 0177564: return e->xcsr;
+        case 0177566: return 0;
+        case 0177550: return e->ptr? e->prs : -1;
+        case 0177552:
+            if (!e->ptr) return -1;
+            e->prs &= ~PRS_DONE;
+            e->irq &= ~IRQ_PTR;
+            irq_eval(e);
+            return e->prb;
+    }
+    return -1;
+}
+
+// A register's contents for merging a byte write into, without the side effects of a read
+// (clearing DONE, the SWR stop). A write to 0177570 goes to the display register.
+static u4_t io_val(emu_t *e, u4_t a)
+{
+    switch (a & ~1) {
+        case 0177776: return PSW & 0377;
+        case 0177570: return e->dispreg;
+        case 0177560: return e->rcsr;
+        case 0177564: return e->xcsr;
+        case 0177550: return e->prs;
+        case 0177552: return e->prb;
+    }
+    return 0;
+}
+
+// explicit PSW writes can't change the T bit
+static void psw_wr(emu_t *e, u4_t v)
+{
+    PSW = (PSW & PSW_T) | (v & 0357);
+    irq_eval(e);
+}
+
+static bool io_wr(emu_t *e, u4_t a, u4_t v, bool byte)
+{
+    // a byte write to an odd address is to the high byte of the register
+    if (byte) {
+        u4_t old = io_val(e, a);
+        v = (a & 1)? ((old & 0377) | ((v << 8) & 0177400)) : ((old & 0177400) | (v & 0377));
+    }
+
+    switch (a & ~1) {
+        case 0177776: if (!(byte && (a & 1))) psw_wr(e, v); return true;
+        case 0177570: e->dispreg = v; return true;
+        case 0177560:
+            e->rcsr = (e->rcsr & ~CSR_IE) | (v & CSR_IE);
+            if (!(v & CSR_IE)) e->irq &= ~IRQ_TTI;
+            irq_eval(e);
+            return true;
+        case 0177562: return true;
+        case 0177564:
+            if ((v & CSR_IE) && !(e->xcsr & CSR_IE) && (e->xcsr & XCSR_RDY)) e->irq |= IRQ_TTO;
+            if (!(v & CSR_IE)) e->irq &= ~IRQ_TTO;
+            e->xcsr = (e->xcsr & ~CSR_IE) | (v & CSR_IE);
+            irq_eval(e);
+            return true;
+        case 0177550:
+            if (!e->ptr) return false;
+            if ((v & CSR_IE) && !(e->prs & CSR_IE) && (e->prs & (PRS_DONE | PRS_ERR))) e->irq |= IRQ_PTR;
+            if (!(v & CSR_IE)) e->irq &= ~IRQ_PTR;
+            e->prs = (e->prs & ~CSR_IE) | (v & CSR_IE);
+            irq_eval(e);
+            if (v & PRS_ENB) ptr_read(e);
+            return true;
+        case 0177552: return e->ptr != NULL;
+        case 0177566:
+            if (!(e->xcsr & XCSR_RDY)) return true;     // overrun: character lost
+            e->xbuf = v & 0377;
+            e->xcsr &= ~XCSR_RDY;
+            e->irq &= ~IRQ_TTO;
+            irq_eval(e);
+            e->x_busy = TTO_DELAY;
+            return true;
+    }
+    return false;
+}
+
+
+// memory
+
+// An injected parity error or bus timeout, once armed, aborts the first access that
+// matches: any access (or just that of the fault's address), reads only for parity.
+static void fault_access(emu_t *e, u4_t a, bool wr)
+{
+    fault_t *f = &e->fault;
+    if (f->addr >= 0 && (u4_t) f->addr != (a & ~1)) return;
+    if (f->type == FAULT_PAR && (wr || a >= e->mem_top)) return;
+    e->armed = false;
+    f->fired = e->n_insns + 1;
+    f->pc = e->pc0;
+    ABORT((f->type == FAULT_PAR)? TRAP_PAR : TRAP_NXM);
+}
+
+// marks bytes about to be written, and logs their old values if asked to
+static void touch(emu_t *e, u4_t a, int n)
+{
+    for (int i = 0; i < n; i++) {
+        e->touched[a+i] = 1;
+        if (e->wlog && e->n_wlog < N_WLOG) {
+            e->wlog[e->n_wlog].addr = a + i;
+            e->wlog[e->n_wlog].old = e->mem[a+i];
+        }
+        if (e->wlog) e->n_wlog++;
+    }
+}
+
+static inline u4_t rd_w(emu_t *e, u4_t a)
+{
+    if (a & 1) ABORT(TRAP_ODD);
+    if (e->armed) fault_access(e, a, false);
+    if (a < e->mem_top) return e->mem[a] | (e->mem[a+1] << 8);
+    int v;
+    if (a < EMU_IO_PAGE || (v = io_rd(e, a)) < 0) ABORT(TRAP_NXM);
+    return v;
+}
+
+static inline u4_t rd_b(emu_t *e, u4_t a)
+{
+    if (e->armed) fault_access(e, a, false);
+    if (a < e->mem_top) return e->mem[a];
+    int v;
+    if (a < EMU_IO_PAGE || (v = io_rd(e, a)) < 0) ABORT(TRAP_NXM);
+    return (a & 1)? (v >> 8) & 0377 : v & 0377;
+}
+
+static inline void wr_w(emu_t *e, u4_t a, u4_t v)
+{
+    if (a & 1) ABORT(TRAP_ODD);
+    if (e->armed) fault_access(e, a, true);
+    if (a < e->mem_top) {
+        if (e->touched) touch(e, a, 2);
+        e->mem[a] = v; e->mem[a+1] = v >> 8;
+        return;
+    }
+    if (a < EMU_IO_PAGE || !io_wr(e, a, v & 0177777, false)) ABORT(TRAP_NXM);
+}
+
+static inline void wr_b(emu_t *e, u4_t a, u4_t v)
+{
+    if (e->armed) fault_access(e, a, true);
+    if (a < e->mem_top) {
+        if (e->touched) touch(e, a, 1);
+        e->mem[a] = v;
+        return;
+    }
+    if (a < EMU_IO_PAGE || !io_wr(e, a, v & 0377, true)) ABORT(TRAP_NXM);
+}
+
+static inline u4_t fetch(emu_t *e)
+{
+    u4_t w = rd_w(e, PC);
+    PC += 2;
+    return w;
+}
+
+static inline void stack_chk(emu_t *e, u4_t a)
+{
+    if (a < STK_YEL) e->trap_req |= TRAP_YEL;
+}
+
+// effective address of a mode 1-7 operand, byte or word
+static u4_t ea(emu_t *e, int spec, bool byte)
+{
+    int r = spec & 7;
+    u4_t a;
+    int inc = (byte && r < 6)? 1 : 2;
+
+    // the 11/40 checks the stack limit on writes through sp in modes 1, 2, 4 and 6 only
+    e->ea_stk = (r == 6 && ((1 << ((spec >> 3) & 7)) & 0126));
+
+    switch ((spec >> 3) & 7) {
+        case 1: return R[r];
+        case 2: a = R[r]; R[r] += inc; return a;
+        case 3: a = R[r]; R[r] += 2; return rd_w(e, a);
+        case 4: return R[r] -= inc;
+        case 5: a = R[r] -= 2; return rd_w(e, a);
+        case 6: a = fetch(e); return (u2_t) (R[r] + a);
+        default: a = fetch(e); return rd_w(e, (u2_t) (R[r] + a));
+    }
+}
+
+// operand access: value and (for read-modify-write) the address it came from
+static inline u4_t get_w(emu_t *e, int spec, u4_t *ap)
+{
+    if ((spec & 070) == 0) return R[spec & 7];
+    u4_t a = ea(e, spec, false);
+    if (ap) *ap = a;
+    return rd_w(e, a);
+}
+
+static inline u4_t get_b(emu_t *e, int spec, u4_t *ap)
+{
+    if ((spec & 070) == 0) return R[spec & 7] & 0377;
+    u4_t a = ea(e, spec, true);
+    if (ap) *ap = a;
+    return rd_b(e, a);
+}
+
+static inline void put_w(emu_t *e, int spec, u4_t a, u4_t v)
+{
+    if ((spec & 070) == 0) { R[spec & 7] = v; return; }
+    if (e->ea_stk) stack_chk(e, a);
+    wr_w(e, a, v);
+}
+
+static inline void put_b(emu_t *e, int spec, u4_t a, u4_t v)
+{
+    if ((spec & 070) == 0) { R[spec & 7] = (R[spec & 7] & 0177400) | (v & 0377); return; }
+    if (e->ea_stk) stack_chk(e, a);
+    wr_b(e, a, v);
+}
+
+static inline void set_nz(emu_t *e, u4_t v, bool byte)
+{
+    PSW &= ~(CC_N | CC_Z);
+    if (byte? SIGN_B(v) : SIGN_W(v)) PSW |= CC_N;
+    if ((v & (byte? 0377 : 0177777)) == 0) PSW |= CC_Z;
+}
+
+#define SET_CC(n, z, v, c) PSW = (PSW & ~017) | ((n)? CC_N:0) | ((z)? CC_Z:0) | ((v)? CC_V:0) | ((c)? CC_C:0)
+
+static void push(emu_t *e, u4_t v)
+{
+    SP -= 2;
+    wr_w(e, SP, v);
+    stack_chk(e, SP);
+}
+
+static u4_t pop(emu_t *e)
+{
+    u4_t v = rd_w(e, SP);
+    SP += 2;
+    return v;
+}
+
+static bool branch(emu_t *e, int cond)
+{
+    u4_t p = PSW;
+    int n = (p >> 3) & 1, z = (p >> 2) & 1, v = (p >> 1) & 1, c = p & 1;
+    switch (cond) {
+        case 0: return true;                // br
+        case 1: return !z;                  // bne
+        case 2: return z;                   // beq
+        case 3: return !(n ^ v);            // bge
+        case 4: return n ^ v;               // blt
+        case 5: return !(z | (n ^ v));      // bgt
+        case 6: return z | (n ^ v);         // ble
+        case 8: return !n;                  // bpl
+        case 9: return n;                   // bmi
+        case 10: return !(c | z);           // bhi
+        case 11: return c | z;              // blos
+        case 12: return !v;                 // bvc
+        case 13: return v;                  // bvs
+        case 14: return !c;                 // bcc
+        case 15: return c;                  // bcs
+    }
+    return false;
+}
+
+// single operand instructions (0050dd-0067dd, 1050dd-1067dd)
+static void one_op(emu_t *e, u4_t ir)
+{
+    bool byte = ir & 0100000;
+    int op = (ir >> 6) & 077, dd = ir & 077;
+    u4_t a = 0, d, r, msk = byte? 0377 : 0177777, sgn = byte? 0200 : 0100000;
+    int c = PSW & CC_C;
+
+    #define GET() (byte? get_b(e, dd, &a) : get_w(e, dd, &a))
+    #define PUT(v) { if (byte) put_b(e, dd, a, v); else put_w(e, dd, a, v); }
+
+    switch (op) {
+    case 050:   // clr
+        if (dd & 070) a = ea(e, dd, byte);
+        SET_CC(0, 1, 0, 0);
+        PUT(0);
+        return;
+    case 051:   // com
+        r = ~GET() & msk;
+        SET_CC(r & sgn, r == 0, 0, 1);
+        PUT(r);
+        return;
+    case 052:   // inc
+        d = GET(); r = (d + 1) & msk;
+        SET_CC(r & sgn, r == 0, r == sgn, c);
+        PUT(r);
+        return;
+    case 053:   // dec
+        d = GET(); r = (d - 1) & msk;
+        SET_CC(r & sgn, r == 0, d == sgn, c);
+        PUT(r);
+        return;
+    case 054:   // neg
+        d = GET(); r = -d & msk;
+        SET_CC(r & sgn, r == 0, r == sgn, r != 0);
+        PUT(r);
+        return;
+    case 055:   // adc
+        d = GET(); r = (d + c) & msk;
+        SET_CC(r & sgn, r == 0, c && d == sgn - 1, c && d == msk);
+        PUT(r);
+        return;
+    case 056:   // sbc
+        d = GET(); r = (d - c) & msk;
+        SET_CC(r & sgn, r == 0, c && d == sgn, c && d == 0);
+        PUT(r);
+        return;
+    case 057:   // tst
+        d = GET();
+        SET_CC(d & sgn, d == 0, 0, 0);
+        return;
+    case 060:   // ror
+        d = GET(); r = (d >> 1) | (c? sgn : 0);
+        c = d & 1;
+        SET_CC(r & sgn, r == 0, ((r & sgn) != 0) ^ c, c);
+        PUT(r);
+        return;
+    case 061:   // rol
+        d = GET(); r = ((d << 1) | c) & msk;
+        c = (d & sgn) != 0;
+        SET_CC(r & sgn, r == 0, ((r & sgn) != 0) ^ c, c);
+        PUT(r);
+        return;
+    case 062:   // asr
+        d = GET(); r = (d >> 1) | (d & sgn);
+        c = d & 1;
+        SET_CC(r & sgn, r == 0, ((r & sgn) != 0) ^ c, c);
+        PUT(r);
+        return;
+    case 063:   // asl
+        d = GET(); r = (d << 1) & msk;
+        c = (d & sgn) != 0;
+        SET_CC(r & sgn, r == 0, ((r & sgn) != 0) ^ c, c);
+        PUT(r);
+        return;
+    }
+
+    if (byte) { e->trap_req |= TRAP_ILL; return; }     // mtps, mfpd, mtpd, mfps: 11/34, 11/45
+
+    switch (op) {
+    case 064:   // mark
+        SP = (PC + (dd << 1)) & 0177777;
+        PC = R[5];
+        R[5] = pop(e);
+        return;
+    case 065:   // mfpi: no memory management, so the previous space is the current one
+        d = get_w(e, dd, &a);
+        SET_CC(d & 0100000, d == 0, 0, c);
+        push(e, d);
+        return;
+    case 066:   // mtpi
+        d = pop(e);
+        if (dd & 070) a = ea(e, dd, false);
+        SET_CC(d & 0100000, d == 0, 0, c);
+        put_w(e, dd, a, d);
+        return;
+    case 067:   // sxt
+        r = (PSW & CC_N)? 0177777 : 0;
+        if (dd & 070) a = ea(e, dd, false);
+        SET_CC(PSW & CC_N, r == 0, 0, c);
+        put_w(e, dd, a, r);
+        return;
+    }
+    #undef GET
+    #undef PUT
+}
+
+// double operand instructions (01ssdd-06ssdd, 11ssdd-16ssdd)
+static void two_op(emu_t *e, u4_t ir)
+{
+    int op = (ir >> 12) & 7, ss = (ir >> 6) & 077, dd = ir & 077;
+    bool byte = (ir & 0100000) && op != 6;
+    u4_t a = 0, s, d, r = 0, msk = byte? 0377 : 0177777, sgn = byte? 0200 : 0100000;
+    int c = PSW & CC_C;
+
+    s = byte? get_b(e, ss, NULL) : get_w(e, ss, NULL);
+
+    switch (op) {
+    case 1:     // mov
+        if (dd & 070) a = ea(e, dd, byte);
+        SET_CC(s & sgn, s == 0, 0, c);
+        if (byte) {
+            if (dd & 070) put_b(e, dd, a, s); else R[dd] = (s & 0200)? (s | 0177400) : s;
+        } else
+            put_w(e, dd, a, s);
+        return;
+    case 2:     // cmp
+        d = byte? get_b(e, dd, NULL) : get_w(e, dd, NULL);
+        r = (s - d) & msk;
+        SET_CC(r & sgn, r == 0, ((s ^ d) & ~(d ^ r)) & sgn, s < d);
+        return;
+    case 3:     // bit
+        d = byte? get_b(e, dd, NULL) : get_w(e, dd, NULL);
+        r = s & d;
+        SET_CC(r & sgn, r == 0, 0, c);
+        return;
+    case 4:     // bic
+        d = byte? get_b(e, dd, &a) : get_w(e, dd, &a);
+        r = d & ~s & msk;
+        SET_CC(r & sgn, r == 0, 0, c);
+        break;
+    case 5:     // bis
+        d = byte? get_b(e, dd, &a) : get_w(e, dd, &a);
+        r = d | s;
+        SET_CC(r & sgn, r == 0, 0, c);
+        break;
+    case 6:     // add, sub
+        d = get_w(e, dd, &a);
+        if (ir & 0100000) {
+            r = (d - s) & 0177777;
+            SET_CC(r & 0100000, r == 0, ((s ^ d) & ~(s ^ r)) & 0100000, d < s);
+        } else {
+            r = (d + s) & 0177777;
+            SET_CC(r & 0100000, r == 0, (~(s ^ d) & (s ^ r)) & 0100000, d + s > 0177777);
+        }
+        put_w(e, dd, a, r);
+        return;
+    }
+    if (byte) put_b(e, dd, a, r); else put_w(e, dd, a, r);
+}
+
+static void exec(emu_t *e, u4_t ir)
+{
+    u4_t a = 0, d;
+    int r;
+
+    if ((ir & 0070000) != 0 && (ir & 0170000) != 0170000 && (ir & 0170000) != 0070000) {
+        two_op(e, ir);
+        return;
+    }
+
+    switch (ir >> 12) {
+    case 000:
+    case 010:
+        break;
+    case 007:
+        switch ((ir >> 9) & 7) {
+            case 4:     // xor
+                d = R[(ir >> 6) & 7];       // the register is read before the destination
+                d ^= get_w(e, ir & 077, &a);
+                SET_CC(d & 0100000, d == 0, 0, PSW & CC_C);
+                put_w(e, ir & 077, a, d);
+                return;
+            case 7:     // sob
+                r = (ir >> 6) & 7;
+                if (--R[r]) PC -= (ir & 077) << 1;
+                return;
+        }
+        e->trap_req |= TRAP_ILL;    // eis, fis
+        return;
+    default:    // 17xxxx floating point
+        e->trap_req |= TRAP_ILL;
+        return;
+    }
+
+    // 00xxxx, 10xxxx
+    switch ((ir >> 9) & 0107) {
+    case 0000:
+        if (ir < 0400) break;
+        // fall through
+    case 0001:
+    case 0002:
+    case 0003:
+        if (branch(e, (ir >> 8) - 1)) PC += (int) (signed char) (ir & 0377) * 2;
+        return;
+    case 0100:
+    case 0101:
+    case 0102:
+    case 0103:
+        if (branch(e, ((ir >> 8) & 7) | 8)) PC += (int) (signed char) (ir & 0377) * 2;
+        return;
+    case 0004:  // jsr
+        r = (ir >> 6) & 7;
+        if ((ir & 070) == 0) { e->trap_req |= TRAP_PRV; return; }
+        a = ea(e, ir & 077, false);
+        push(e, R[r]);
+        R[r] = PC;
+        PC = a;
+        return;
+    case 0104:  // emt, trap
+        e->trap_req |= (ir & 0400)? TRAP_TRAP : TRAP_EMT;
+        return;
+    case 0005:
+    case 0006:
+    case 0105:
+    case 0106:
+        one_op(e, ir);
+        return;
+    default:
+        e->trap_req |= TRAP_ILL;
+        return;
+    }
+
+    // 000000-000377
+    switch (ir >> 6) {
+    case 0:
+        switch (ir) {
+            case 0:     // halt
+                e->stop = EMU_HALT;
+                e->ev_at = 0;
+                return;
+            case 1:     // wait
+                e->wait = true;
+                e->ev_at = 0;
+                return;
+            case 2:     // rti
+            case 6:     // rtt
+                PC = pop(e);
+                PSW = pop(e) & 0377;
+                irq_eval(e);
+                if (PSW & PSW_T) e->ev_at = 0;
+                if (ir == 2 && (PSW & PSW_T)) e->trap_req |= TRAP_TRC;
+                if (ir == 6) e->trc_inhibit = true;
+                return;
+            case 3: e->trap_req |= TRAP_BPT; return;
+            case 4: e->trap_req |= TRAP_IOT; return;
+            case 5:     // reset
+                dev_reset(e);
+                return;
+        }
+        e->trap_req |= TRAP_ILL;
+        return;
+    case 1:     // jmp
+        if ((ir & 070) == 0) { e->trap_req |= TRAP_PRV; return; }
+        PC = ea(e, ir & 077, false);
+        return;
+    case 2:
+        if ((ir & 070) == 0) {  // rts
+            r = ir & 7;
+            PC = R[r];
+            R[r] = pop(e);
+            return;
+        }
+        if (ir >= 0240) {       // condition codes
+            if (ir & 020) PSW |= ir & 017; else PSW &= ~(ir & 017);
+            return;
+        }
+        e->trap_req |= TRAP_ILL;    // spl is 11/45 only
+        return;
+    case 3: {   // swab
+        int dd = ir & 077;
+        a = 0;
+        d = get_w(e, dd, &a);
+        d = ((d >> 8) | (d << 8)) & 0177777;
+        SET_CC(d & 0200, (d & 0377) == 0, 0, 0);
+        put_w(e, dd, a, d);
+        return;
+    }
+    }
+}
+
+// takes the highest priority trap or interrupt, returns false if none
+static bool service(emu_t *e)
+{
+    int i;
+    u4_t vec;
+
+    if (!e->trap_req) return false;
+    for (i = 0; i < N_TRAPS; i++) if (e->trap_req & (1 << i)) break;
+    if (i < N_TRAPS) {
+        e->trap_req &= ~trap_clear[i];
+        vec = trap_vec[i];
+    } else {
+        if ((e->irq & IRQ_FAULT) && e->fault.pri > ((PSW >> 5) & 7)) {
+            e->irq &= ~IRQ_FAULT;
+            vec = e->fault.vec;
+            e->fault.fired = e->n_insns + 1;
+            e->fault.pc = PC;
+        } else
+        if (e->irq & IRQ_TTI) { e->irq &= ~IRQ_TTI; vec = 060; } else
+        if (e->irq & IRQ_TTO) { e->irq &= ~IRQ_TTO; vec = 064; }
+        else { e->irq &= ~IRQ_PTR; vec = 070; }
+    }
+    if (e->on_trap) e->on_trap(e, vec);
+
+    u4_t psw = PSW;
+    e->wait = false;
+    SP -= 2;
+    wr_w(e, SP, psw);
+    SP -= 2;
+    wr_w(e, SP, PC);
+    PC = rd_w(e, vec);
+    PSW = rd_w(e, vec + 2) & 0377;
+    irq_eval(e);
+    if (SP < STK_YEL && vec != 004) e->trap_req |= TRAP_YEL;
+    return true;
+}
+
+static inline void tick(emu_t *e)
+{
+    if (e->x_busy && --e->x_busy == 0) tto_done(e);
+}
+
+// The next instruction count at which the run loop has to do more than execute an instruction:
+// the limit or the fault to arm, or at once while waiting, stopping, tracing (T bit, set by an RTI
+// or a trap) or in lockstep (swr_stop).
+static inline void ev_set(emu_t *e)
+{
+    if (e->wait || e->swr_stop || (PSW & PSW_T) || e->stop != EMU_RUN) e->ev_at = 0;
+    else e->ev_at = (e->fault_next < e->end)? e->fault_next : e->end;
+}
+
+#define EV_EXEC     0       // execute the instruction at PC
+#define EV_AGAIN    1       // a trap was taken or an instruction time spent waiting
+#define EV_STOP     2
+
+// Everything between instructions other than executing the next one, in order: a fault
+// interrupt due, traps and interrupts, the instruction limit, arming a memory fault, WAIT,
+// the breakpoint, the lockstep save and the T bit.
+static int event(emu_t *e)
+{
+    if (e->stop != EMU_RUN) return EV_STOP;
+    if (e->n_insns >= e->fault_next && e->fault.type == FAULT_IRQ) {
+        e->irq |= IRQ_FAULT;
+        e->fault_next = FAULT_NEVER;
+        irq_eval(e);
+    }
+    if (e->trap_req) {
+        e->in_trap = true;
+        bool taken = service(e);
+        e->in_trap = false;
+        if (taken) {
+            ev_set(e);
+            return (e->stop == EMU_RUN)? EV_AGAIN : EV_STOP;
+        }
+    }
+    if (e->n_insns >= e->end) { e->stop = EMU_LIMIT; return EV_STOP; }
+
+    // memory faults are armed between instructions, not part way through a trap
+    if (e->n_insns >= e->fault_next) {
+        e->armed = true;
+        e->fault_next = FAULT_NEVER;
+    }
+
+    if (e->wait) {
+        // idle until the console interrupts
+        e->n_insns++;
+        tick(e);
+        if (!e->x_busy && !(e->trap_req & TRAP_INT) && e->fault_next == FAULT_NEVER) { e->stop = EMU_WAIT; return EV_STOP; }
+        return (e->stop == EMU_RUN)? EV_AGAIN : EV_STOP;
+    }
+
+    // not again for an instruction restarted after EMU_SWR
+    if (PC == e->brk && e->on_brk && e->n_insns != e->swr_at) {
+        e->on_brk(e);
+        if (e->stop != EMU_RUN) return EV_STOP;
+    }
+    if (e->swr_stop) {
+        memcpy(e->r0, R, sizeof(e->r0));
+        e->trap_req0 = e->trap_req;
+        e->trc0 = e->trc_inhibit;
+    }
+    if ((PSW & PSW_T) && !e->trc_inhibit) e->trap_req |= TRAP_TRC;
+    ev_set(e);
+    return EV_EXEC;
+}
+
+// The instruction loop, kept out of emu_run() so that none of its locals (exec() and the rest
+// are inlined here) live across the setjmp(). Pending traps, the ev_at count and the breakpoint
+// are tested together, so the common case is one branch before the instruction.
+static void __attribute__((noinline)) run_loop(emu_t *e)
+{
+    for (;;) {
+        if (e->trap_req | (e->n_insns >= e->ev_at) | (PC == e->brk)) {
+            int ev = event(e);
+            if (ev == EV_STOP) break;
+            if (ev == EV_AGAIN) continue;
+        }
+        e->pc0 = PC;
+        e->trc_inhibit = false;
+        e->cc0 = PSW;
+        e->ir = fetch(e);
+        exec(e, e->ir);
+        e->n_insns++;
+        tick(e);
+    }
+}
+
+// Runs at most n instructions from the current state. Returns the EMU_xxx stop reason.
+int emu_run(emu_t *e, u64_t n)
+{
+    e->end = e->n_insns + n;
+    e->stop = EMU_RUN;
+    e->in_trap = false;
+
+    if (setjmp(e->jb)) {
+        if (e->stop == EMU_SWR) {
+            memcpy(R, e->r0, sizeof(e->r0));
+            PSW = e->cc0;
+            e->trap_req = e->trap_req0;
+            e->trc_inhibit = e->trc0;
+            irq_eval(e);
+            return e->stop;
+        }
+        // bus error part way through an instruction (or a trap sequence): the condition codes
+        // are those from before the instruction
+        if (e->in_trap) { e->stop = EMU_DBLBUS; return e->stop; }
+        PSW = (PSW & ~017) | (e->cc0 & 017);
+        e->n_insns++;
+        tick(e);
+    }
+
+    ev_set(e);
+    run_loop(e);
+    if (e->stop == EMU_HALT) e->n_insns++;
+    return e->stop;
+}
+
+void emu_free(emu_t *e)
+{
+    free(e->out);
+    e->out = NULL;
+    e->n_out = e->alloc_out = 0;
+}
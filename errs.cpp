@@ -0,0 +1,335 @@
+//
+// Error call sites (txt2abs --errs outfile.err --in infile.txt, txt2abs --errs file.err --where nnnnnn)
+//
+// The diagnostic reports a failure by executing a trap instruction (104400-104777, "trap 0" in
+// CQKC) placed after each check, and the console shows its pc (or the pc following it, pushed
+// by the trap). This finds every such call in the converted image and records for it:
+//
+//      the test it belongs to, the last one-word heading comment ("// cc0", not a commented
+//      out label like "// swab_fail:") or label before it,
+//      and the description, the last longer comment ("// check branch insns")
+//      the check: the last instruction before it other than a branch (cmp, tst, bit, ...)
+//      the listing line and page
+//
+// Only trap instructions that are the first word of a source line and still in memory once the
+// image is loaded count (a word line of data that happens to hold 1044xx would too, but CQKC
+// has none). Comments only count as names at the start of a line.
+//
+// The table is written as a perfect hash on pc (hash and displace), mapped by the query, so an
+// error pc resolves with one lookup whatever the number of sites. If pc isn't a site, pc-2 is
+// tried as the return address the trap pushed. The file is:
+// err_hdr_t, u2_t disp[n_bkts] (padded to 4 bytes), err_ent_t[n_slots], strings.
+// A pc's slot is err_hash(pc, disp[err_hash(pc, 0) % n_bkts] + 1) % n_slots.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "txt2abs.h"
+
+#define ERR_MAGIC "T2AERR1"
+
+#define TRAP_LO     0104400
+#define TRAP_HI     0104777
+#define ERR_EMPTY   0177777     // pc of an unused slot (pcs are even)
+#define ERR_BKT     4           // average sites per bucket
+#define N_DISP      65536
+
+struct err_hdr_t {
+    char magic[8];
+    u4_t n_ents, n_slots, n_bkts, str_len;
+};
+
+struct err_ent_t {
+    u2_t pc, trap;
+    u2_t chk_pc, page;
+    u4_t line, chk_line;        // 1-based, chk_line 0 if no check found
+    u4_t test, desc, chk;       // offsets in the strings
+};
+
+struct err_pool_t {
+    char *s;
+    int len, alloc;
+};
+
+static u4_t err_hash(u4_t pc, u4_t d)
+{
+    u4_t x = (pc + 1) * 0x9e3779b1 ^ d * 0x85ebca6b;
+    x ^= x >> 16; x *= 0x7feb352d;
+    x ^= x >> 15; x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static u4_t pool_add(err_pool_t *p, const char *s)
+{
+    int n = strlen(s) + 1;
+    if (p->len + n > p->alloc) {
+        p->alloc = (p->len + n) * 2;
+        p->s = (char *) realloc(p->s, p->alloc);
+    }
+    memcpy(p->s + p->len, s, n);
+    p->len += n;
+    return p->len - n;
+}
+
+// text of a comment starting a line, or NULL
+static const char *comment(const char *s)
+{
+    if (s[0] != '/' || s[1] != '/') return NULL;
+    for (s += 2; *s == ' ' || *s == '\t'; s++)
+        ;
+    return s;
+}
+
+static bool is_branch(u2_t w)
+{
+    const op_t *op;
+    for (op = pdp11_ops; op->name; op++)
+        if ((w & op->mask) == op->code) break;
+    return op->name && (op->fmt == F_BR || op->fmt == F_SOB);
+}
+
+// The instruction before line i that set the condition codes the trap's branches test,
+// or -1 if a test boundary, another trap or the start of the listing comes first.
+static int err_check(listing_t *lst, int i)
+{
+    while (--i >= 0) {
+        lline_t *lp = &lst->ln[i];
+        if (!lp->active) continue;
+        if (lp->l.type == L_LABEL) return -1;
+        if (lp->l.type == L_BLANK) {
+            const char *cp = comment(lp->s);
+            if (cp && isalpha(*cp)) return -1;
+            continue;
+        }
+        if (lp->l.type != L_WORDS) {
+            if (lp->l.type == L_PAGE || lp->l.type == L_CHK_CUR || lp->l.type == L_CHK_PREV) continue;
+            return -1;
+        }
+        u2_t w;
+        if (listing_words(lst, i, &w, 1) < 1 || (w >= TRAP_LO && w <= TRAP_HI)) return -1;
+        if (!is_branch(w)) return i;
+    }
+    return -1;
+}
+
+// Places the sites in n_slots slots. Returns -1 if some bucket fits with no displacement.
+static int err_place(err_ent_t *sites, int n, err_ent_t *slots, int n_slots, u2_t *disp, int n_bkts)
+{
+    int *cnt = (int *) calloc(n_bkts, sizeof(int)), *order = (int *) malloc(sizeof(int) * (n_bkts + 1));
+    int *first = (int *) malloc(sizeof(int) * (n_bkts + 1)), *next = (int *) malloc(sizeof(int) * (n + 1));
+    int b, i, k, rv = 0;
+
+    for (b = 0; b < n_bkts; b++) first[b] = -1;
+    for (i = 0; i < n; i++) {
+        b = err_hash(sites[i].pc, 0) % n_bkts;
+        next[i] = first[b];
+        first[b] = i;
+        cnt[b]++;
+    }
+    for (i = 0; i < n_slots; i++) slots[i].pc = ERR_EMPTY;
+
+    // largest buckets first, while the table is emptiest (a simple insertion sort: few buckets)
+    for (b = 0; b < n_bkts; b++) {
+        for (k = b; k > 0 && cnt[order[k-1]] < cnt[b]; k--) order[k] = order[k-1];
+        order[k] = b;
+    }
+
+    for (k = 0; k < n_bkts; k++) {
+        b = order[k];
+        disp[b] = 0;
+        if (cnt[b] == 0) continue;
+        u4_t d;
+        for (d = 0; d < N_DISP; d++) {
+            for (i = first[b]; i >= 0; i = next[i]) {
+                u4_t s = err_hash(sites[i].pc, d + 1) % n_slots;
+                if (slots[s].pc != ERR_EMPTY) break;
+                slots[s] = sites[i];        // claimed, undone below if the bucket doesn't fit
+            }
+            if (i < 0) break;
+            for (int j = first[b]; j != i; j = next[j]) slots[err_hash(sites[j].pc, d + 1) % n_slots].pc = ERR_EMPTY;
+        }
+        if (d == N_DISP) { rv = -1; break; }
+        disp[b] = d;
+    }
+
+    free(cnt);
+    free(order);
+    free(first);
+    free(next);
+    return rv;
+}
+
+int errs_main(const char *fn_in, const char *fn_errs, int n_defs, char **defs)
+{
+    if (!conv_is_listing(fn_in)) { printf("%s: --errs needs the listing (.txt)\n", fn_in); return -1; }
+    FILE *fp;
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len), rv = -1;
+    u1_t *mem = (u1_t *) calloc(ABS_MEM, 1);
+    u1_t *loaded = (u1_t *) calloc(ABS_MEM, 1);
+    listing_t lst;
+    listing_init(&lst, n_defs, defs);
+    listing_load(&lst, fn_in);
+    err_ent_t *sites = NULL, *slots = NULL;
+    u2_t *disp = NULL;
+    err_pool_t pool = { NULL, 0, 0 };
+    int i, n = 0, n_tests = 0, n_chk = 0, n_slots, n_bkts;
+
+    if (errs) {
+        if (errs > 0) printf("%d error%s, no table written\n", errs, (errs != 1)? "s":"");
+        goto out;
+    }
+    abs_load(img, len, mem, loaded);
+
+    {
+        sites = (err_ent_t *) malloc(sizeof(err_ent_t) * (lst.n + 1));
+        u4_t test = pool_add(&pool, ""), desc = test, test_used = ~0;
+        char s[NBUF];
+
+        for (i = 0; i < lst.n; i++) {
+            lline_t *lp = &lst.ln[i];
+            if (!lp->active) continue;
+            if (lp->l.type == L_LABEL) { test = pool_add(&pool, lab_name(lp->l.v[0])); continue; }
+            if (lp->l.type == L_BLANK) {
+                const char *cp = comment(lp->s);
+                if (cp == NULL || !isalpha(*cp)) continue;
+                if (strpbrk(cp, " \t")) desc = pool_add(&pool, cp); else
+                if (cp[strlen(cp) - 1] != ':') test = pool_add(&pool, cp);  // "// swab_fail:" marks a branch target
+                continue;
+            }
+            if (lp->l.type != L_WORDS) continue;
+
+            u2_t w[3];
+            u4_t pc = listing_pc(&lst, i);
+            if (listing_words(&lst, i, w, 1) < 1 || w[0] < TRAP_LO || w[0] > TRAP_HI) continue;
+            if (pc + 1 >= ABS_MEM || !loaded[pc] || (mem[pc] | (mem[pc+1] << 8)) != w[0]) continue;
+
+            err_ent_t *e = &sites[n++];
+            memset(e, 0, sizeof(*e));
+            e->pc = pc;
+            e->trap = w[0];
+            e->line = i + 1;
+            int page = listing_page(&lst, i);
+            e->page = (page < 0)? 0 : page;
+            e->test = test;
+            e->desc = desc;
+            if (test != test_used) { n_tests++; test_used = test; }
+
+            int k = err_check(&lst, i);
+            if (k >= 0) {
+                e->chk_pc = listing_pc(&lst, k);
+                e->chk_line = k + 1;
+                int nw = listing_words(&lst, k, w, 3);
+                dis_pdp11(e->chk_pc, w, nw, s, NBUF);
+                e->chk = pool_add(&pool, s);
+                n_chk++;
+            } else {
+                e->chk = pool_add(&pool, "");
+            }
+        }
+    }
+
+    if (n == 0) { printf("no error calls (trap instructions) found\n"); goto out; }
+
+    // grow the table until every bucket finds a displacement (the first try practically always does)
+    n_bkts = (n + ERR_BKT - 1) / ERR_BKT;
+    disp = (u2_t *) malloc(sizeof(u2_t) * (n_bkts + 1));
+    for (n_slots = n; ; n_slots++) {
+        slots = (err_ent_t *) realloc(slots, sizeof(err_ent_t) * n_slots);
+        if (err_place(sites, n, slots, n_slots, disp, n_bkts) == 0) break;
+    }
+
+    if ((fp = fopen(fn_errs, "w")) == NULL) { printf("fopen W %s\n", fn_errs); goto out; }
+    {
+        err_hdr_t h;
+        memset(&h, 0, sizeof(h));
+        strcpy(h.magic, ERR_MAGIC);
+        h.n_ents = n;
+        h.n_slots = n_slots;
+        h.n_bkts = n_bkts;
+        h.str_len = pool.len;
+        u2_t pad = 0;
+        fwrite(&h, sizeof(h), 1, fp);
+        fwrite(disp, sizeof(u2_t), n_bkts, fp);
+        if (n_bkts & 1) fwrite(&pad, sizeof(u2_t), 1, fp);
+        fwrite(slots, sizeof(err_ent_t), n_slots, fp);
+        fwrite(pool.s, 1, pool.len, fp);
+        int err = ferror(fp);
+        if (fclose(fp) != 0 || err) { printf("write error %s\n", fn_errs); goto out; }
+    }
+    printf("%s: %d error call%s in %d test%s, %d with a check, %d slots\n", fn_errs, n, (n != 1)? "s":"",
+        n_tests, (n_tests != 1)? "s":"", n_chk, n_slots);
+    rv = 0;
+
+out:
+    free(sites);
+    free(slots);
+    free(disp);
+    free(pool.s);
+    listing_free(&lst);
+    free(mem);
+    free(loaded);
+    conv_free(c);
+    return rv;
+}
+
+static const err_ent_t *err_find(const err_hdr_t *h, const u2_t *disp, const err_ent_t *slots, u4_t pc)
+{
+    u4_t d = disp[err_hash(pc, 0) % h->n_bkts];
+    const err_ent_t *e = &slots[err_hash(pc, d + 1) % h->n_slots];
+    return (e->pc == pc)? e : NULL;
+}
+
+int errs_query(const char *fn_errs, u4_t pc)
+{
+    int fd;
+    struct stat st;
+    if ((fd = open(fn_errs, O_RDONLY)) < 0 || fstat(fd, &st) < 0) { printf("open %s\n", fn_errs); return -1; }
+    u1_t *base = (u1_t *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { printf("mmap %s\n", fn_errs); return -1; }
+
+    err_hdr_t *h = (err_hdr_t *) base;
+    u2_t *disp = (u2_t *) (h + 1);
+    err_ent_t *slots = (err_ent_t *) (disp + ((h->n_bkts + 1) & ~1));
+    const char *strs = (const char *) (slots + h->n_slots);
+    if ((size_t) st.st_size < sizeof(*h) || strcmp(h->magic, ERR_MAGIC) != 0 || h->n_bkts == 0 ||
+        (size_t) st.st_size != (size_t) ((u1_t *) (strs + h->str_len) - base)) {
+        printf("%s: not a txt2abs error call table\n", fn_errs);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    const err_ent_t *e = err_find(h, disp, slots, pc);
+    bool ret = false;
+    if (e == NULL && pc >= 2 && (e = err_find(h, disp, slots, pc - 2)) != NULL) ret = true;
+
+    if (e == NULL) {
+        printf("%06o: not an error call\n", pc);
+    } else {
+        printf("%06o: trap %o", e->pc, e->trap & 0377);
+        if (ret) printf(" (%06o is its return address)", pc);
+        printf(", line %d", e->line);
+        if (e->page) printf(" page %d", e->page);
+        printf("\n");
+        if (strs[e->test]) printf("test:  %s\n", &strs[e->test]);
+        if (strs[e->desc]) printf("       %s\n", &strs[e->desc]);
+        if (e->chk_line) printf("check: %06o %s (line %d)\n", e->chk_pc, &strs[e->chk], e->chk_line);
+    }
+    munmap(base, st.st_size);
+    return e? 0 : -1;
+}
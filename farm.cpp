@@ -0,0 +1,301 @@
+//
+// Loader farm: one process streaming images to many boards (txt2abs --port dev[=image] ... --farm)
+//
+// Usage: txt2abs [--def xxx] [--in default] [--cps n] [--baud n] --port dev[=image] [--port ...] --farm
+//
+// Every port is sent its image once (the --in image unless "=image" is given), all at the same
+// time from a single thread multiplexing the ports with epoll. Images go through conv_file(): one
+// ending in ".txt" is converted in memory (with the --def set), anything else is read as an
+// absolute format file and checked. Each is read or converted once and shared by all the ports
+// sending it.
+//
+// Each port is paced on its own: at most "--cps n" characters a second (default "--baud n" / 10,
+// or as fast as the line takes them), and an XOFF (023) from the board stops it until an XON
+// (021). Other input is ignored. A serial device is set to raw mode (and to "--baud n").
+// "--port pty" opens a pty instead and prints its name, as a stand-in for a board (e.g. an
+// emulator, or a test reading the stream).
+//
+// Progress is reported every second (ports done, loading and held by XOFF, bytes sent) and
+// when a port finishes or fails, and a table of all ports is printed at the end.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#include "txt2abs.h"
+
+#define FARM_CHUNK      256         // bytes written at a time
+#define FARM_REPORT_MS  1000
+
+#define XON     021
+#define XOFF    023
+
+enum port_e { P_LOADING, P_DONE, P_FAILED };
+
+struct fimg_t {
+    const char *fn;
+    conv_t conv;                    // holds the image (see conv_file())
+    const u1_t *data;
+    int len;
+};
+
+struct fport_t {
+    const char *dev;
+    char name[64];                  // pty slave
+    int fd, sfd;
+    fimg_t *img;
+    int off, state, xoffs;
+    bool xoff, want_out;
+    double t0, t1;                  // start, end
+    double credit;                  // characters the pacing allows now
+    const char *err;
+};
+
+static fimg_t imgs[N_PORTS];
+static int n_imgs;
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static fimg_t *img_get(const char *fn, int n_defs, char **defs)
+{
+    for (int i = 0; i < n_imgs; i++)
+        if (strcmp(imgs[i].fn, fn) == 0) return &imgs[i];
+
+    fimg_t *im = &imgs[n_imgs];
+    conv_t *c = &im->conv;
+    conv_init(c, NULL, 0);
+    long len;
+    int errs = conv_file(c, fn, n_defs, defs, &im->data, &len);
+    if (errs) {
+        if (errs > 0) printf("%s: %d error%s, not sent\n", fn, errs, (errs != 1)? "s":"");
+        conv_free(c);
+        return NULL;
+    }
+    im->fn = fn;
+    im->len = len;
+    n_imgs++;
+    return im;
+}
+
+static speed_t baud_speed(int baud)
+{
+    static const struct { int baud; speed_t sp; } speeds[] = {
+        { 300, B300 }, { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+        { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 }, { 0, B0 }
+    };
+    for (int i = 0; speeds[i].baud; i++)
+        if (speeds[i].baud == baud) return speeds[i].sp;
+    return B0;
+}
+
+static int port_open(fport_t *p, int baud)
+{
+    struct termios t;
+    if (strcmp(p->dev, "pty") == 0) {
+        if ((p->fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0 || grantpt(p->fd) < 0 || unlockpt(p->fd) < 0) {
+            printf("can't open a pty\n");
+            return -1;
+        }
+        snprintf(p->name, sizeof(p->name), "%s", ptsname(p->fd));
+        // hold the slave open, raw, so the stream waits there for the stand-in
+        p->sfd = open(p->name, O_RDWR | O_NOCTTY);
+        tcgetattr(p->sfd, &t);
+        cfmakeraw(&t);
+        tcsetattr(p->sfd, TCSANOW, &t);
+        return 0;
+    }
+
+    snprintf(p->name, sizeof(p->name), "%s", p->dev);
+    if ((p->fd = open(p->dev, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) { printf("open %s: %s\n", p->dev, strerror(errno)); return -1; }
+    if (tcgetattr(p->fd, &t) == 0) {
+        cfmakeraw(&t);
+        t.c_cflag |= CLOCAL | CREAD;
+        if (baud) {
+            if (baud_speed(baud) == B0) { printf("--baud %d not supported\n", baud); return -1; }
+            cfsetispeed(&t, baud_speed(baud));
+            cfsetospeed(&t, baud_speed(baud));
+        }
+        tcsetattr(p->fd, TCSANOW, &t);
+    }
+    return 0;
+}
+
+static void port_end(fport_t *p, int state, const char *err, double now)
+{
+    p->state = state;
+    p->err = err;
+    p->t1 = now;
+    printf("%8.1fs %s %s", (now - p->t0) / 1000.0, p->name, (state == P_DONE)? "done" : "failed");
+    if (err) printf(": %s at byte %d of %d", err, p->off, p->img->len);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void port_epoll(int ep, fport_t *p, int i, bool out)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (out? (u4_t) EPOLLOUT : 0);
+    ev.data.u32 = i;
+    epoll_ctl(ep, EPOLL_CTL_MOD, p->fd, &ev);
+    p->want_out = out;
+}
+
+int farm_main(int n_ports, char **port_s, const char *fn_in, int n_defs, char **defs, int cps, int baud)
+{
+    if (cps == 0 && baud) cps = baud / 10;
+    fport_t *ports = (fport_t *) calloc(n_ports, sizeof(fport_t));
+    int ep = epoll_create1(0), i, rv = -1;
+    fport_t *p;
+
+    for (i = 0; i < n_ports; i++) {
+        p = &ports[i];
+        char *eq = strchr(port_s[i], '=');
+        if (eq) *eq = '\0';
+        p->dev = port_s[i];
+        const char *fn = eq? eq + 1 : fn_in;
+        if (fn == NULL) { printf("--port %s: no image (=image or --in)\n", p->dev); goto out; }
+        if ((p->img = img_get(fn, n_defs, defs)) == NULL || port_open(p, baud) < 0) goto out;
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, p->fd, &ev);
+        p->want_out = true;
+        printf("%s: %s, %d bytes\n", p->name, p->img->fn, p->img->len);
+    }
+    fflush(stdout);
+
+    {
+        double start = now_ms(), last = start, report = start + FARM_REPORT_MS;
+        for (i = 0; i < n_ports; i++) ports[i].t0 = start;
+        int active = n_ports;
+        struct epoll_event evs[N_PORTS];
+        u1_t rbuf[256];
+
+        while (active) {
+            // the earliest a paced port can write again
+            int wait = FARM_REPORT_MS;
+            if (cps) wait = 1000 * FARM_CHUNK / cps / 4 + 1;
+            int n = epoll_wait(ep, evs, N_PORTS, wait);
+            double now = now_ms();
+
+            for (i = 0; i < n_ports; i++) {
+                p = &ports[i];
+                if (p->state != P_LOADING) continue;
+                if (cps) {
+                    p->credit += (now - last) * cps / 1000.0;
+                    if (p->credit > FARM_CHUNK) p->credit = FARM_CHUNK;
+                }
+            }
+            last = now;
+
+            for (int k = 0; k < n; k++) {
+                p = &ports[evs[k].data.u32];
+                if (p->state != P_LOADING) continue;
+                if (evs[k].events & EPOLLIN) {
+                    int r = read(p->fd, rbuf, sizeof(rbuf));
+                    for (int j = 0; j < r; j++) {
+                        if (rbuf[j] == XOFF) { if (!p->xoff) p->xoffs++; p->xoff = true; }
+                        if (rbuf[j] == XON) p->xoff = false;
+                    }
+                }
+                if ((evs[k].events & (EPOLLERR | EPOLLHUP)) && !(evs[k].events & EPOLLIN) && strcmp(p->dev, "pty") != 0) {
+                    port_end(p, P_FAILED, "hangup", now);
+                    active--;
+                }
+            }
+
+            for (i = 0; i < n_ports; i++) {
+                p = &ports[i];
+                if (p->state != P_LOADING) continue;
+                int len = p->img->len - p->off;
+                if (len > FARM_CHUNK) len = FARM_CHUNK;
+                if (cps && len > (int) p->credit) len = (int) p->credit;
+                if (p->xoff || len == 0) {
+                    if (p->want_out) port_epoll(ep, p, i, false);
+                    continue;
+                }
+                int w = write(p->fd, p->img->data + p->off, len);
+                if (w < 0 && errno != EAGAIN) {
+                    port_end(p, P_FAILED, strerror(errno), now);
+                    active--;
+                    continue;
+                }
+                if (w > 0) {
+                    p->off += w;
+                    if (cps) p->credit -= w;
+                }
+                if (p->off == p->img->len) {
+                    port_end(p, P_DONE, NULL, now);
+                    active--;
+                    continue;
+                }
+                // paced ports wait for the pacing unless the line is full
+                bool out = (w < len || !cps);
+                if (out != p->want_out) port_epoll(ep, p, i, out);
+            }
+
+            if (now >= report && active) {
+                int done = 0, loading = 0, held = 0, failed = 0;
+                long sent = 0, total = 0;
+                for (i = 0; i < n_ports; i++) {
+                    p = &ports[i];
+                    if (p->state == P_DONE) done++; else
+                    if (p->state == P_FAILED) failed++; else
+                    { loading++; if (p->xoff) held++; }
+                    sent += p->off;
+                    total += p->img->len;
+                }
+                printf("%8.1fs %d done, %d loading (%d xoff), %d failed, %ld of %ld bytes\n", (now - start) / 1000.0,
+                    done, loading, held, failed, sent, total);
+                fflush(stdout);
+                report = now + FARM_REPORT_MS;
+            }
+        }
+    }
+
+    printf("\n%-20s %-24s %8s %8s %8s %5s  %s\n", "port", "image", "bytes", "secs", "cps", "xoffs", "result");
+    rv = 0;
+    for (i = 0; i < n_ports; i++) {
+        p = &ports[i];
+        double secs = (p->t1 - p->t0) / 1000.0;
+        printf("%-20s %-24s %8d %8.2f %8.0f %5d  %s\n", p->name, p->img->fn, p->off, secs, (secs > 0)? p->off / secs : 0.0,
+            p->xoffs, (p->state == P_DONE)? "done" : p->err);
+        if (p->state != P_DONE) rv = -1;
+    }
+
+    // the stream is lost if a pty goes away before its stand-in has read it
+    for (i = 0; i < n_ports; i++) {
+        int queued;
+        for (bool said = false; ports[i].sfd > 0 && ioctl(ports[i].sfd, FIONREAD, &queued) == 0 && queued > 0; said = true) {
+            if (!said) { printf("waiting for %s to read %d bytes\n", ports[i].name, queued); fflush(stdout); }
+            usleep(10000);
+        }
+    }
+
+out:
+    for (i = 0; i < n_ports; i++) {
+        if (ports[i].fd > 0) close(ports[i].fd);
+        if (ports[i].sfd > 0) close(ports[i].sfd);
+    }
+    close(ep);
+    free(ports);
+    for (i = 0; i < n_imgs; i++) conv_free(&imgs[i].conv);
+    n_imgs = 0;
+    return rv;
+}
@@ -0,0 +1,322 @@
+//
+// Fault injection (txt2abs --inject N | --fault spec ... --in infile.txt)
+//
+// The listing is converted and booted once on the interpreter up to the end of its first pass.
+// That snapshot is then the starting point of every scenario: a copy of it is given one fault
+// and run for K more passes ("--run K", default 1) on a pool of threads ("--jobs n"). The
+// outcome of each scenario is classified as for --run (see run.cpp) and the results are
+// aggregated by fault type, and by distinct outcome (result and error pc) with the number of
+// different instructions whose fault led to it.
+//
+// "--inject N" generates N scenarios, cycling through the fault types and spread evenly (with
+// some jitter from "--seed n") over the instructions of a clean pass. "--fault spec" adds one
+// explicit scenario, listed individually. Each scenario depends only on its spec, so results
+// are the same on any number of threads and a generated scenario can be rerun with --fault.
+//
+// spec: type[:vec[:level]]@[n][=addr]
+//      type    par     parity error, trap to 114 (memory reads only)
+//              nxm     bus timeout, trap to 4
+//              irq     interrupt through vec (default 0) at bus request level (default 4)
+//      n       instructions after the snapshot at which the fault is armed (default 0)
+//      addr    (octal) the fault hits the first access to addr, else the first access
+//
+// e.g. --fault par@1200 --fault nxm@=1014 --fault irq:100:6@50000
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "txt2abs.h"
+
+#define N_FAULT_TYPES 3
+#define N_GROUPS 40         // distinct outcomes listed
+
+static const char *type_name[N_FAULT_TYPES] = { "par", "nxm", "irq" };
+
+// vectors and levels of the generated spurious interrupts
+static const struct { u2_t vec; u1_t pri; } spurious[] = {
+    { 0, 4 }, { 060, 4 }, { 0100, 6 }, { 0300, 5 }
+};
+#define N_SPURIOUS (int) (sizeof(spurious) / sizeof(spurious[0]))
+
+struct scen_t {
+    fault_t f;
+    run_t r;
+};
+
+static scen_t *scens;
+static int n_scens, next_scen;
+static emu_t *snap;
+static run_t snap_r;
+static int passes;
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int fault_parse(const char *spec, fault_t *f)
+{
+    const char *cp = spec;
+    char *ep;
+    int t;
+    memset(f, 0, sizeof(*f));
+    f->addr = -1;
+    f->pri = 4;
+
+    for (t = 0; t < N_FAULT_TYPES; t++)
+        if (strncmp(cp, type_name[t], 3) == 0) break;
+    if (t == N_FAULT_TYPES) return -1;
+    f->type = (fault_e) t;
+    cp += 3;
+    if (*cp == ':' && f->type == FAULT_IRQ) {
+        f->vec = strtoul(cp + 1, &ep, 8) & 0774;
+        cp = ep;
+        if (*cp == ':') { f->pri = strtoul(cp + 1, &ep, 8); cp = ep; }
+        if (f->pri < 4 || f->pri > 7) return -1;
+    }
+    if (*cp++ != '@') return -1;
+    if (*cp >= '0' && *cp <= '9') { f->at = strtoull(cp, &ep, 10); cp = ep; }
+    if (*cp == '=') { f->addr = strtoul(cp + 1, &ep, 8) & 0177776; cp = ep; }
+    return (*cp == '\0')? 0 : -1;
+}
+
+static void fault_spec(const fault_t *f, char *s, int ns)
+{
+    int n = snprintf(s, ns, "%s", type_name[f->type]);
+    if (f->type == FAULT_IRQ) n += snprintf(s + n, ns - n, ":%o:%d", f->vec, f->pri);
+    n += snprintf(s + n, ns - n, "@%llu", (unsigned long long) f->at);
+    if (f->addr >= 0) snprintf(s + n, ns - n, "=%o", f->addr);
+}
+
+static u4_t xorshift(u4_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static void *worker(void *)
+{
+    emu_t *e = (emu_t *) malloc(sizeof(emu_t));
+    int i;
+
+    while ((i = __sync_fetch_and_add(&next_scen, 1)) < n_scens) {
+        scen_t *s = &scens[i];
+        memcpy(e, snap, sizeof(emu_t));
+        e->out = NULL;
+        e->n_out = e->alloc_out = 0;
+        s->r = snap_r;
+        s->r.out = NULL;
+        e->arg = &s->r;
+
+        fault_t f = s->f;
+        f.at += snap->n_insns;
+        emu_fault(e, &f);
+        run_passes(e, &s->r, snap_r.passes + passes);
+        s->f.fired = e->fault.fired;
+        s->f.pc = e->fault.pc;
+        emu_free(e);
+    }
+
+    free(e);
+    return NULL;
+}
+
+static const char *outcome(const scen_t *s)
+{
+    if (!s->f.fired) return "not hit";
+    return run_result(&s->r);
+}
+
+static u4_t outcome_pc(const scen_t *s)
+{
+    return s->r.errs? s->r.err_pc : s->r.stop_pc;
+}
+
+static bool same_outcome(const scen_t *a, const scen_t *b)
+{
+    return a->f.type == b->f.type && a->r.stop == b->r.stop && (a->r.errs != 0) == (b->r.errs != 0) &&
+        outcome_pc(a) == outcome_pc(b);
+}
+
+int fault_main(const char *fn_in, int n_defs, char **defs, const run_opt_t *opt, int n_gen, u4_t seed,
+    int n_specs, char **specs, int n_threads)
+{
+    int i, t;
+    passes = (opt->passes > 0)? opt->passes : 1;
+
+    for (i = 0; i < n_specs; i++) {
+        fault_t f;
+        if (fault_parse(specs[i], &f) < 0) { printf("bad fault spec \"%s\"\n", specs[i]); return -1; }
+    }
+
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len);
+    if (errs) {
+        if (errs > 0) printf("%d error%s, not run\n", errs, (errs != 1)? "s":"");
+        conv_free(c);
+        return -1;
+    }
+
+    // boot to the end of the first pass, then check a clean run from there
+    snap = (emu_t *) malloc(sizeof(emu_t));
+    run_start(snap, img, len, opt, &snap_r);
+    conv_free(c);
+    run_passes(snap, &snap_r, 1);
+    if (!RUN_PASSED(&snap_r)) {
+        printf("boot: ");
+        run_done(snap, &snap_r);
+        run_report(stdout, &snap_r);
+        free(snap_r.out);
+        emu_free(snap);
+        free(snap);
+        return -1;
+    }
+
+    emu_t *e = (emu_t *) malloc(sizeof(emu_t));
+    run_t clean;
+    memcpy(e, snap, sizeof(emu_t));
+    e->out = NULL;
+    e->n_out = e->alloc_out = 0;
+    clean = snap_r;
+    e->arg = &clean;
+    run_passes(e, &clean, 1 + passes);
+    if (!RUN_PASSED(&clean)) {
+        printf("clean run from snapshot: ");
+        run_done(e, &clean);
+        run_report(stdout, &clean);
+        free(clean.out);
+        emu_free(e);
+        free(e);
+        emu_free(snap);
+        free(snap);
+        return -1;
+    }
+    u64_t pass_len = (clean.n_insns - snap->n_insns) / passes;
+    emu_free(e);
+    free(e);
+    printf("snapshot at %llu instructions, %llu a pass\n", (unsigned long long) snap->n_insns, (unsigned long long) pass_len);
+
+    // scenarios
+    n_scens = n_specs + n_gen;
+    scens = (scen_t *) calloc(n_scens, sizeof(scen_t));
+    for (i = 0; i < n_specs; i++) fault_parse(specs[i], &scens[i].f);
+    int per_type = (n_gen + N_FAULT_TYPES - 1) / N_FAULT_TYPES;
+    u64_t stride = per_type? pass_len / per_type : 0;
+    for (i = 0; i < n_gen; i++) {
+        fault_t *f = &scens[n_specs + i].f;
+        u4_t x = xorshift(seed * 2654435761u + i + 1);
+        f->type = (fault_e) (i % N_FAULT_TYPES);
+        f->at = (u64_t) (i / N_FAULT_TYPES) * stride + (stride? x % stride : 0);
+        f->addr = -1;
+        const int sp = (i / N_FAULT_TYPES) % N_SPURIOUS;
+        f->vec = spurious[sp].vec;
+        f->pri = spurious[sp].pri;
+    }
+
+    if (n_threads <= 0) n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > n_scens) n_threads = n_scens;
+    if (n_threads < 1) n_threads = 1;
+
+    double t0 = now_ms();
+    pthread_t *tids = (pthread_t *) malloc(sizeof(pthread_t) * n_threads);
+    for (i = 0; i < n_threads; i++) pthread_create(&tids[i], NULL, worker, NULL);
+    for (i = 0; i < n_threads; i++) pthread_join(tids[i], NULL);
+    double ms = now_ms() - t0;
+
+    // explicit scenarios
+    char spec[64];
+    for (i = 0; i < n_specs; i++) {
+        scen_t *s = &scens[i];
+        fault_spec(&s->f, spec, sizeof(spec));
+        printf("%-24s %-8s %6d %6d %06o", spec, outcome(s), s->r.passes - snap_r.passes, s->r.errs, outcome_pc(s));
+        if (s->f.fired) printf("  hit %06o at %llu", s->f.pc, (unsigned long long) (s->f.fired - 1 - snap->n_insns));
+        printf("\n");
+    }
+
+    // by type
+    #define N_OUTCOMES 7
+    static const char *outcomes[N_OUTCOMES] = { "not hit", "pass", "errors", "halt", "hung", "timeout", "dblbus" };
+    int counts[N_FAULT_TYPES + 1][N_OUTCOMES];
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < n_scens; i++) {
+        const char *o = outcome(&scens[i]);
+        for (int k = 0; k < N_OUTCOMES; k++) {
+            if (strcmp(o, outcomes[k]) != 0) continue;
+            counts[scens[i].f.type][k]++;
+            counts[N_FAULT_TYPES][k]++;
+        }
+    }
+    printf("\n%-6s %9s", "fault", "scenarios");
+    for (int k = 0; k < N_OUTCOMES; k++) printf(" %8s", outcomes[k]);
+    printf("\n");
+    for (t = 0; t <= N_FAULT_TYPES; t++) {
+        int n = 0;
+        for (int k = 0; k < N_OUTCOMES; k++) n += counts[t][k];
+        if (n == 0) continue;
+        printf("%-6s %9d", (t < N_FAULT_TYPES)? type_name[t] : "total", n);
+        for (int k = 0; k < N_OUTCOMES; k++) printf(" %8d", counts[t][k]);
+        printf("\n");
+    }
+
+    // distinct outcomes other than a clean pass, most frequent first, with a scenario to rerun
+    int *grp = (int *) malloc(sizeof(int) * n_scens), *cnt = (int *) calloc(n_scens, sizeof(int)), n_grp = 0;
+    for (i = 0; i < n_scens; i++) {
+        scen_t *s = &scens[i];
+        if (!s->f.fired || RUN_PASSED(&s->r)) continue;
+        int g;
+        for (g = 0; g < n_grp; g++) {
+            if (same_outcome(&scens[grp[g]], s)) break;
+        }
+        if (g == n_grp) grp[n_grp++] = i;
+        cnt[g]++;
+    }
+    for (i = 1; i < n_grp; i++) {
+        for (int j = i; j > 0 && cnt[j] > cnt[j-1]; j--) {
+            int tg = grp[j]; grp[j] = grp[j-1]; grp[j-1] = tg;
+            int tc = cnt[j]; cnt[j] = cnt[j-1]; cnt[j-1] = tc;
+        }
+    }
+    // and the number of different instructions hit that led to each
+    static u1_t seen[(ABS_MEM / 2) / 8];
+    if (n_grp) printf("\n%-6s %-8s %6s %6s %6s  %s\n", "fault", "outcome", "pc", "count", "insns", "e.g.");
+    for (i = 0; i < n_grp && i < N_GROUPS; i++) {
+        scen_t *s = &scens[grp[i]];
+        int n_pcs = 0;
+        memset(seen, 0, sizeof(seen));
+        for (int j = 0; j < n_scens; j++) {
+            scen_t *s2 = &scens[j];
+            if (!s2->f.fired || !same_outcome(s2, s)) continue;
+            int w = s2->f.pc >> 1;
+            if (!(seen[w >> 3] & (1 << (w & 7)))) { seen[w >> 3] |= 1 << (w & 7); n_pcs++; }
+        }
+        fault_spec(&s->f, spec, sizeof(spec));
+        printf("%-6s %-8s %06o %6d %6d  --fault %s\n", type_name[s->f.type], outcome(s), outcome_pc(s), cnt[i], n_pcs, spec);
+    }
+    if (n_grp > N_GROUPS) printf("(%d more)\n", n_grp - N_GROUPS);
+
+    printf("\n%d scenario%s of %d pass%s, %.1f ms on %d thread%s\n", n_scens, (n_scens != 1)? "s":"",
+        passes, (passes != 1)? "es":"", ms, n_threads, (n_threads != 1)? "s":"");
+
+    free(grp);
+    free(cnt);
+    free(tids);
+    free(scens);
+    emu_free(snap);
+    free(snap);
+    return 0;
+}
@@ -0,0 +1,151 @@
+//
+// Memory initialization files for simulated and FPGA PDP-11 cores
+//
+// Usage: txt2abs [--def xxx] --mem fmt [--width n] [--base nnnnnn] [--depth n] --in infile.txt --out outfile
+//
+// Converts in memory and writes the image as the contents of a RAM, one entry per n bits
+// ("--width" 8, 16 (default) or 32) starting from the byte address "--base" (octal, default 0),
+// so a simulation can start with the program already in memory instead of running a loader.
+// Words are little-endian as on the PDP-11: a 16-bit entry is the byte at the even address plus
+// the next one << 8, a 32-bit entry the word at the lower address plus the next one << 16.
+// The RAM is "--depth" entries deep (decimal), by default just enough to hold the image.
+// Bytes the image doesn't load are 0 (memh and memb leave out entries with none loaded).
+//
+// fmt:
+//      memh    $readmemh: hex entries, one per line, "@addr" before each run of loaded entries
+//      memb    $readmemb: the same in binary
+//      coe     Xilinx block memory generator coefficients file, radix 16
+//      mif     Intel/Altera memory initialization file, radix hex, runs of zero entries as ranges
+//
+// Each file starts with a comment giving the start address of the image.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "txt2abs.h"
+
+enum mem_fmt_e { MEM_H, MEM_B, MEM_COE, MEM_MIF };
+
+static const char *fmt_name[] = { "memh", "memb", "coe", "mif", NULL };
+
+// entry e of the RAM: bpe bytes from base
+static u4_t entry(const u1_t *mem, u4_t base, int bpe, int e)
+{
+    u4_t v = 0;
+    for (int b = 0; b < bpe; b++) v |= mem[base + e*bpe + b] << (b * 8);
+    return v;
+}
+
+static bool entry_loaded(const u1_t *loaded, u4_t base, int bpe, int e)
+{
+    for (int b = 0; b < bpe; b++) if (loaded[base + e*bpe + b]) return true;
+    return false;
+}
+
+static void put_bin(FILE *fp, u4_t v, int width)
+{
+    for (int i = width - 1; i >= 0; i--) fputc('0' + ((v >> i) & 1), fp);
+}
+
+int fpga_main(const char *fn_in, const char *fn_out, int n_defs, char **defs, const char *fmt_s, int width, u4_t base, int depth)
+{
+    int fmt;
+    for (fmt = 0; fmt_name[fmt] && strcmp(fmt_name[fmt], fmt_s) != 0; fmt++)
+        ;
+    if (fmt_name[fmt] == NULL) { printf("bad --mem \"%s\": memh, memb, coe or mif\n", fmt_s); return -1; }
+    if (width != 8 && width != 16 && width != 32) { printf("bad --width %d: 8, 16 or 32\n", width); return -1; }
+    int bpe = width / 8;
+    if (base >= ABS_MEM || (base % bpe)) { printf("bad --base %o: must be a multiple of %d\n", base, bpe); return -1; }
+    if (fn_out == NULL) { printf("--mem requires --out\n"); return -1; }
+
+    FILE *fp;
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len), rv = -1;
+    u1_t *mem = (u1_t *) calloc(ABS_MEM, 1);
+    u1_t *loaded = (u1_t *) calloc(ABS_MEM, 1);
+    int start = abs_load(img, len, mem, loaded);
+    int a, i, n, lo = ABS_MEM, hi = -1;
+
+    for (a = 0; a < ABS_MEM; a++) {
+        if (!loaded[a]) continue;
+        if (a < lo) lo = a;
+        hi = a;
+    }
+
+    if (errs) {
+        if (errs > 0) printf("%d error%s, not written\n", errs, (errs != 1)? "s":"");
+    } else
+    if (hi < 0) {
+        printf("nothing loaded\n");
+    } else
+    if ((u4_t) lo < base) {
+        printf("image loads at %06o, below --base %06o\n", lo, base);
+    } else {
+        int need = (hi - base) / bpe + 1;
+        if (depth == 0) depth = need;
+        if (need > depth || base + depth * bpe > ABS_MEM) {
+            printf("image needs %d entries of %d bits from %06o, --depth %d\n", need, width, base, depth);
+            goto out;
+        }
+        if ((fp = fopen(fn_out, "w")) == NULL) { printf("fopen W %s\n", fn_out); goto out; }
+
+        #define ENTRY(e) entry(mem, base, bpe, e)
+        #define LOADED(e) entry_loaded(loaded, base, bpe, e)
+
+        char st[32];
+        if (start < 0 || (start & 1)) sprintf(st, "none (halt)"); else sprintf(st, "%06o", start);
+        int hexw = bpe * 2;
+
+        switch (fmt) {
+        case MEM_H:
+        case MEM_B:
+            fprintf(fp, "// %s: %d entries of %d bits from %06o, start %s\n", fn_in, depth, width, base, st);
+            for (i = 0; i < depth; i++) {
+                if (!LOADED(i)) continue;
+                if (i == 0 || !LOADED(i-1)) fprintf(fp, "@%x\n", i);
+                if (fmt == MEM_H) fprintf(fp, "%0*x\n", hexw, ENTRY(i)); else { put_bin(fp, ENTRY(i), width); fputc('\n', fp); }
+            }
+            break;
+
+        case MEM_COE:
+            fprintf(fp, "; %s: %d entries of %d bits from %06o, start %s\n", fn_in, depth, width, base, st);
+            fprintf(fp, "memory_initialization_radix=16;\nmemory_initialization_vector=\n");
+            for (i = 0; i < depth; i++)
+                fprintf(fp, "%0*x%s\n", hexw, ENTRY(i), (i == depth - 1)? ";" : ",");
+            break;
+
+        case MEM_MIF:
+            fprintf(fp, "-- %s: %d entries of %d bits from %06o, start %s\n", fn_in, depth, width, base, st);
+            fprintf(fp, "WIDTH=%d;\nDEPTH=%d;\nADDRESS_RADIX=HEX;\nDATA_RADIX=HEX;\nCONTENT BEGIN\n", width, depth);
+            for (i = 0; i < depth; i = n) {
+                u4_t v = ENTRY(i);
+                for (n = i + 1; n < depth && v == 0 && ENTRY(n) == 0; n++)
+                    ;
+                if (n - i > 1)
+                    fprintf(fp, "    [%x..%x] : 0;\n", i, n - 1);
+                else
+                    fprintf(fp, "    %x : %0*x;\n", i, hexw, v);
+            }
+            fprintf(fp, "END;\n");
+            break;
+        }
+
+        if (fclose(fp) != 0) { printf("write error %s\n", fn_out); goto out; }
+        printf("%s: %d entries of %d bits from %06o, start %s\n", fn_out, depth, width, base, st);
+        rv = 0;
+    }
+
+out:
+    free(mem);
+    free(loaded);
+    conv_free(c);
+    return rv;
+}
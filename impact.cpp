@@ -0,0 +1,211 @@
+//
+// Define impact analysis (txt2abs --impact)
+//
+// Usage: txt2abs [--def xxx] --impact --in infile.txt
+//
+// For every define tested by a conditional of the listing, prints the source lines and the
+// address ranges it can affect:
+//
+// NAME lines a-b,c-d,...               1-based, including the #if/#elif/#else/#endif lines
+// NAME addrs nnnnnn-nnnnnn,...         octal, inclusive
+//
+// The lines come from one walk of the conditional structure. Each nesting level carries the set
+// of defines its branch depends on: those tested by its #if and any #elif above it (so a
+// #elif's define affects only its own branch and the ones after it) plus those of the enclosing
+// levels. A "#define X" inside such a branch makes X depend on the same set, so a later test of X
+// is attributed to them too.
+//
+// The addresses compare the listing evaluated with the --def set without NAME (ignoring any
+// "#define NAME") and with it: the words of its lines in either evaluation, plus any other line
+// whose pc moves because the branches differ in size. A define whose lines are only active in
+// combination with other defines has lines but no addresses here.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "txt2abs.h"
+
+#define N_SETW (N_SYMS / 32)
+
+struct imp_t {
+    int order;              // first seen
+    int n_rng, alloc;
+    int (*rng)[2];          // line ranges, 0-based inclusive
+    u4_t dep[N_SETW];       // defines a #define of this symbol depends on
+};
+
+static imp_t *imps[N_SYMS];
+static int n_order;
+
+static imp_t *imp(int s)
+{
+    if (imps[s] == NULL) {
+        imps[s] = (imp_t *) calloc(1, sizeof(imp_t));
+        imps[s]->order = -1;
+    }
+    return imps[s];
+}
+
+static void set_sym(u4_t *set, int s)
+{
+    if (s < 0) return;
+    set[s >> 5] |= 1u << (s & 31);
+    imp_t *ip = imp(s);
+    if (ip->order < 0) ip->order = n_order++;
+    for (int i = 0; i < N_SETW; i++) set[i] |= ip->dep[i];
+}
+
+static void add_line(imp_t *ip, int line)
+{
+    if (ip->n_rng && ip->rng[ip->n_rng - 1][1] == line - 1) { ip->rng[ip->n_rng - 1][1] = line; return; }
+    if (ip->n_rng == ip->alloc) {
+        ip->alloc = ip->alloc * 2 + 16;
+        ip->rng = (int (*)[2]) realloc(ip->rng, sizeof(int[2]) * ip->alloc);
+    }
+    ip->rng[ip->n_rng][0] = ip->rng[ip->n_rng][1] = line;
+    ip->n_rng++;
+}
+
+// walk of the conditional structure, attributing lines to defines
+static void impact_lines(listing_t *lst)
+{
+    u4_t stk[N_IFDEFS + 1][N_SETW];
+    int sp = 0, i, j, k;
+    memset(stk[0], 0, sizeof(stk[0]));
+
+    for (i = 0; i < lst->n; i++) {
+        line_t *l = &lst->ln[i].l;
+        int syms[N_IFDEFS], ns = 0;
+        u4_t *top = stk[sp];
+
+        switch (l->type) {
+        case L_IF1: case L_IF0: case L_IF: case L_IFDEF:
+            if (sp == N_IFDEFS) break;
+            sp++;
+            memcpy(stk[sp], top, sizeof(stk[0]));
+            top = stk[sp];
+            if (l->type == L_IFDEF) syms[ns++] = cond_sym(l->name);
+            if (l->type == L_IF) ns = cond_syms(l->v[0], syms, N_IFDEFS);
+            break;
+        case L_ELIF:
+            ns = cond_syms(l->v[0], syms, N_IFDEFS);
+            break;
+        case L_DEFINE: {
+            int s = cond_sym(l->name);
+            if (s >= 0) for (j = 0; j < N_SETW; j++) imp(s)->dep[j] |= top[j];
+            break;
+        }
+        default:
+            break;
+        }
+        for (j = 0; j < ns; j++) set_sym(top, syms[j]);
+
+        for (j = 0; j < N_SETW; j++)
+            for (k = 0; k < 32 && (top[j] >> k); k++)
+                if ((top[j] >> k) & 1) add_line(imp(j*32 + k), i);
+
+        if (l->type == L_ENDIF && sp > 0) sp--;
+    }
+}
+
+static void mark(u1_t *m, u4_t pc, int n)
+{
+    for (; n > 0; pc++, n--) if (pc < ABS_MEM) m[pc >> 3] |= 1 << (pc & 7);
+}
+
+// pc and size of each line as currently evaluated
+static void snapshot(listing_t *lst, u4_t *pc, int *size)
+{
+    for (int i = 0; i < lst->n; i++) {
+        lline_t *lp = &lst->ln[i];
+        pc[i] = listing_pc(lst, i);
+        size[i] = lp->active? line_size(&lp->l) : -1;
+    }
+}
+
+static void eval(listing_t *lst, int n_defs, char **defs, const char *undef)
+{
+    lst->n_defs = n_defs;
+    for (int i = 0; i < n_defs; i++) lst->defs[i] = defs[i];
+    lst->undef = undef;
+    lst->stale = true;
+    listing_sync(lst);
+}
+
+static int order_cmp(const void *a, const void *b)
+{
+    return imps[*(const int *) a]->order - imps[*(const int *) b]->order;
+}
+
+int impact_main(const char *fn_in, int n_defs, char **defs)
+{
+    listing_t lst;
+    int i, k, n_syms = 0;
+    int syms[N_SYMS];
+
+    listing_init(&lst, 0, NULL);
+    if (listing_load(&lst, fn_in) < 0) { printf("fopen R %s\n", fn_in); return -1; }
+    impact_lines(&lst);
+
+    for (i = 0; i < N_SYMS; i++) if (imps[i] && imps[i]->order >= 0) syms[n_syms++] = i;
+    qsort(syms, n_syms, sizeof(int), order_cmp);
+
+    u4_t *pc0 = (u4_t *) malloc(sizeof(u4_t) * (lst.n + 1)), *pc1 = (u4_t *) malloc(sizeof(u4_t) * (lst.n + 1));
+    int *sz0 = (int *) malloc(sizeof(int) * (lst.n + 1)), *sz1 = (int *) malloc(sizeof(int) * (lst.n + 1));
+    u1_t *in = (u1_t *) malloc(lst.n + 1);
+    u1_t *m = (u1_t *) malloc(ABS_MEM / 8);
+    char *dv[N_IFDEFS + 1];
+
+    for (k = 0; k < n_syms; k++) {
+        imp_t *ip = imps[syms[k]];
+        const char *name = cond_name(syms[k]);
+        int nd = 0, r;
+
+        printf("%s lines ", name);
+        for (r = 0; r < ip->n_rng; r++)
+            printf("%s%d-%d", r? ",":"", ip->rng[r][0] + 1, ip->rng[r][1] + 1);
+        printf("\n");
+
+        // --def set without and with the symbol
+        for (i = 0; i < n_defs; i++) if (strcmp(defs[i], name) != 0) dv[nd++] = defs[i];
+        eval(&lst, nd, dv, name);
+        snapshot(&lst, pc0, sz0);
+        dv[nd] = (char *) name;
+        eval(&lst, nd + 1, dv, NULL);
+        snapshot(&lst, pc1, sz1);
+
+        memset(in, 0, lst.n);
+        for (r = 0; r < ip->n_rng; r++)
+            for (i = ip->rng[r][0]; i <= ip->rng[r][1]; i++) in[i] = 1;
+
+        memset(m, 0, ABS_MEM / 8);
+        for (i = 0; i < lst.n; i++) {
+            if (!in[i] && sz0[i] == sz1[i] && pc0[i] == pc1[i]) continue;
+            if (sz0[i] > 0) mark(m, pc0[i], sz0[i]);
+            if (sz1[i] > 0) mark(m, pc1[i], sz1[i]);
+        }
+
+        printf("%s addrs ", name);
+        int n_addr = 0;
+        for (u4_t a = 0; a < ABS_MEM; a++) {
+            if (!((m[a >> 3] >> (a & 7)) & 1)) continue;
+            u4_t e = a;
+            while (e + 1 < ABS_MEM && ((m[(e+1) >> 3] >> ((e+1) & 7)) & 1)) e++;
+            printf("%s%06o-%06o", n_addr? ",":"", a, e);
+            n_addr++;
+            a = e;
+        }
+        printf("%s\n", n_addr? "" : "none");
+    }
+
+    // the defs pointers are ours, not listing_init()'s
+    lst.n_defs = 0;
+    listing_free(&lst);
+    free(pc0); free(pc1); free(sz0); free(sz1); free(in); free(m);
+    return 0;
+}
@@ -0,0 +1,153 @@
+//
+// #include "file" support
+//
+// Each included file is read, split into lines and parsed once per run. The result is kept in
+// a process-wide cache shared by all conversions, so a fragment included by many listings
+// (or by many variants of one listing) costs one parse.
+//
+// Every file a conversion reads is recorded with a 64-bit FNV-1a hash of its contents.
+// With "--deps outfile.deps" these hashes (plus the --def list and the output options) are written
+// after a successful conversion, and the next run skips the conversion if none of them changed. Editing a shared
+// fragment therefore only rebuilds the listings that actually include it.
+//
+// Syntax of outfile.deps:
+// hash hhhhhhhhhhhhhhhh path      one per file read (hex hash)
+// def xxx                         one per --def argument
+// opt xxx                         one per output option ("list", "debug_cond", "prov file")
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "txt2abs.h"
+
+static inc_t *incs;
+static pthread_mutex_t incs_lock = PTHREAD_MUTEX_INITIALIZER;     // --batch converts on several threads
+
+u64_t hash_mem(const void *p, int n)
+{
+    const u1_t *bp = (const u1_t *) p;
+    u64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < n; i++) {
+        h ^= bp[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int hash_file(const char *path, u64_t *hash)
+{
+    long len;
+    char *s = file_read(path, &len);
+    if (s == NULL) return -1;
+    *hash = hash_mem(s, len);
+    free(s);
+    return 0;
+}
+
+// name relative to the directory of the file it is included from
+void inc_path(char *path, const char *fn_from, const char *name)
+{
+    const char *slash = fn_from? strrchr(fn_from, '/') : NULL;
+    if (name[0] == '/' || slash == NULL)
+        snprintf(path, NPATH, "%s", name);
+    else
+        snprintf(path, NPATH, "%.*s%s", (int) (slash - fn_from + 1), fn_from, name);
+}
+
+static inc_t *inc_load_locked(const char *path)
+{
+    inc_t *inc;
+    for (inc = incs; inc; inc = inc->next)
+        if (strcmp(inc->path, path) == 0) return inc;
+
+    long len;
+    int i;
+    char *text = file_read(path, &len);
+    if (text == NULL) return NULL;
+
+    inc = (inc_t *) calloc(1, sizeof(inc_t));
+    inc->path = strdup(path);
+    inc->hash = hash_mem(text, len);
+
+    for (i = 0; i < len; i++) if (text[i] == '\n') inc->n++;
+    if (len > 0 && text[len-1] != '\n') inc->n++;
+    inc->lines = (char **) malloc(sizeof(char *) * (inc->n + 1));
+    inc->parsed = (line_t *) malloc(sizeof(line_t) * (inc->n + 1));
+
+    char *cp = text;
+    for (i = 0; i < inc->n; i++) {
+        char *e = strchr(cp, '\n');
+        if (e) *e = '\0';
+        if (strlen(cp) >= NBUF) cp[NBUF-1] = '\0';     // same limit as top-level lines
+        inc->lines[i] = cp;
+        const char *bp = cp;
+        while (*bp != '\0' && isspace(*bp)) bp++;
+        parse_line(bp, &inc->parsed[i]);
+        cp = e? e+1 : cp + strlen(cp);
+    }
+
+    // the lines point into text, which stays allocated for the rest of the run
+    inc->next = incs;
+    incs = inc;
+    return inc;
+}
+
+inc_t *inc_load(const char *path)
+{
+    pthread_mutex_lock(&incs_lock);
+    inc_t *inc = inc_load_locked(path);
+    pthread_mutex_unlock(&incs_lock);
+    return inc;
+}
+
+int deps_write(conv_t *c, const char *fn_deps, int n_defs, char **defs, int n_opts, char **opts)
+{
+    FILE *fp;
+    if ((fp = fopen(fn_deps, "w")) == NULL) { printf("fopen W %s\n", fn_deps); return -1; }
+    u64_t hash;
+    if (hash_file(c->fn_in, &hash) == 0) fprintf(fp, "hash %016llx %s\n", hash, c->fn_in);
+    for (int i = 0; i < c->n_deps; i++) fprintf(fp, "hash %016llx %s\n", c->deps[i]->hash, c->deps[i]->path);
+    for (int i = 0; i < n_defs; i++) fprintf(fp, "def %s\n", defs[i]);
+    for (int i = 0; i < n_opts; i++) fprintf(fp, "opt %s\n", opts[i]);
+    fclose(fp);
+    return 0;
+}
+
+// True if fn_out exists and fn_deps shows that no file it was made from has changed since,
+// and that it was made with the same defines and output options.
+bool deps_uptodate(const char *fn_deps, const char *fn_out, const char *fn_in, int n_defs, char **defs, int n_opts, char **opts)
+{
+    FILE *fp;
+    if (access(fn_out, F_OK) != 0) return false;
+    if ((fp = fopen(fn_deps, "r")) == NULL) return false;
+
+    char buf[NPATH + 64], name[NPATH];
+    u64_t hash, cur;
+    int nd = 0, no = 0;
+    bool ok = true, have_in = false;
+
+    while (ok && fgets(buf, sizeof(buf), fp)) {
+        if (sscanf(buf, "hash %llx %1023[^\n]", &hash, name) == 2) {
+            if (hash_file(name, &cur) < 0 || cur != hash) ok = false;
+            if (strcmp(name, fn_in) == 0) have_in = true;
+        } else
+        if (sscanf(buf, "def %1023s", name) == 1) {
+            if (nd >= n_defs || strcmp(name, defs[nd]) != 0) ok = false;
+            nd++;
+        } else
+        if (sscanf(buf, "opt %1023[^\n]", name) == 1) {
+            if (no >= n_opts || strcmp(name, opts[no]) != 0) ok = false;
+            no++;
+        }
+    }
+    fclose(fp);
+    return ok && have_in && nd == n_defs && no == n_opts;
+}
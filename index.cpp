@@ -0,0 +1,195 @@
+//
+// Corpus-wide pc index across all diagnostics converted by --batch
+//
+// Usage: txt2abs [--def xxx] --batch dir --index corpus.idx       build while converting dir
+//        txt2abs --index corpus.idx --where nnnnnn                 every diagnostic/variant with a word at pc
+//        txt2abs --index corpus.idx --seq "nnnnnn nnnnnn ..."      every place the word sequence is loaded
+//        txt2abs --index corpus.idx --where nnnnnn --seq "..."     ... starting at pc
+//
+// For each converted image the index holds one entry per word of the final memory contents
+// (after any overlapping loads) giving its pc, value, source line and listing page. So from a
+// halt pc and a few words examined at the console the diagnostic, variant and line that
+// produced the halt can be found without knowing which image was loaded. Note that after a
+// HALT instruction the console shows the pc of the following word.
+//
+// The file is binary and mapped, not parsed, so a query costs a few binary searches:
+// idx_hdr_t, idx_img_t[n_imgs], idx_ent_t[n_ents] (by image, then ascending pc),
+// u4_t[n_ents] (entry numbers by word value, then entry number) for the --seq lookup.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "txt2abs.h"
+
+#define IDX_MAGIC "T2AIDX1"
+
+struct idx_hdr_t {
+    char magic[8];
+    u4_t n_imgs, n_ents;
+};
+
+// Builds the entries for the image of a finished conversion (c->prov must have been set,
+// and the runs not yet sorted by prov_write()). Returns the number of entries.
+int idx_build(conv_t *c, idx_ent_t **ents)
+{
+    u1_t *mem = (u1_t *) malloc(ABS_MEM);
+    u1_t *loaded = (u1_t *) calloc(ABS_MEM, 1);
+    prov_run_t **src = (prov_run_t **) calloc(ABS_MEM, sizeof(prov_run_t *));
+    int i, a, n = 0;
+
+    abs_load(c->img, c->img_len, mem, loaded);
+
+    // runs are in emitted order, so a later load of an address overrides an earlier one
+    for (i = 0; i < c->n_runs; i++) {
+        prov_run_t *r = &c->runs[i];
+        for (a = r->addr; a < (int) (r->addr + r->n) && a < ABS_MEM; a++) src[a] = r;
+    }
+
+    for (a = 0; a < ABS_MEM; a += 2) if (loaded[a]) n++;
+    idx_ent_t *e = *ents = (idx_ent_t *) malloc(sizeof(idx_ent_t) * (n + 1));
+    for (a = 0; a < ABS_MEM; a += 2) {
+        if (!loaded[a]) continue;
+        e->pc = a;
+        e->word = mem[a] | (mem[a+1] << 8);
+        e->line = src[a]? src[a]->line : 0;
+        e->page = src[a]? src[a]->page : 0;
+        e->img = 0;
+        e++;
+    }
+
+    free(mem);
+    free(loaded);
+    free(src);
+    return n;
+}
+
+static idx_ent_t *sort_ents;
+
+static int word_cmp(const void *a, const void *b)
+{
+    u4_t ia = *(const u4_t *) a, ib = *(const u4_t *) b;
+    if (sort_ents[ia].word != sort_ents[ib].word) return sort_ents[ia].word - sort_ents[ib].word;
+    return (ia < ib)? -1 : (ia > ib);
+}
+
+int idx_write(const char *fn_idx, idx_img_t *imgs, idx_ent_t **ents, int n_imgs)
+{
+    FILE *fp;
+    if ((fp = fopen(fn_idx, "w")) == NULL) { printf("fopen W %s\n", fn_idx); return -1; }
+
+    idx_hdr_t h;
+    memset(&h, 0, sizeof(h));
+    strcpy(h.magic, IDX_MAGIC);
+    h.n_imgs = n_imgs;
+    int i, j, n = 0;
+    for (i = 0; i < n_imgs; i++) {
+        imgs[i].ent0 = n;
+        n += imgs[i].n_ents;
+    }
+    h.n_ents = n;
+
+    idx_ent_t *all = (idx_ent_t *) malloc(sizeof(idx_ent_t) * (n + 1));
+    u4_t *by_word = (u4_t *) malloc(sizeof(u4_t) * (n + 1));
+    for (i = 0; i < n_imgs; i++) {
+        for (j = 0; j < (int) imgs[i].n_ents; j++) {
+            all[imgs[i].ent0 + j] = ents[i][j];
+            all[imgs[i].ent0 + j].img = i;
+        }
+    }
+    for (i = 0; i < n; i++) by_word[i] = i;
+    sort_ents = all;
+    qsort(by_word, n, sizeof(u4_t), word_cmp);
+
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(imgs, sizeof(idx_img_t), n_imgs, fp);
+    fwrite(all, sizeof(idx_ent_t), n, fp);
+    fwrite(by_word, sizeof(u4_t), n, fp);
+    int err = ferror(fp);
+    fclose(fp);
+    free(all);
+    free(by_word);
+    if (err) { printf("write error %s\n", fn_idx); return -1; }
+    return 0;
+}
+
+static void idx_print(idx_img_t *im, idx_ent_t *e)
+{
+    printf("%-24s %-16s %06o %06o line %d", im->name, im->variant, e->pc, e->word, e->line);
+    if (e->page) printf(" page %d", e->page);
+    printf("\n");
+}
+
+// pc < 0: any, n_seq == 0: no word sequence
+int idx_query(const char *fn_idx, int pc, int n_seq, u4_t *seq)
+{
+    int fd;
+    struct stat st;
+    if ((fd = open(fn_idx, O_RDONLY)) < 0 || fstat(fd, &st) < 0) { printf("open %s\n", fn_idx); return -1; }
+    u1_t *base = (u1_t *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { printf("mmap %s\n", fn_idx); return -1; }
+
+    idx_hdr_t *h = (idx_hdr_t *) base;
+    idx_img_t *imgs = (idx_img_t *) (h + 1);
+    idx_ent_t *ents = (idx_ent_t *) (imgs + h->n_imgs);
+    u4_t *by_word = (u4_t *) (ents + h->n_ents);
+    if ((size_t) st.st_size < sizeof(*h) || strcmp(h->magic, IDX_MAGIC) != 0 ||
+        (size_t) st.st_size != (size_t) ((u1_t *) (by_word + h->n_ents) - base)) {
+        printf("%s: not a txt2abs index\n", fn_idx);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    int found = 0;
+    u4_t i, k;
+
+    if (n_seq == 0) {
+        // first entry at or above pc in each image
+        for (i = 0; i < h->n_imgs; i++) {
+            idx_ent_t *e = &ents[imgs[i].ent0];
+            int lo = 0, hi = imgs[i].n_ents;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (e[mid].pc < pc) lo = mid + 1; else hi = mid;
+            }
+            if (lo < (int) imgs[i].n_ents && e[lo].pc == pc) {
+                idx_print(&imgs[i], &e[lo]);
+                found++;
+            }
+        }
+    } else {
+        // entries with the first word, then check the following ones are at consecutive pcs
+        u4_t lo = 0, hi = h->n_ents;
+        while (lo < hi) {
+            u4_t mid = (lo + hi) / 2;
+            if (ents[by_word[mid]].word < seq[0]) lo = mid + 1; else hi = mid;
+        }
+        for (; lo < h->n_ents && ents[by_word[lo]].word == seq[0]; lo++) {
+            u4_t ei = by_word[lo];
+            idx_ent_t *e = &ents[ei];
+            idx_img_t *im = &imgs[e->img];
+            if (pc >= 0 && e->pc != pc) continue;
+            for (k = 1; k < (u4_t) n_seq; k++) {
+                if (ei + k >= im->ent0 + im->n_ents) break;
+                idx_ent_t *ek = &ents[ei + k];
+                if (ek->pc != e->pc + k*2 || ek->word != seq[k]) break;
+            }
+            if (k < (u4_t) n_seq) continue;
+            idx_print(im, e);
+            found++;
+        }
+    }
+
+    if (!found) printf("no match\n");
+    munmap(base, st.st_size);
+    return found? 0 : -1;
+}
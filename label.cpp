@@ -0,0 +1,296 @@
+//
+// Symbolic labels
+//
+// Syntax:  name:          defines name as the current pc (on a line by itself)
+//          &name          in place of a word value: the address of name
+//          %name          in place of a word value: the pc-relative offset of name, i.e.
+//                         name - (address of this word + 2), as used by addressing modes 67 and 77
+//
+// A name starts with a letter, "_", "." or "$" followed by letters, digits, "_", "." or "$".
+// For example "4767 %sub" is "jsr pc,sub" and "12737 1 &flag" is "mov #1,@#flag".
+//
+// Labels are resolved in the single conversion pass. A reference to a label already defined is
+// filled in directly. A forward reference emits a zero placeholder and is queued on the label;
+// when the label is defined each queued word is patched: in the block still being built, or in
+// the output already written together with that block's checksum. Each reference is handled
+// once, so conversion stays linear in the size of the listing.
+//
+// Label names are interned per run (like define names, see cond.cpp); the values are kept
+// per conversion in a hash table in the conversion's arena.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "txt2abs.h"
+
+// names
+
+static pthread_mutex_t lab_lock = PTHREAD_MUTEX_INITIALIZER;
+static char **names;
+static int n_names, alloc_names;
+static int *slots, n_slots;         // open addressing, index + 1
+
+static void rehash()
+{
+    n_slots = n_slots? n_slots * 2 : 1024;
+    free(slots);
+    slots = (int *) calloc(n_slots, sizeof(int));
+    for (int i = 0; i < n_names; i++) {
+        u4_t h = hash_mem(names[i], strlen(names[i])) & (n_slots - 1);
+        while (slots[h]) h = (h + 1) & (n_slots - 1);
+        slots[h] = i + 1;
+    }
+}
+
+// interned number of a label name of length len
+int lab_sym(const char *name, int len)
+{
+    pthread_mutex_lock(&lab_lock);
+    if (n_names * 2 >= n_slots) rehash();
+    u4_t h = hash_mem(name, len) & (n_slots - 1);
+    int s;
+    for (; (s = slots[h]) != 0; h = (h + 1) & (n_slots - 1))
+        if (strncmp(names[s-1], name, len) == 0 && names[s-1][len] == '\0') break;
+    if (s == 0) {
+        if (n_names == alloc_names) {
+            alloc_names = alloc_names * 2 + 256;
+            names = (char **) realloc(names, sizeof(char *) * alloc_names);
+        }
+        names[n_names] = strndup(name, len);
+        slots[h] = s = ++n_names;
+    }
+    pthread_mutex_unlock(&lab_lock);
+    return s - 1;
+}
+
+const char *lab_name(int s)
+{
+    pthread_mutex_lock(&lab_lock);
+    const char *name = names[s];
+    pthread_mutex_unlock(&lab_lock);
+    return name;
+}
+
+int lab_count()
+{
+    return n_names;
+}
+
+
+// per conversion
+
+// a word waiting for its label
+struct fix_t {
+    fix_t *next;            // on the label
+    fix_t *next_blk;        // on the block being built
+    int sym;
+    bool rel;
+    u1_t br;                // BR_xxx if the word is a branch instruction
+    u2_t opc;
+    u4_t pc;                // address of the word
+    int dpos;               // offset in the data of the block being built, until it is written
+    u4_t off;               // then: offset of the word in the output
+    struct wblk_t *wb;      //       and the block it went out in
+    int seq;                // order of the references
+    int lnum;
+    const char *fn;
+};
+
+// checksum of a written block that holds placeholders
+struct wblk_t {
+    u4_t cksum_off;
+    u1_t cksum;
+};
+
+struct lab_t {
+    int sym;                // -1: free slot
+    bool defined;
+    u4_t value;
+    fix_t *fix, **fix_end;  // in reference order
+};
+
+static lab_t *lab_find(conv_t *c, int sym)
+{
+    if (c->labs == NULL) {
+        c->labs = (lab_t *) arena_alloc(&c->arena, sizeof(lab_t) * N_LABELS);
+        if (c->labs == NULL) { error(c, "no memory for labels"); return NULL; }
+        for (int i = 0; i < N_LABELS; i++) c->labs[i].sym = -1;
+    }
+    u4_t h = (sym * 2654435761u) & (N_LABELS - 1);
+    for (int i = 0; i < N_LABELS; i++, h = (h + 1) & (N_LABELS - 1)) {
+        lab_t *lp = &c->labs[h];
+        if (lp->sym == sym) return lp;
+        if (lp->sym < 0) {
+            if (c->n_labs >= N_LABELS * 3 / 4) break;
+            memset(lp, 0, sizeof(*lp));
+            lp->sym = sym;
+            lp->fix_end = &lp->fix;
+            c->n_labs++;
+            return lp;
+        }
+    }
+    error(c, "more than %d labels", N_LABELS * 3 / 4);
+    return NULL;
+}
+
+static int word_at(bool rel, int br, u2_t opc, u4_t pc, u4_t target)
+{
+    int off = (int) (target & 0177777) - (int) (pc + 2);
+    if (br == BR_8) {
+        if ((off & 1) || off < -0400 || off > 0376) return -1;
+        return opc | ((off >> 1) & 0377);
+    }
+    if (br == BR_SOB) {
+        if ((off & 1) || off > 0 || off < -0176) return -1;
+        return opc | (-off >> 1);
+    }
+    return (rel? off : (int) target) & 0177777;
+}
+
+// Value of word i of l at pc, given the value of its label or number. Covers "&name", "%name"
+// and the pc-relative operands and branches of an assembled instruction. -1 if a branch
+// target is out of range.
+int lab_word(const line_t *l, int i, u4_t pc, u4_t target)
+{
+    return word_at((l->rel >> i) & 1, (i == 0)? l->br : 0, l->opc, pc, target);
+}
+
+static int lab_value(conv_t *c, fix_t *f, u4_t value)
+{
+    int w = word_at(f->rel, f->br, f->opc, f->pc, value);
+    if (w < 0) {
+        int lnum = c->lnum;
+        const char *fn_cur = c->fn_cur;
+        c->lnum = f->lnum;
+        c->fn_cur = f->fn;
+        error(c, "branch to %06o out of range", value);
+        c->lnum = lnum;
+        c->fn_cur = fn_cur;
+        w = f->opc;
+    }
+    return w;
+}
+
+// stores w over the zero placeholder at output offset off, correcting the block checksum
+static void patch_out(conv_t *c, fix_t *f, u4_t w)
+{
+    u1_t b[2] = { (u1_t) (w & 0xff), (u1_t) (w >> 8) };
+    f->wb->cksum = (f->wb->cksum - b[0] - b[1]) & 0xff;
+
+    if (c->fwp) {
+        long pos = ftell(c->fwp);
+        fseek(c->fwp, f->off, SEEK_SET);
+        fwrite(b, 1, 2, c->fwp);
+        fseek(c->fwp, f->wb->cksum_off, SEEK_SET);
+        fwrite(&f->wb->cksum, 1, 1, c->fwp);
+        fseek(c->fwp, pos, SEEK_SET);
+    } else
+    if (c->img && f->wb->cksum_off < (u4_t) c->img_len) {
+        c->img[f->off] = b[0];
+        c->img[f->off + 1] = b[1];
+        c->img[f->wb->cksum_off] = f->wb->cksum;
+    }
+}
+
+void lab_define(conv_t *c, int sym)
+{
+    lab_t *lp = lab_find(c, sym);
+    if (lp == NULL) return;
+    if (lp->defined) { error(c, "label \"%s\" already defined as %06o", lab_name(sym), lp->value); return; }
+    lp->defined = true;
+    lp->value = c->pc;
+
+    for (fix_t *f = lp->fix; f; f = f->next) {
+        u4_t w = lab_value(c, f, lp->value);
+        if (f->wb == NULL) {
+            c->blk->data[f->dpos] = w & 0xff;
+            c->blk->data[f->dpos + 1] = w >> 8;
+        } else
+            patch_out(c, f, w);
+    }
+    lp->fix = NULL;
+    lp->fix_end = &lp->fix;
+}
+
+// value of the reference in word i of l, about to be stored at c->pc (zero if not yet known)
+u4_t lab_ref(conv_t *c, const line_t *l, int i)
+{
+    int sym = l->v[i];
+    lab_t *lp = lab_find(c, sym);
+    if (lp == NULL) return 0;
+    fix_t fx;
+    fx.rel = (l->rel >> i) & 1;
+    fx.br = (i == 0)? l->br : 0;
+    fx.opc = l->opc;
+    fx.pc = c->pc;
+    fx.lnum = c->lnum;
+    fx.fn = c->fn_cur;
+    if (lp->defined) return lab_value(c, &fx, lp->value);
+
+    fix_t *f = (fix_t *) arena_alloc(&c->arena, sizeof(fix_t));
+    if (f == NULL) { error(c, "no memory for label references"); return 0; }
+    *f = fx;
+    f->sym = sym;
+    f->dpos = c->sp - c->blk->data;
+    f->wb = NULL;
+    f->seq = c->n_fix++;
+    f->next = NULL;
+    *lp->fix_end = f;
+    lp->fix_end = &f->next;
+    f->next_blk = c->blk_fix;
+    c->blk_fix = f;
+    return 0;
+}
+
+// called by write_abs() once the block being built is written at output offset off
+void lab_blk_written(conv_t *c, u4_t off, int tlen, u1_t cksum)
+{
+    if (c->blk_fix == NULL) return;
+    wblk_t *wb = (wblk_t *) arena_alloc(&c->arena, sizeof(wblk_t));
+    if (wb == NULL) { error(c, "no memory for label references"); return; }
+    wb->cksum_off = off + tlen - CKSUM_LEN;
+    wb->cksum = cksum;
+    for (fix_t *f = c->blk_fix; f; f = f->next_blk) {
+        f->off = off + HDR_LEN + f->dpos;
+        f->wb = wb;
+    }
+    c->blk_fix = NULL;
+}
+
+static int fix_cmp(const void *a, const void *b)
+{
+    return (*(fix_t * const *) a)->seq - (*(fix_t * const *) b)->seq;
+}
+
+// reports references to labels never defined, in the order they appear
+void lab_end(conv_t *c)
+{
+    if (c->labs == NULL) return;
+    int i, n = 0;
+    for (i = 0; i < N_LABELS; i++)
+        for (fix_t *f = c->labs[i].fix; c->labs[i].sym >= 0 && f; f = f->next) n++;
+    if (n == 0) return;
+
+    fix_t **undef = (fix_t **) malloc(sizeof(fix_t *) * n);
+    n = 0;
+    for (i = 0; i < N_LABELS; i++)
+        for (fix_t *f = c->labs[i].fix; c->labs[i].sym >= 0 && f; f = f->next) undef[n++] = f;
+    qsort(undef, n, sizeof(fix_t *), fix_cmp);
+
+    int lnum = c->lnum;
+    const char *fn_cur = c->fn_cur;
+    for (i = 0; i < n; i++) {
+        c->lnum = undef[i]->lnum;
+        c->fn_cur = undef[i]->fn;
+        error(c, "undefined label \"%s\"", lab_name(undef[i]->sym));
+    }
+    c->lnum = lnum;
+    c->fn_cur = fn_cur;
+    free(undef);
+}
@@ -0,0 +1,190 @@
+//
+// Absolute loader conformance (txt2abs --loader file[@addr[:start]] --in infile.txt | infile.abs)
+//
+// Loads an image through a real absolute loader rather than abs_load(): the loader's own
+// code (e.g. DEC-11-L2PA, as dumped from a machine or simulator) is put in the interpreter's
+// memory (see emu.cpp) and started with the image as the tape in a PC11 reader that delivers
+// every character as soon as it is asked for, so a whole image loads in a few milliseconds.
+//
+// The loader file is either an absolute format image (.abs, started at its start address), or
+// the loader's bytes as they sit in memory from addr (octal), started at start (default addr).
+// The switch register is 0 (a normal, unrelocated load) and sp starts just below the loader.
+//
+// The image conforms if the loader reads it up to and including the final block, every byte
+// the image holds ends up in memory, and then the loader either transfers to the start address
+// or, when there is none (odd), halts. Anything else (a halt on a checksum error, reading past
+// the end of the tape, looping) is reported with the pc and tape position. An image that would
+// load over the loader itself is reported as such, as a real load would fail.
+//
+// With "--batch dir" every variant is checked (see batch.cpp).
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "txt2abs.h"
+
+#define LDR_INSNS_BYTE 1000     // instructions allowed per tape character
+
+static void ldr_brk(emu_t *e)
+{
+    e->stop = EMU_STOP;
+}
+
+// Reads the loader file. Returns -1 if it can't.
+int ldr_open(const char *spec, ldr_t *l)
+{
+    char fn[NBUF];
+    snprintf(fn, NBUF, "%s", spec);
+    char *at = strchr(fn, '@');
+    if (at) *at++ = '\0';
+    memset(l, 0, sizeof(*l));
+
+    FILE *fp;
+    if ((fp = fopen(fn, "r")) == NULL) { printf("fopen R %s\n", fn); return -1; }
+    u1_t *data = (u1_t *) malloc(IMG_SIZE);
+    int len = fread(data, 1, IMG_SIZE, fp);
+    fclose(fp);
+    l->mem = (u1_t *) calloc(ABS_MEM, 1);
+    l->loaded = (u1_t *) calloc(ABS_MEM, 1);
+
+    int n = strlen(fn);
+    if (n > 4 && strcmp(fn + n - 4, ".abs") == 0) {
+        l->start = abs_load(data, len, l->mem, l->loaded);
+        if (l->start < 0 || (l->start & 1)) { printf("%s: no start address\n", fn); free(data); return -1; }
+    } else {
+        char *ep;
+        if (at == NULL) { printf("--loader %s: raw loader needs @addr\n", spec); free(data); return -1; }
+        u4_t addr = strtoul(at, &ep, 8);
+        l->start = (*ep == ':')? strtoul(ep + 1, &ep, 8) : addr;
+        if (*ep != '\0' || (addr & 1) || (l->start & 1) || addr + len > EMU_MEM_TOP) {
+            printf("--loader %s: bad address, or doesn't fit below %06o\n", spec, EMU_MEM_TOP);
+            free(data);
+            return -1;
+        }
+        memcpy(&l->mem[addr], data, len);
+        memset(&l->loaded[addr], 1, len);
+    }
+    free(data);
+
+    for (l->lo = 0; l->lo < ABS_MEM && !l->loaded[l->lo]; l->lo++)
+        ;
+    for (l->hi = ABS_MEM; l->hi > l->lo && !l->loaded[l->hi - 1]; l->hi--)
+        ;
+    return 0;
+}
+
+void ldr_close(ldr_t *l)
+{
+    free(l->mem);
+    free(l->loaded);
+}
+
+// Loads img through the loader. Returns 0 if it conforms.
+int ldr_check(const ldr_t *l, const u1_t *img, int len, ldr_res_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    u1_t *mem = (u1_t *) calloc(ABS_MEM, 1);
+    u1_t *loaded = (u1_t *) calloc(ABS_MEM, 1);
+    int start = abs_load(img, len, mem, loaded), a;
+    emu_t *e = (emu_t *) malloc(sizeof(emu_t));
+
+    // the end of the final block, where the loader should stop reading
+    int end = 0;
+    for (int off = 0; off + HDR_LEN + CKSUM_LEN <= len; ) {
+        int blen = img[off+2] | (img[off+3] << 8);
+        off += blen + CKSUM_LEN;
+        res->blks++;
+        if (blen == HDR_LEN) { end = off; break; }
+    }
+
+    for (a = 0; a < ABS_MEM; a++) {
+        if (loaded[a]) res->bytes++;
+        if (loaded[a] && l->loaded[a] && res->overlap++ == 0) res->overlap_at = a;
+    }
+    if (res->overlap) {
+        res->why = "loads over the loader";
+        goto out;
+    }
+
+    emu_init(e, 0);
+    for (a = 0; a < ABS_MEM; a++) if (l->loaded[a]) e->mem[a] = l->mem[a];
+    e->ptr = img;
+    e->ptr_len = len;
+    e->r[6] = l->lo & ~1;
+    e->r[7] = l->start;
+    if (start >= 0 && !(start & 1)) {
+        e->brk = start;
+        e->on_brk = ldr_brk;
+    }
+    res->stop = emu_run(e, (u64_t) LDR_INSNS_BYTE * (len + 1));
+    res->pc = e->r[7];
+    res->tape_pos = e->ptr_pos;
+    res->n_insns = e->n_insns;
+    res->start = start;
+
+    for (a = 0; a < ABS_MEM; a++)
+        if (loaded[a] && e->mem[a] != mem[a] && res->diffs++ == 0) res->diff_at = a;
+
+    if (res->stop == EMU_LIMIT) res->why = "still running"; else
+    if (res->stop != EMU_STOP && res->stop != EMU_HALT) res->why = "stopped"; else
+    if (res->stop == EMU_HALT && (start < 0 || !(start & 1))) res->why = "halted"; else
+    if (end == 0) res->why = "no final block"; else
+    if (res->tape_pos < end) res->why = "stopped before the final block"; else
+    if (res->tape_pos > end) res->why = "read past the final block"; else
+    if (res->diffs) res->why = "memory differs";
+
+out:
+    emu_free(e);
+    free(e);
+    free(mem);
+    free(loaded);
+    return res->why? -1 : 0;
+}
+
+void ldr_report(FILE *fp, const ldr_res_t *r)
+{
+    if (r->why == NULL) {
+        fprintf(fp, "conforms: %d blocks, %d bytes, ", r->blks, r->bytes);
+        if (r->start & 1) fprintf(fp, "halted at %06o", r->pc); else fprintf(fp, "started at %06o", r->start);
+        fprintf(fp, " after %llu instructions\n", (unsigned long long) r->n_insns);
+        return;
+    }
+    fprintf(fp, "fails: %s", r->why);
+    if (r->overlap) fprintf(fp, " (%d bytes from %06o)\n", r->overlap, r->overlap_at); else
+    if (r->n_insns == 0) fprintf(fp, "\n"); else {
+        fprintf(fp, ", pc %06o, tape byte %d, %llu instructions", r->pc, r->tape_pos, (unsigned long long) r->n_insns);
+        if (r->diffs) fprintf(fp, ", %d bytes differ from %06o", r->diffs, r->diff_at);
+        fprintf(fp, "\n");
+    }
+}
+
+int ldr_main(const char *spec, const char *fn_in, int n_defs, char **defs)
+{
+    ldr_t l;
+    if (ldr_open(spec, &l) < 0) return -1;
+
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len), rv = -1;
+    if (errs == -2) errs = 0;       // a malformed tape is for the loader to find
+
+    if (errs > 0) {
+        printf("%d error%s, not loaded\n", errs, (errs != 1)? "s":"");
+    } else
+    if (errs == 0) {
+        ldr_res_t res;
+        rv = ldr_check(&l, img, len, &res);
+        ldr_report(stdout, &res);
+    }
+
+    conv_free(c);
+    ldr_close(&l);
+    return rv;
+}
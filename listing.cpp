@@ -0,0 +1,502 @@
+//
+// In-memory, incrementally updated copy of infile.txt
+//
+// Used by the language server (lsp.cpp) to keep per-line pc values current while the listing is
+// being edited, without re-running the whole conversion for each keystroke.
+//
+// The pc of line i is: origin value of the closest preceding active "=" line (or zero)
+// plus the sum of the active line sizes in between. Line sizes are kept in a Fenwick tree so
+// editing the words of a line is an O(log n) update and any pc is an O(log n) query.
+// Only edits that change the conditional structure, add/remove lines or change the kind of a
+// pc-relevant line ("=", "b", ":", "::", "// page") cause an O(n) rebuild.
+// Also used by the patch applier (patch.cpp) which batches its edits behind a single rebuild.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "txt2abs.h"
+
+static void parse_lline(lline_t *lp)
+{
+    const char *bp = lp->s;
+    while (*bp != '\0' && isspace(*bp)) bp++;
+    parse_line(bp, &lp->l);
+}
+
+static int lline_size(lline_t *lp)
+{
+    return lp->active? line_size(&lp->l) : 0;
+}
+
+
+// Fenwick tree
+
+static void fen_add(listing_t *lst, int i, int delta)
+{
+    for (i++; i <= lst->n; i += i & -i) lst->fen[i] += delta;
+}
+
+// sum of sizes of lines [0, i)
+static int fen_sum(listing_t *lst, int i)
+{
+    int sum = 0;
+    for (; i > 0; i -= i & -i) sum += lst->fen[i];
+    return sum;
+}
+
+// largest k with fen_sum(k) <= target, i.e. the line whose pc range contains the target offset
+static int fen_find(listing_t *lst, int target)
+{
+    int k = 0, step = 1;
+    while (step * 2 <= lst->n) step *= 2;
+    for (; step; step >>= 1) {
+        if (k + step <= lst->n && lst->fen[k + step] <= target) {
+            k += step;
+            target -= lst->fen[k];
+        }
+    }
+    return k;
+}
+
+static void fen_build(listing_t *lst)
+{
+    lst->fen = (int *) realloc(lst->fen, sizeof(int) * (lst->n + 1));
+    lst->fen[0] = 0;
+    for (int i = 1; i <= lst->n; i++) lst->fen[i] = lline_size(&lst->ln[i-1]);
+    for (int i = 1; i <= lst->n; i++) {
+        int j = i + (i & -i);
+        if (j <= lst->n) lst->fen[j] += lst->fen[i];
+    }
+}
+
+
+// index of the last entry of the ascending list that is < i, or -1
+static int list_before(int *list, int n, int i)
+{
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (list[mid] < i) lo = mid + 1; else hi = mid;
+    }
+    return lo - 1;
+}
+
+#define LIST_ADD(list, n, i) list[n++] = i
+
+// Re-evaluate the conditional structure exactly the way the converter does, then rebuild the
+// index lists and Fenwick tree.
+static void listing_rebuild(listing_t *lst)
+{
+    int i, j;
+    u4_t lvl = 1, inside_if = 0, ignore_input = 0, taken = 0;
+    int n_defs = lst->n_defs;
+    const char *defs[N_IFDEFS];
+    u4_t def_set[N_SYMS / 32];
+    memset(def_set, 0, sizeof(def_set));
+    for (i = 0; i < n_defs; i++) {
+        defs[i] = lst->defs[i];
+        cond_set_add(def_set, defs[i]);
+    }
+    bool t;
+
+    lst->orgs = (int *) realloc(lst->orgs, sizeof(int) * (lst->n + 1));
+    lst->chks = (int *) realloc(lst->chks, sizeof(int) * (lst->n + 1));
+    lst->pars = (int *) realloc(lst->pars, sizeof(int) * (lst->n + 1));
+    lst->pages = (int *) realloc(lst->pages, sizeof(int) * (lst->n + 1));
+    lst->n_orgs = lst->n_chks = lst->n_pars = lst->n_pages = 0;
+
+    for (i = 0; i < lst->n; i++) {
+        lline_t *lp = &lst->ln[i];
+        line_t *l = &lp->l;
+        lp->cerr = 0;
+        lp->active = true;
+
+        switch (l->type) {
+
+        case L_PAGE: LIST_ADD(lst->pages, lst->n_pages, i); continue;
+
+        case L_ELSE:
+            if (!(inside_if & lvl)) { lp->cerr |= CERR_ELSE; continue; }
+            if (taken & lvl) ignore_input |= lvl; else ignore_input &= ~lvl;
+            taken |= lvl;
+            continue;
+
+        case L_ELIF:
+            if (!(inside_if & lvl)) { lp->cerr |= CERR_ELIF; continue; }
+            if ((taken & lvl) || !cond_eval(l->v[0], def_set)) { ignore_input |= lvl; continue; }
+            ignore_input &= ~lvl;
+            taken |= lvl;
+            continue;
+
+        case L_ENDIF:
+            inside_if &= ~lvl;
+            ignore_input &= ~lvl;
+            taken &= ~lvl;
+            lvl >>= 1;
+            if (lvl == 0) { lp->cerr |= CERR_ENDIF; lvl = 1; }
+            continue;
+
+        case L_IF1: case L_IF0: case L_IF: case L_IFDEF:
+            if (l->type == L_IFDEF) {
+                for (j = 0; j < n_defs; j++)
+                    if (strcmp(l->name, defs[j]) == 0) break;
+                t = (j != n_defs);
+            } else
+                t = (l->type == L_IF)? cond_eval(l->v[0], def_set) : (l->type == L_IF1);
+            lvl <<= 1;
+            inside_if |= lvl;
+            if (t) { ignore_input &= ~lvl; taken |= lvl; } else { ignore_input |= lvl; taken &= ~lvl; }
+            continue;
+
+        default: break;
+        }
+
+        if (ignore_input) { lp->active = false; continue; }
+
+        switch (l->type) {
+            case L_DEFINE:
+                if (lst->undef && strcmp(l->name, lst->undef) == 0) break;
+                if (n_defs < N_IFDEFS) defs[n_defs++] = l->name;
+                cond_set_add(def_set, l->name);
+                break;
+            case L_ORG: LIST_ADD(lst->orgs, lst->n_orgs, i); LIST_ADD(lst->pars, lst->n_pars, i); break;
+            case L_BYTE: LIST_ADD(lst->pars, lst->n_pars, i); break;
+            case L_CHK_CUR: case L_CHK_PREV: LIST_ADD(lst->chks, lst->n_chks, i); break;
+            default: break;
+        }
+    }
+
+    // report unterminated #if on the last #if left open
+    if (lvl != 1) {
+        int open = 0;
+        for (i = lst->n - 1; i >= 0; i--) {
+            line_e t = lst->ln[i].l.type;
+            if (t == L_ENDIF) open--; else
+            if (t == L_IF0 || t == L_IF1 || t == L_IF || t == L_IFDEF) {
+                if (++open > 0) { lst->ln[i].cerr |= CERR_UNTERM; break; }
+            }
+        }
+    }
+
+    fen_build(lst);
+    lst->stale = false;
+    lst->rebuilds++;
+}
+
+void listing_init(listing_t *lst, int n_defs, char **defs)
+{
+    memset(lst, 0, sizeof(*lst));
+    lst->n_defs = n_defs;
+    for (int i = 0; i < n_defs; i++) lst->defs[i] = strdup(defs[i]);
+}
+
+void listing_free(listing_t *lst)
+{
+    for (int i = 0; i < lst->n; i++) free(lst->ln[i].s);
+    for (int i = 0; i < lst->n_defs; i++) free(lst->defs[i]);
+    free(lst->ln); free(lst->fen);
+    free(lst->orgs); free(lst->chks); free(lst->pars); free(lst->pages);
+    memset(lst, 0, sizeof(*lst));
+}
+
+// lines of a line-kind that may change without disturbing the index lists
+static bool plain_line(line_e t)
+{
+    return (t == L_BLANK || t == L_WORDS || t == L_SYNTAX || t == L_ERROR || t == L_WARNING ||
+        t == L_LABEL);
+}
+
+static bool cond_line(line_e t)
+{
+    return (t >= L_ELSE && t <= L_INCLUDE);
+}
+
+// With lst->defer set, O(n) rebuilds are postponed until listing_sync() so a batch of
+// structural edits costs a single rebuild.
+static void listing_stale(listing_t *lst)
+{
+    if (lst->defer) lst->stale = true; else listing_rebuild(lst);
+}
+
+void listing_sync(listing_t *lst)
+{
+    if (lst->stale) listing_rebuild(lst);
+}
+
+// Replaces lines [first, first + n_old) with the n_new strings in lines[] (ownership is taken).
+void listing_replace(listing_t *lst, int first, int n_old, char **lines, int n_new)
+{
+    int i;
+    bool structural = (n_old != n_new);
+
+    for (i = 0; i < n_old; i++)
+        if (cond_line(lst->ln[first + i].l.type)) structural = true;
+
+    if (structural) {
+        int n = lst->n - n_old + n_new;
+        if (n > lst->alloc) {
+            lst->alloc = n + n/2 + 64;
+            lst->ln = (lline_t *) realloc(lst->ln, sizeof(lline_t) * lst->alloc);
+        }
+        for (i = 0; i < n_old; i++) free(lst->ln[first + i].s);
+        memmove(&lst->ln[first + n_new], &lst->ln[first + n_old], sizeof(lline_t) * (lst->n - first - n_old));
+        lst->n = n;
+        for (i = 0; i < n_new; i++) {
+            lline_t *lp = &lst->ln[first + i];
+            lp->s = lines[i];
+            lp->active = false;
+            parse_lline(lp);
+        }
+        listing_stale(lst);
+        return;
+    }
+
+    for (i = 0; i < n_new; i++) {
+        lline_t *lp = &lst->ln[first + i];
+        line_e t_old = lp->l.type;
+        int sz_old = lline_size(lp);
+        free(lp->s);
+        lp->s = lines[i];
+        parse_lline(lp);
+        line_e t_new = lp->l.type;
+
+        // a change of line kind is only incremental if both kinds are plain (or identical)
+        if (t_old != t_new && !(plain_line(t_old) && plain_line(t_new))) {
+            for (i++; i < n_new; i++) {
+                free(lst->ln[first + i].s);
+                lst->ln[first + i].s = lines[i];
+                parse_lline(&lst->ln[first + i]);
+            }
+            listing_stale(lst);
+            return;
+        }
+
+        int delta = lline_size(lp) - sz_old;
+        if (delta && !lst->stale) fen_add(lst, first + i, delta);
+    }
+}
+
+static char **split_lines(const char *text, int *np)
+{
+    int n = 1, i;
+    const char *cp;
+    for (cp = text; *cp; cp++) if (*cp == '\n') n++;
+    char **lines = (char **) malloc(sizeof(char *) * n);
+
+    for (i = 0, cp = text; i < n; i++) {
+        const char *e = strchr(cp, '\n');
+        size_t len = e? (size_t) (e - cp) : strlen(cp);
+        if (len > 0 && cp[len-1] == '\r') len--;
+        lines[i] = strndup(cp, len);
+        cp = e? e+1 : cp + strlen(cp);
+    }
+    *np = n;
+    return lines;
+}
+
+int listing_load(listing_t *lst, const char *fn)
+{
+    long len;
+    char *text = file_read(fn, &len);
+    if (text == NULL) return -1;
+    if (len > 0 && text[len-1] == '\n') text[len-1] = '\0';   // no empty line after the last \n
+    listing_set(lst, text);
+    free(text);
+    return 0;
+}
+
+int listing_write(listing_t *lst, FILE *fp)
+{
+    for (int i = 0; i < lst->n; i++)
+        if (fprintf(fp, "%s\n", lst->ln[i].s) < 0) return -1;
+    return 0;
+}
+
+void listing_set(listing_t *lst, const char *text)
+{
+    int n;
+    char **lines = split_lines(text, &n);
+    listing_replace(lst, 0, lst->n, lines, n);
+    free(lines);
+}
+
+// Applies an edit replacing the text from (l0, c0) to (l1, c1) with text.
+void listing_edit(listing_t *lst, int l0, int c0, int l1, int c1, const char *text)
+{
+    if (lst->n == 0) { listing_set(lst, text); return; }
+    if (l0 >= lst->n) { l0 = lst->n - 1; c0 = strlen(lst->ln[l0].s); }
+    if (l1 >= lst->n) { l1 = lst->n - 1; c1 = strlen(lst->ln[l1].s); }
+    const char *s0 = lst->ln[l0].s, *s1 = lst->ln[l1].s;
+    int len0 = strlen(s0), len1 = strlen(s1);
+    if (c0 > len0) c0 = len0;
+    if (c1 > len1) c1 = len1;
+
+    char *joined;
+    asprintf(&joined, "%.*s%s%s", c0, s0, text, s1 + c1);
+    int n;
+    char **lines = split_lines(joined, &n);
+    free(joined);
+    listing_replace(lst, l0, l1 - l0 + 1, lines, n);
+    free(lines);
+}
+
+// pc at the start of line i
+u4_t listing_pc(listing_t *lst, int i)
+{
+    int j = list_before(lst->orgs, lst->n_orgs, i);
+    if (j < 0) return fen_sum(lst, i);
+    int oi = lst->orgs[j];
+    return lst->ln[oi].l.v[0] + fen_sum(lst, i) - fen_sum(lst, oi + 1);
+}
+
+// listing page of line i, or -1 if before the first "// page NN" comment
+int listing_page(listing_t *lst, int i)
+{
+    int j = list_before(lst->pages, lst->n_pages, i + 1);
+    return (j < 0)? -1 : lst->ln[lst->pages[j]].l.v[0];
+}
+
+// Finds the active word or byte line containing pc. Returns the line or -1, and the
+// word index within the line.
+int listing_find_pc(listing_t *lst, u4_t pc, int *wi)
+{
+    // each origin starts a segment of monotonically increasing pc
+    for (int j = -1; j < lst->n_orgs; j++) {
+        int first = (j < 0)? 0 : lst->orgs[j] + 1;
+        int end = (j+1 < lst->n_orgs)? lst->orgs[j+1] : lst->n;
+        u4_t org = (j < 0)? 0 : lst->ln[lst->orgs[j]].l.v[0];
+        int base = fen_sum(lst, first);
+        if (pc < org || pc >= org + fen_sum(lst, end) - base) continue;
+
+        int i = fen_find(lst, base + pc - org);
+        u4_t lpc = listing_pc(lst, i);
+        if (lst->ln[i].l.type == L_BYTE) {
+            if (pc != lpc) return -1;
+            *wi = 0;
+        } else {
+            if ((pc - lpc) & 1) return -1;
+            *wi = (pc - lpc) / 2;
+        }
+        return i;
+    }
+    return -1;
+}
+
+// line defining label sym (first active one), or -1
+static int label_line(listing_t *lst, int sym)
+{
+    for (int i = 0; i < lst->n; i++)
+        if (lst->ln[i].active && lst->ln[i].l.type == L_LABEL && (int) lst->ln[i].l.v[0] == sym) return i;
+    return -1;
+}
+
+// Collects up to nw words starting at line i, following on to subsequent active lines.
+// Stops at a reference to an undefined label. Pc-relative and branch words are resolved.
+int listing_words(listing_t *lst, int i, u2_t *w, int nw)
+{
+    int n = 0;
+    for (; i < lst->n && n < nw; i++) {
+        lline_t *lp = &lst->ln[i];
+        if (!lp->active) continue;
+        if (lp->l.type == L_WORDS) {
+            for (int k = 0; k < lp->l.n && n < nw; k++) {
+                u4_t v = lp->l.v[k];
+                if ((lp->l.refs >> k) & 1) {
+                    int d = label_line(lst, v);
+                    if (d < 0) return n;
+                    v = listing_pc(lst, d);
+                }
+                int wv = lab_word(&lp->l, k, listing_pc(lst, i) + k*2, v);
+                w[n++] = (wv < 0)? lp->l.opc : wv;
+            }
+        } else
+        if (lp->l.type != L_BLANK && lp->l.type != L_PAGE && lp->l.type != L_CHK_PREV && lp->l.type != L_CHK_CUR &&
+            lp->l.type != L_LABEL)
+            break;
+    }
+    return n;
+}
+
+int listing_diags(listing_t *lst, diag_f fn, void *arg)
+{
+    int i, k, nd = 0;
+    char msg[256];
+    int n_labs = lab_count();
+    int *lab_def = (int *) malloc(sizeof(int) * (n_labs + 1));
+    for (k = 0; k < n_labs; k++) lab_def[k] = -1;
+    #define DIAG(line, sev, ...) { snprintf(msg, sizeof(msg), __VA_ARGS__); fn(arg, line, sev, msg); nd++; }
+
+    for (i = 0; i < lst->n; i++) {
+        lline_t *lp = &lst->ln[i];
+        line_t *l = &lp->l;
+        if (lp->cerr & CERR_ELSE) DIAG(i, DIAG_ERROR, "#else not inside #if");
+        if (lp->cerr & CERR_ELIF) DIAG(i, DIAG_ERROR, "#elif not inside #if");
+        if (lp->cerr & CERR_ENDIF) DIAG(i, DIAG_ERROR, "#endif without corresponding #if");
+        if (lp->cerr & CERR_UNTERM) DIAG(i, DIAG_ERROR, "#if without corresponding #endif");
+        if (!lp->active) continue;
+
+        switch (l->type) {
+            case L_ERROR: DIAG(i, DIAG_ERROR, "%s", lp->s); break;
+            case L_WARNING: DIAG(i, DIAG_WARNING, "%s", lp->s); break;
+            case L_INCLUDE: DIAG(i, DIAG_WARNING, "#include not expanded here, following pc values exclude it"); break;
+            case L_SYNTAX: DIAG(i, DIAG_ERROR, "syntax error \"%s\"", lp->s); break;
+            case L_ORG: if (l->v[0] > 0177777) DIAG(i, DIAG_ERROR, "range norg=%06o", l->v[0]); break;
+            case L_CHK_CUR: if (l->v[0] > 0177777) DIAG(i, DIAG_ERROR, "'::' range chk=%06o", l->v[0]); break;
+            case L_CHK_PREV: if (l->v[0] > 0177777) DIAG(i, DIAG_ERROR, "':' range chk=%06o", l->v[0]); break;
+            case L_BYTE: if (l->v[0] > 0377) DIAG(i, DIAG_ERROR, "range b=%04o", l->v[0]); break;
+            case L_WORDS:
+                for (k = 0; k < l->n; k++)
+                    if (!((l->refs >> k) & 1) && l->v[k] > 0177777) DIAG(i, DIAG_ERROR, "range w%d=%06o", k, l->v[k]);
+                break;
+            case L_LABEL:
+                if (lab_def[l->v[0]] >= 0)
+                    DIAG(i, DIAG_ERROR, "label \"%s\" already defined as %06o", l->name, listing_pc(lst, lab_def[l->v[0]]))
+                else
+                    lab_def[l->v[0]] = i;
+                break;
+            default: break;
+        }
+    }
+
+    for (i = 0; i < lst->n; i++) {
+        line_t *l = &lst->ln[i].l;
+        if (!lst->ln[i].active || l->type != L_WORDS || (l->refs == 0 && l->br == 0)) continue;
+        for (k = 0; k < l->n; k++)
+            if (((l->refs >> k) & 1) && lab_def[l->v[k]] < 0)
+                DIAG(i, DIAG_ERROR, "undefined label \"%s\"", lab_name(l->v[k]));
+        if (l->br && (!(l->refs & 1) || lab_def[l->v[0]] >= 0)) {
+            u4_t t = (l->refs & 1)? listing_pc(lst, lab_def[l->v[0]]) : l->v[0];
+            if (lab_word(l, 0, listing_pc(lst, i), t) < 0) DIAG(i, DIAG_ERROR, "branch to %06o out of range", t);
+        }
+    }
+    free(lab_def);
+
+    for (k = 0; k < lst->n_chks; k++) {
+        i = lst->chks[k];
+        line_t *l = &lst->ln[i].l;
+        u4_t pc = listing_pc(lst, i);
+        if (l->type == L_CHK_CUR && pc != l->v[0])
+            DIAG(i, DIAG_ERROR, "consistency check, expecting pc=%06o but \":: %06o\" specified", pc, l->v[0]);
+        if (l->type == L_CHK_PREV && pc - 2 != l->v[0])
+            DIAG(i, DIAG_ERROR, "consistency check, expecting (pc-2)=%06o but \": %06o\" specified", pc - 2, l->v[0]);
+    }
+
+    // pc parity only changes at "=" and "b" lines, so only the lines following one of them that
+    // leaves the pc odd need checking, and then every word line up to the next one is at an odd pc
+    for (k = 0; k < lst->n_pars; k++) {
+        int end = (k + 1 < lst->n_pars)? lst->pars[k+1] : lst->n;
+        i = lst->pars[k] + 1;
+        if ((listing_pc(lst, i) & 1) == 0) continue;
+        for (; i < end; i++)
+            if (lst->ln[i].active && lst->ln[i].l.type == L_WORDS) DIAG(i, DIAG_ERROR, "odd pc=%06o", listing_pc(lst, i));
+    }
+
+    return nd;
+    #undef DIAG
+}
@@ -0,0 +1,388 @@
+//
+// Language server for infile.txt listings (txt2abs --lsp)
+//
+// Speaks the Language Server Protocol over stdin/stdout. Each open document is kept as a
+// listing_t (see listing.cpp) updated incrementally from the editor's range edits, so the
+// consistency checks (":" and "::"), range errors and odd pc errors are re-reported after every
+// keystroke without re-running the conversion. Hovering over a line shows its pc, listing page
+// and a disassembly of the instruction starting there.
+//
+// Defines are taken from the "--def xxx" arguments plus an optional "defines" string array
+// in the client's initializationOptions.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "txt2abs.h"
+
+
+// growable output string
+
+struct sbuf_t {
+    char *s;
+    int len, alloc;
+};
+
+static void sb_printf(sbuf_t *sb, const char *fmt, ...)
+{
+    va_list ap;
+    while (1) {
+        int avail = sb->alloc - sb->len;
+        va_start(ap, fmt);
+        int n = vsnprintf(sb->s + sb->len, avail, fmt, ap);
+        va_end(ap);
+        if (n < avail) { sb->len += n; return; }
+        sb->alloc = sb->alloc * 2 + n + 256;
+        sb->s = (char *) realloc(sb->s, sb->alloc);
+    }
+}
+
+// JSON string with quotes and escapes
+static void sb_str(sbuf_t *sb, const char *s)
+{
+    sb_printf(sb, "\"");
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') sb_printf(sb, "\\%c", *s); else
+        if (*s == '\n') sb_printf(sb, "\\n"); else
+        if ((u1_t) *s < ' ') sb_printf(sb, "\\u%04x", *s); else
+            sb_printf(sb, "%c", *s);
+    }
+    sb_printf(sb, "\"");
+}
+
+
+// Minimal JSON access: values are located in the message text by pointer, nothing is built.
+
+static const char *js_ws(const char *p)
+{
+    while (*p && isspace(*p)) p++;
+    return p;
+}
+
+// pointer just past the value starting at p
+static const char *js_skip(const char *p)
+{
+    p = js_ws(p);
+    if (*p == '"') {
+        for (p++; *p && *p != '"'; p++)
+            if (*p == '\\' && p[1]) p++;
+        return *p? p+1 : p;
+    }
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        do {
+            if (*p == '"') { p = js_skip(p); continue; }
+            if (*p == '{' || *p == '[') depth++;
+            if (*p == '}' || *p == ']') depth--;
+            p++;
+        } while (*p && depth > 0);
+        return p;
+    }
+    while (*p && *p != ',' && *p != '}' && *p != ']' && !isspace(*p)) p++;
+    return p;
+}
+
+static const char *js_member(const char *p, const char *key, int kl)
+{
+    p = js_ws(p);
+    if (*p != '{') return NULL;
+    for (p++;; p++) {
+        p = js_ws(p);
+        if (*p != '"') return NULL;
+        const char *k = p + 1;
+        p = js_skip(p);
+        bool match = (p - k - 1 == kl && strncmp(k, key, kl) == 0);
+        p = js_ws(p);
+        if (*p != ':') return NULL;
+        p = js_ws(p + 1);
+        if (match) return p;
+        p = js_ws(js_skip(p));
+        if (*p != ',') return NULL;
+    }
+}
+
+// value at dotted path of members, e.g. "params.textDocument.uri", or NULL
+static const char *js_get(const char *p, const char *path)
+{
+    while (p && *path) {
+        const char *e = strchr(path, '.');
+        int kl = e? (e - path) : strlen(path);
+        p = js_member(p, path, kl);
+        path += kl + (e? 1:0);
+    }
+    return p;
+}
+
+// element i of array, or NULL
+static const char *js_elem(const char *p, int i)
+{
+    if (p == NULL) return NULL;
+    p = js_ws(p);
+    if (*p != '[') return NULL;
+    p = js_ws(p + 1);
+    if (*p == ']') return NULL;
+    for (; i > 0; i--) {
+        p = js_ws(js_skip(p));
+        if (*p != ',') return NULL;
+        p = js_ws(p + 1);
+    }
+    return p;
+}
+
+static int js_int(const char *p, int def)
+{
+    if (p == NULL || !(isdigit(*p) || *p == '-')) return def;
+    return strtol(p, NULL, 10);
+}
+
+// malloc'd copy of the string value at p, or NULL
+static char *js_str(const char *p)
+{
+    if (p == NULL || *p != '"') return NULL;
+    const char *e = js_skip(p);
+    char *s = (char *) malloc(e - p), *d = s;
+
+    for (p++; p < e-1; p++) {
+        if (*p != '\\') { *d++ = *p; continue; }
+        switch (*++p) {
+            case 'n': *d++ = '\n'; break;
+            case 'r': *d++ = '\r'; break;
+            case 't': *d++ = '\t'; break;
+            case 'b': *d++ = '\b'; break;
+            case 'f': *d++ = '\f'; break;
+            case 'u': {
+                unsigned u = 0;
+                sscanf(p+1, "%4x", &u);
+                p += 4;
+                if (u < 0x80) *d++ = u; else
+                if (u < 0x800) { *d++ = 0xc0 | (u >> 6); *d++ = 0x80 | (u & 0x3f); } else
+                    { *d++ = 0xe0 | (u >> 12); *d++ = 0x80 | ((u >> 6) & 0x3f); *d++ = 0x80 | (u & 0x3f); }
+                break;
+            }
+            default: *d++ = *p; break;
+        }
+    }
+    *d = '\0';
+    return s;
+}
+
+
+// documents
+
+#define N_DOCS 16
+
+struct doc_t {
+    char *uri;
+    listing_t lst;
+};
+
+static doc_t docs[N_DOCS];
+static int n_defs;
+static char *defs[N_IFDEFS];
+
+static doc_t *doc_find(const char *msg, bool create)
+{
+    char *uri = js_str(js_get(msg, "params.textDocument.uri"));
+    if (uri == NULL) return NULL;
+    doc_t *free_doc = NULL;
+
+    for (int i = 0; i < N_DOCS; i++) {
+        doc_t *d = &docs[i];
+        if (d->uri && strcmp(d->uri, uri) == 0) { free(uri); return d; }
+        if (d->uri == NULL && free_doc == NULL) free_doc = d;
+    }
+
+    if (!create || free_doc == NULL) { free(uri); return NULL; }
+    free_doc->uri = uri;
+    listing_init(&free_doc->lst, n_defs, defs);
+    return free_doc;
+}
+
+
+// protocol
+
+static void lsp_send(sbuf_t *sb)
+{
+    printf("Content-Length: %d\r\n\r\n", sb->len);
+    fwrite(sb->s, 1, sb->len, stdout);
+    fflush(stdout);
+    sb->len = 0;
+}
+
+// reads one message body, NULL on eof
+static char *lsp_recv()
+{
+    char hdr[256];
+    int len = -1;
+
+    while (fgets(hdr, sizeof(hdr), stdin)) {
+        if (strcmp(hdr, "\r\n") == 0 || strcmp(hdr, "\n") == 0) {
+            if (len < 0) continue;
+            char *msg = (char *) malloc(len + 1);
+            if (fread(msg, 1, len, stdin) != (size_t) len) { free(msg); return NULL; }
+            msg[len] = '\0';
+            return msg;
+        }
+        sscanf(hdr, "Content-Length: %d", &len);
+    }
+    return NULL;
+}
+
+static sbuf_t out;
+
+struct diag_ctx_t {
+    listing_t *lst;
+    int n;
+};
+
+static void diag_json(void *arg, int line, diag_e sev, const char *msg)
+{
+    diag_ctx_t *dc = (diag_ctx_t *) arg;
+    sb_printf(&out, "%s{\"range\":{\"start\":{\"line\":%d,\"character\":0},\"end\":{\"line\":%d,\"character\":%d}},"
+        "\"severity\":%d,\"source\":\"txt2abs\",\"message\":", dc->n++? ",":"", line, line, (int) strlen(dc->lst->ln[line].s), sev);
+    sb_str(&out, msg);
+    sb_printf(&out, "}");
+}
+
+static void publish_diags(doc_t *d, bool clear)
+{
+    diag_ctx_t dc = { &d->lst, 0 };
+    sb_printf(&out, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    sb_str(&out, d->uri);
+    sb_printf(&out, ",\"diagnostics\":[");
+    if (!clear) listing_diags(&d->lst, diag_json, &dc);
+    sb_printf(&out, "]}}");
+    lsp_send(&out);
+}
+
+static void hover(doc_t *d, int line, sbuf_t *sb)
+{
+    listing_t *lst = &d->lst;
+    if (line < 0 || line >= lst->n) { sb_printf(sb, "null"); return; }
+    lline_t *lp = &lst->ln[line];
+    char s[256], dis[64];
+
+    if (!lp->active) {
+        snprintf(s, sizeof(s), "excluded by conditional compilation");
+    } else {
+        u4_t pc = listing_pc(lst, line);
+        int n = snprintf(s, sizeof(s), "pc %06o", pc);
+        int page = listing_page(lst, line);
+        if (page >= 0) n += snprintf(s + n, sizeof(s) - n, "  page %d", page);
+
+        if (lp->l.type == L_WORDS) {
+            u2_t w[3];
+            int nw = listing_words(lst, line, w, 3);
+            dis_pdp11(pc, w, nw, dis, sizeof(dis));
+            snprintf(s + n, sizeof(s) - n, "\n%s", dis);
+        }
+    }
+
+    sb_printf(sb, "{\"contents\":{\"kind\":\"plaintext\",\"value\":");
+    sb_str(sb, s);
+    sb_printf(sb, "}}");
+}
+
+int lsp_server(int _n_defs, char **_defs)
+{
+    n_defs = _n_defs;
+    for (int i = 0; i < n_defs; i++) defs[i] = _defs[i];
+    char *msg;
+
+    while ((msg = lsp_recv()) != NULL) {
+        char *method = js_str(js_get(msg, "method"));
+        const char *id = js_get(msg, "id");
+        int id_len = id? (js_skip(id) - id) : 0;
+        doc_t *d;
+
+        #define METHOD(s) (method && strcmp(method, s) == 0)
+        #define RESULT_BEGIN() sb_printf(&out, "{\"jsonrpc\":\"2.0\",\"id\":%.*s,\"result\":", id_len, id)
+        #define RESULT_END() { sb_printf(&out, "}"); lsp_send(&out); }
+
+        if (METHOD("initialize")) {
+            const char *dp;
+            char *s;
+            for (int i = 0; (dp = js_elem(js_get(msg, "params.initializationOptions.defines"), i)) != NULL; i++)
+                if ((s = js_str(dp)) != NULL && n_defs < N_IFDEFS) defs[n_defs++] = s;
+            RESULT_BEGIN();
+            sb_printf(&out, "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2},\"hoverProvider\":true},"
+                "\"serverInfo\":{\"name\":\"txt2abs\"}}");
+            RESULT_END();
+        } else
+
+        if (METHOD("shutdown")) {
+            RESULT_BEGIN();
+            sb_printf(&out, "null");
+            RESULT_END();
+        } else
+
+        if (METHOD("exit")) {
+            free(method); free(msg);
+            return 0;
+        } else
+
+        if (METHOD("textDocument/didOpen")) {
+            char *text = js_str(js_get(msg, "params.textDocument.text"));
+            if ((d = doc_find(msg, true)) != NULL && text) {
+                listing_set(&d->lst, text);
+                publish_diags(d, false);
+            }
+            free(text);
+        } else
+
+        if (METHOD("textDocument/didChange")) {
+            if ((d = doc_find(msg, false)) != NULL) {
+                const char *cp, *changes = js_get(msg, "params.contentChanges");
+                for (int i = 0; (cp = js_elem(changes, i)) != NULL; i++) {
+                    char *text = js_str(js_get(cp, "text"));
+                    if (text == NULL) continue;
+                    const char *range = js_get(cp, "range");
+                    if (range)
+                        listing_edit(&d->lst,
+                            js_int(js_get(range, "start.line"), 0), js_int(js_get(range, "start.character"), 0),
+                            js_int(js_get(range, "end.line"), 0), js_int(js_get(range, "end.character"), 0), text);
+                    else
+                        listing_set(&d->lst, text);
+                    free(text);
+                }
+                publish_diags(d, false);
+            }
+        } else
+
+        if (METHOD("textDocument/didClose")) {
+            if ((d = doc_find(msg, false)) != NULL) {
+                publish_diags(d, true);
+                listing_free(&d->lst);
+                free(d->uri);
+                d->uri = NULL;
+            }
+        } else
+
+        if (METHOD("textDocument/hover")) {
+            RESULT_BEGIN();
+            if ((d = doc_find(msg, false)) != NULL)
+                hover(d, js_int(js_get(msg, "params.position.line"), -1), &out);
+            else
+                sb_printf(&out, "null");
+            RESULT_END();
+        } else
+
+        if (id) {
+            sb_printf(&out, "{\"jsonrpc\":\"2.0\",\"id\":%.*s,\"error\":{\"code\":-32601,\"message\":\"method not found\"}}",
+                id_len, id);
+            lsp_send(&out);
+        }
+
+        free(method);
+        free(msg);
+    }
+
+    return 0;
+}
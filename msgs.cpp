@@ -0,0 +1,260 @@
+//
+// Console message table (txt2abs --msgs outfile.msg --in infile.txt | infile.abs,
+// txt2abs --msgs file.msg [--match console.log])
+//
+// The messages the diagnostic types are in the image as packed ASCII, two characters a word
+// ("47440 20116 52502") or "b nnn" bytes. They are found in the loaded memory as runs of
+// printable characters, CR, LF and BEL, and split into the lines the console shows. A line
+// counts as a message if it has three letters of the same case in a row (so code and tables that
+// happen to decode as a few characters don't), leading and trailing spaces removed.
+//
+// The messages and their pcs are compiled into an Aho-Corasick automaton, written with them, so
+// a console log of any size is matched against every message in one pass over it, one table
+// lookup per character. The parity bit is ignored and all digits are the same character, so a
+// message matches with the numbers the diagnostic fills in ("PASS #0000" matches "PASS #0012").
+// Where several messages end at the same character only the longest is reported.
+//
+// The file is mapped by the matcher:
+// msg_hdr_t, msg_ent_t[n_msgs], u2_t next[n_states][MSG_CHARS], u2_t out[n_states],
+// u2_t dict[n_states], strings.
+// out is 1 + the message ending at the state, or 0; dict is the next state down the
+// failure links with a message, or 0.
+//
+// "--match -" reads stdin. Without --match the table is listed.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "txt2abs.h"
+
+#define MSG_MAGIC "T2AMSG1"
+
+#define MSG_CHARS   128
+#define MSG_LETTERS 3
+#define N_MSG_LINE  256
+#define NONE        0xffff
+
+struct msg_hdr_t {
+    char magic[8];
+    u4_t n_msgs, n_states, str_len;
+};
+
+struct msg_ent_t {
+    u2_t pc, len;
+    u4_t str;
+};
+
+static bool msg_char(u1_t b)
+{
+    return (b >= ' ' && b < 0177) || b == '\r' || b == '\n' || b == 07;
+}
+
+// the automaton's alphabet
+static inline u1_t msg_fold(u1_t b)
+{
+    b &= 0177;
+    return isdigit(b)? '0' : b;
+}
+
+// Adds line [s, s+n) at pc to the table if it is a message.
+static void msg_line(const u1_t *s, int n, u4_t pc, msg_ent_t *ents, int *n_msgs, char *strs, int *str_len)
+{
+    while (n > 0 && s[0] == ' ') { s++; n--; pc++; }
+    while (n > 0 && s[n-1] == ' ') n--;
+    int run = 0, best = 0;
+    for (int i = 0; i < n; i++) {
+        if (!isalpha(s[i])) run = 0; else
+        if (run && !isupper(s[i]) == !isupper(s[i-1])) run++; else run = 1;
+        if (run > best) best = run;
+    }
+    if (best < MSG_LETTERS || n >= N_MSG_LINE) return;
+
+    msg_ent_t *e = &ents[(*n_msgs)++];
+    e->pc = pc;
+    e->len = n;
+    e->str = *str_len;
+    memcpy(strs + *str_len, s, n);
+    strs[*str_len + n] = '\0';
+    *str_len += n + 1;
+}
+
+int msgs_main(const char *fn_in, const char *fn_msg, int n_defs, char **defs)
+{
+    FILE *fp;
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len), rv = -1;
+    u1_t *mem = (u1_t *) calloc(ABS_MEM, 1);
+    u1_t *loaded = (u1_t *) calloc(ABS_MEM, 1);
+    msg_ent_t *ents = (msg_ent_t *) malloc(sizeof(msg_ent_t) * ABS_MEM / 4);
+    char *strs = (char *) malloc(ABS_MEM * 2);
+    u2_t *next = NULL, *out = NULL, *dict = NULL, *fail = NULL, *queue = NULL;
+    int n_msgs = 0, str_len = 0, n_states = 1, chars = 0, i, k;
+    u4_t a, e;
+
+    if (errs) {
+        if (errs > 0) printf("%d error%s, no table written\n", errs, (errs != 1)? "s":"");
+        goto out;
+    }
+    abs_load(img, len, mem, loaded);
+
+    // runs of text, split into lines
+    for (a = 0; a < ABS_MEM; a = e + 1) {
+        for (e = a; e < ABS_MEM && loaded[e] && msg_char(mem[e]); e++)
+            ;
+        for (u4_t s = a, t; s < e; s = t + 1) {
+            for (t = s; t < e && mem[t] != '\r' && mem[t] != '\n'; t++)
+                ;
+            if (t > s) msg_line(&mem[s], t - s, s, ents, &n_msgs, strs, &str_len);
+        }
+    }
+    if (n_msgs == 0) { printf("no messages found\n"); goto out; }
+
+    // trie of the messages, state 0 the root
+    for (i = 0; i < n_msgs; i++) chars += ents[i].len;
+    if (chars + 1 >= NONE) { printf("%d characters of messages, too many\n", chars); goto out; }
+    next = (u2_t *) malloc(sizeof(u2_t) * (chars + 1) * MSG_CHARS);
+    out = (u2_t *) calloc(chars + 1, sizeof(u2_t));
+    dict = (u2_t *) calloc(chars + 1, sizeof(u2_t));
+    fail = (u2_t *) calloc(chars + 1, sizeof(u2_t));
+    queue = (u2_t *) malloc(sizeof(u2_t) * (chars + 1));
+    for (k = 0; k < MSG_CHARS; k++) next[k] = NONE;
+
+    for (i = 0; i < n_msgs; i++) {
+        int st = 0;
+        for (const char *cp = strs + ents[i].str; *cp; cp++) {
+            u2_t *np = &next[st * MSG_CHARS + msg_fold(*cp)];
+            if (*np == NONE) {
+                *np = n_states;
+                for (k = 0; k < MSG_CHARS; k++) next[n_states * MSG_CHARS + k] = NONE;
+                n_states++;
+            }
+            st = *np;
+        }
+        if (out[st] == 0) out[st] = i + 1;
+    }
+
+    // failure links breadth first, filling in the missing transitions so every character is one lookup
+    {
+        int head = 0, tail = 0;
+        for (k = 0; k < MSG_CHARS; k++) {
+            u2_t *np = &next[k];
+            if (*np == NONE) { *np = 0; continue; }
+            fail[*np] = 0;
+            queue[tail++] = *np;
+        }
+        while (head < tail) {
+            int st = queue[head++];
+            dict[st] = out[fail[st]]? fail[st] : dict[fail[st]];
+            for (k = 0; k < MSG_CHARS; k++) {
+                u2_t *np = &next[st * MSG_CHARS + k];
+                if (*np == NONE) { *np = next[fail[st] * MSG_CHARS + k]; continue; }
+                fail[*np] = next[fail[st] * MSG_CHARS + k];
+                queue[tail++] = *np;
+            }
+        }
+    }
+
+    if ((fp = fopen(fn_msg, "w")) == NULL) { printf("fopen W %s\n", fn_msg); goto out; }
+    {
+        msg_hdr_t h;
+        memset(&h, 0, sizeof(h));
+        strcpy(h.magic, MSG_MAGIC);
+        h.n_msgs = n_msgs;
+        h.n_states = n_states;
+        h.str_len = str_len;
+        fwrite(&h, sizeof(h), 1, fp);
+        fwrite(ents, sizeof(msg_ent_t), n_msgs, fp);
+        fwrite(next, sizeof(u2_t), n_states * MSG_CHARS, fp);
+        fwrite(out, sizeof(u2_t), n_states, fp);
+        fwrite(dict, sizeof(u2_t), n_states, fp);
+        fwrite(strs, 1, str_len, fp);
+        int err = ferror(fp);
+        if (fclose(fp) != 0 || err) { printf("write error %s\n", fn_msg); goto out; }
+    }
+    printf("%s: %d message%s, %d characters, %d states\n", fn_msg, n_msgs, (n_msgs != 1)? "s":"", chars, n_states);
+    rv = 0;
+
+out:
+    free(ents);
+    free(strs);
+    free(next);
+    free(out);
+    free(dict);
+    free(fail);
+    free(queue);
+    free(mem);
+    free(loaded);
+    conv_free(c);
+    return rv;
+}
+
+// fn_log NULL: list the table
+int msgs_match(const char *fn_msg, const char *fn_log)
+{
+    int fd;
+    struct stat st;
+    if ((fd = open(fn_msg, O_RDONLY)) < 0 || fstat(fd, &st) < 0) { printf("open %s\n", fn_msg); return -1; }
+    u1_t *base = (u1_t *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { printf("mmap %s\n", fn_msg); return -1; }
+
+    msg_hdr_t *h = (msg_hdr_t *) base;
+    msg_ent_t *ents = (msg_ent_t *) (h + 1);
+    u2_t *next = (u2_t *) (ents + h->n_msgs);
+    u2_t *out = next + h->n_states * MSG_CHARS;
+    u2_t *dict = out + h->n_states;
+    const char *strs = (const char *) (dict + h->n_states);
+    if ((size_t) st.st_size < sizeof(*h) || strcmp(h->magic, MSG_MAGIC) != 0 ||
+        (size_t) st.st_size != (size_t) ((u1_t *) (strs + h->str_len) - base)) {
+        printf("%s: not a txt2abs message table\n", fn_msg);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    u4_t i;
+    if (fn_log == NULL) {
+        for (i = 0; i < h->n_msgs; i++) printf("%06o %s\n", ents[i].pc, &strs[ents[i].str]);
+        munmap(base, st.st_size);
+        return 0;
+    }
+
+    FILE *fp = stdin;
+    if (strcmp(fn_log, "-") != 0 && (fp = fopen(fn_log, "r")) == NULL) { printf("fopen R %s\n", fn_log); munmap(base, st.st_size); return -1; }
+    u4_t *counts = (u4_t *) calloc(h->n_msgs, sizeof(u4_t));
+    u1_t buf[64 * 1024];
+    int n, lnum = 1, found = 0, state = 0;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        for (int k = 0; k < n; k++) {
+            state = next[state * MSG_CHARS + msg_fold(buf[k])];
+            if ((buf[k] & 0177) == '\n') lnum++;
+            int m = out[state]? state : dict[state];
+            if (m == 0) continue;
+            msg_ent_t *e = &ents[out[m] - 1];
+            printf("line %d: %06o %s\n", lnum, e->pc, &strs[e->str]);
+            counts[out[m] - 1]++;
+            found++;
+        }
+    }
+    if (fp != stdin) fclose(fp);
+
+    printf("%d match%s\n", found, (found != 1)? "es":"");
+    for (i = 0; i < h->n_msgs; i++)
+        if (counts[i]) printf("%8u %06o %s\n", counts[i], ents[i].pc, &strs[ents[i].str]);
+    free(counts);
+    munmap(base, st.st_size);
+    return found? 0 : -1;
+}
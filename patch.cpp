@@ -0,0 +1,322 @@
+//
+// Structured patches applied to infile.txt (txt2abs --patch)
+//
+// Usage: txt2abs [--def xxx] --patch fixes.pat --in infile.txt --out patched.txt
+//
+// Syntax of fixes.pat:
+// replace pc nnnnnn [nnnnnn ...]   replace up to 8 consecutive words starting at pc
+// ifdef xxx pc                     the line at pc becomes the #else of a new "#ifdef xxx"
+//   ...                              whose body is the following lines up to "end"
+// end
+// insert xxx pc                    the following lines up to "end" are inserted under a new
+//   ...                              "#ifdef xxx" before the line at pc. If they contain an "="
+// end                                origin the pc is restored afterwards.
+//
+// All pc values refer to the unpatched listing (as evaluated with the current defines), so
+// a set of revision deltas can be written down directly from the old listing. For example
+// the CQKC_E0_FIX RESTPS patch would be:
+//
+//      ifdef CQKC_E0_FIX 2556
+//      12707   300         // jmp 300
+//      end
+//      insert CQKC_E0_FIX 2562
+//      = 300
+//      42737   177400  177776
+//      13746   2540
+//      12707   2546
+//      :: 316
+//      end
+//
+// Word replacements are applied in place (pc values don't move). The structural edits are then
+// applied from the bottom of the listing up so earlier locations stay valid, with the listing's
+// index rebuild deferred until the end. A batch of any size costs one O(n) rebuild plus
+// O(log n) per patch.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "txt2abs.h"
+
+static int perrs;
+
+static void patch_error(int line, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    printf("patch line %d ERROR: ", line);
+    vprintf(fmt, ap);
+    printf("\n");
+    perrs++;
+    va_end(ap);
+}
+
+int patch_read(const char *fn, patch_t **pp, int *np)
+{
+    FILE *fp;
+    if ((fp = fopen(fn, "r")) == NULL) { printf("fopen R %s\n", fn); return -1; }
+
+    char buf[256];
+    int lnum = 0, n = 0, alloc = 0;
+    patch_t *p = NULL, *cur = NULL;
+    perrs = 0;
+
+    while (fgets(buf, sizeof(buf), fp)) {
+        lnum++;
+        int len = strlen(buf);
+        while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == '\r')) buf[--len] = '\0';
+        char *bp = buf;
+        while (*bp != '\0' && isspace(*bp)) bp++;
+
+        // collecting a block
+        if (cur) {
+            if (strcmp(bp, "end") == 0) { cur = NULL; continue; }
+            cur->block = (char **) realloc(cur->block, sizeof(char *) * (cur->n_block + 1));
+            cur->block[cur->n_block++] = strdup(bp);
+            continue;
+        }
+
+        if (*bp == '\0' || strncmp(bp, "//", 2) == 0)
+            continue;
+
+        if (n == alloc) {
+            alloc = alloc * 2 + 16;
+            p = (patch_t *) realloc(p, sizeof(patch_t) * alloc);
+        }
+        patch_t *pt = &p[n];
+        memset(pt, 0, sizeof(*pt));
+        pt->src_line = lnum;
+
+        if (strncmp(bp, "replace ", 8) == 0) {
+            char *cp = bp + 8, *ep;
+            pt->op = P_REPLACE;
+            pt->pc = strtoul(cp, &ep, 8);
+            if (ep == cp) { patch_error(lnum, "missing pc"); continue; }
+            for (cp = ep; pt->n < N_PATCH_WORDS; cp = ep) {
+                u4_t w = strtoul(cp, &ep, 8);
+                if (ep == cp) break;
+                pt->w[pt->n++] = w;
+            }
+            while (*cp != '\0' && isspace(*cp)) cp++;
+            if (pt->n == 0 || (*cp != '\0' && strncmp(cp, "//", 2) != 0)) { patch_error(lnum, "syntax error \"%s\"", buf); continue; }
+            int i;
+            for (i = 0; i < pt->n; i++)
+                if (pt->w[i] > 0177777) break;
+            if (i < pt->n) { patch_error(lnum, "range w%d=%06o", i, pt->w[i]); continue; }
+        } else
+
+        if (sscanf(bp, "ifdef %63s %o", pt->name, &pt->pc) == 2) {
+            pt->op = P_IFDEF;
+            cur = pt;
+        } else
+
+        if (sscanf(bp, "insert %63s %o", pt->name, &pt->pc) == 2) {
+            pt->op = P_INSERT;
+            cur = pt;
+        } else
+
+        { patch_error(lnum, "syntax error \"%s\"", buf); continue; }
+
+        if (pt->pc > 0177777) { patch_error(lnum, "range pc=%06o", pt->pc); continue; }
+        n++;
+    }
+    fclose(fp);
+
+    if (cur) patch_error(lnum, "missing \"end\" for block starting at line %d", cur->src_line);
+    *pp = p;
+    *np = n;
+    return perrs;
+}
+
+void patch_free(patch_t *p, int np)
+{
+    for (int i = 0; i < np; i++) {
+        for (int j = 0; j < p[i].n_block; j++) free(p[i].block[j]);
+        free(p[i].block);
+    }
+    free(p);
+}
+
+// Rewrites a word line with new values, keeping its indentation and the column of any comment.
+static char *format_words(const char *orig, const line_t *l)
+{
+    char s[256];
+    int indent = strspn(orig, " \t");
+    const char *cmt = strstr(orig, "//");
+    int n = snprintf(s, sizeof(s), "%.*s", indent, orig);
+
+    for (int i = 0; i < l->n; i++) {
+        char w[N_NAME + 2];
+        if ((l->refs >> i) & 1)
+            snprintf(w, sizeof(w), "%c%s", ((l->rel >> i) & 1)? '%' : '&', lab_name(l->v[i]));
+        else
+            snprintf(w, sizeof(w), "%o", l->v[i]);
+        n += snprintf(s + n, sizeof(s) - n, (i < l->n - 1)? "%-8s" : "%s", w);
+    }
+
+    if (cmt) {
+        int col = cmt - orig;
+        while (n < col && n < (int) sizeof(s) - 1) s[n++] = ' ';
+        if (n >= col) n += snprintf(s + n, sizeof(s) - n, (n > col)? "    %s" : "%s", cmt);
+    }
+    s[n] = '\0';
+    return strdup(s);
+}
+
+static int lines_add(char ***lines, int n, char *s)
+{
+    *lines = (char **) realloc(*lines, sizeof(char *) * (n + 1));
+    (*lines)[n] = s;
+    return n + 1;
+}
+
+static char *indented(const char *s)
+{
+    char *r;
+    if (*s == '\0') return strdup("");
+    asprintf(&r, "    %s", s);
+    return r;
+}
+
+// structural patches: bottom of listing first, at the same line the #ifdef wrap before any inserts
+// (which then land above it), later patches before earlier ones so the earlier ones end up first
+static int patch_cmp(const void *a, const void *b)
+{
+    const patch_t *pa = *(const patch_t **) a, *pb = *(const patch_t **) b;
+    if (pa->line != pb->line) return pb->line - pa->line;
+    if (pa->op != pb->op) return (pa->op == P_IFDEF)? -1 : 1;
+    return pb->src_line - pa->src_line;
+}
+
+int patch_apply(listing_t *lst, patch_t *p, int np)
+{
+    int i, k, ns = 0;
+    patch_t **sp = (patch_t **) malloc(sizeof(patch_t *) * (np + 1));
+    perrs = 0;
+
+    listing_sync(lst);
+    lst->defer = true;
+
+    for (i = 0; i < np; i++) {
+        patch_t *pt = &p[i];
+        pt->line = listing_find_pc(lst, pt->pc, &pt->wi);
+        if (pt->line < 0) { patch_error(pt->src_line, "no word at pc=%06o", pt->pc); continue; }
+
+        if (pt->op != P_REPLACE) {
+            if (pt->wi != 0) { patch_error(pt->src_line, "pc=%06o is not the first word of its line", pt->pc); continue; }
+            sp[ns++] = pt;
+            continue;
+        }
+
+        // replacing values doesn't move any pc, so each word can be located in the unpatched listing
+        for (k = 0; k < pt->n; k++) {
+            int wi, line = listing_find_pc(lst, pt->pc + k*2, &wi);
+            lline_t *lp = (line < 0)? NULL : &lst->ln[line];
+            if (lp == NULL || lp->l.type != L_WORDS) {
+                patch_error(pt->src_line, "no word at pc=%06o", pt->pc + k*2);
+                break;
+            }
+            line_t l = lp->l;
+            if (l.br || (l.rel & ~l.refs)) {
+                // an assembled instruction: its pc-dependent words become plain values
+                u2_t w[3];
+                if (listing_words(lst, line, w, l.n) < l.n) {
+                    patch_error(pt->src_line, "undefined label in the line at pc=%06o", pt->pc + k*2);
+                    break;
+                }
+                for (int j = 0; j < l.n; j++) {
+                    if (((l.refs >> j) & 1) && !(j == 0 && l.br)) continue;
+                    l.v[j] = w[j];
+                    l.refs &= ~(1 << j);
+                }
+                l.rel &= l.refs;
+                l.br = 0;
+            }
+            l.v[wi] = pt->w[k];
+            l.refs &= ~(1 << wi);       // a replaced label reference becomes a plain value
+            char *s = format_words(lp->s, &l);
+            listing_replace(lst, line, 1, &s, 1);
+        }
+    }
+
+    qsort(sp, ns, sizeof(patch_t *), patch_cmp);
+
+    for (i = 0; i < ns; i++) {
+        patch_t *pt = sp[i];
+        if (i > 0 && pt->op == P_IFDEF && sp[i-1]->op == P_IFDEF && sp[i-1]->line == pt->line) {
+            patch_error(pt->src_line, "line at pc=%06o already patched by line %d", pt->pc, sp[i-1]->src_line);
+            continue;
+        }
+
+        char **lines = NULL, *s;
+        int n = 0;
+        bool has_org = false;
+        asprintf(&s, "#ifdef %s", pt->name);
+        n = lines_add(&lines, n, s);
+        for (k = 0; k < pt->n_block; k++) {
+            n = lines_add(&lines, n, indented(pt->block[k]));
+            line_t l;
+            parse_line(pt->block[k], &l);
+            if (l.type == L_ORG) has_org = true;
+        }
+
+        if (pt->op == P_IFDEF) {
+            const char *orig = lst->ln[pt->line].s;
+            n = lines_add(&lines, n, strdup("#else"));
+            n = lines_add(&lines, n, indented(orig + strspn(orig, " \t")));
+        } else
+        if (has_org) {
+            asprintf(&s, "    = %o", pt->pc);
+            n = lines_add(&lines, n, s);
+        }
+        n = lines_add(&lines, n, strdup("#endif"));
+
+        listing_replace(lst, pt->line, (pt->op == P_IFDEF)? 1:0, lines, n);
+        free(lines);
+    }
+
+    free(sp);
+    lst->defer = false;
+    listing_sync(lst);
+    return perrs;
+}
+
+static void diag_print(void *arg, int line, diag_e sev, const char *msg)
+{
+    printf("line %d %s: %s\n", line + 1, (sev == DIAG_ERROR)? "ERROR" : "NOTE", msg);
+    if (sev == DIAG_ERROR) (*(int *) arg)++;
+}
+
+int patch_main(const char *fn_patch, const char *fn_in, const char *fn_out, int n_defs, char **defs)
+{
+    listing_t lst;
+    patch_t *p = NULL;
+    int np = 0, errs = 0;
+
+    listing_init(&lst, n_defs, defs);
+    if (listing_load(&lst, fn_in) < 0) { printf("fopen R %s\n", fn_in); return -1; }
+    errs += patch_read(fn_patch, &p, &np);
+    if (errs == 0) errs += patch_apply(&lst, p, np);
+    if (errs == 0) {
+        printf("%d patch%s applied\n", np, (np != 1)? "es":"");
+        listing_diags(&lst, diag_print, &errs);
+    }
+
+    if (errs == 0) {
+        FILE *fp;
+        if ((fp = fopen(fn_out, "w")) == NULL) { printf("fopen W %s\n", fn_out); return -1; }
+        if (listing_write(&lst, fp) < 0) printf("write error\n");
+        fclose(fp);
+    }
+
+    printf("%d error%s\n", errs, (errs != 1)? "s":"");
+    patch_free(p, np);
+    listing_free(&lst);
+    return 0;
+}
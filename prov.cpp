@@ -0,0 +1,127 @@
+//
+// Provenance sidecar: which source lines each emitted block was built from
+//
+// Usage: txt2abs --prov outfile.prov --in infile.txt --out outfile.abs    write sidecar while converting
+//        txt2abs --prov outfile.prov --where nnnnnn                       find the source line of an address
+//
+// Syntax of outfile.prov:
+// blk n offset org len first_line last_line   one per block in .abs file order (offset is decimal)
+// addr bytes line blk                         one per run of bytes from a single line, ascending addr
+//
+// Addresses and lengths are octal, line numbers and block numbers decimal. Because the runs are
+// written in ascending address order a lookup is a binary search over them (and a walk back over
+// any earlier runs still reaching the address). A load checksum error identifies a block, whose
+// "blk" line gives the range of source lines it came from.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "txt2abs.h"
+
+static int run_cmp(const void *a, const void *b)
+{
+    const prov_run_t *ra = (const prov_run_t *) a, *rb = (const prov_run_t *) b;
+    if (ra->addr != rb->addr) return (ra->addr < rb->addr)? -1 : 1;
+    return ra->line - rb->line;
+}
+
+int prov_write(conv_t *c, const char *fn_prov, const char *fn_in)
+{
+    FILE *fp;
+    if ((fp = fopen(fn_prov, "w")) == NULL) { printf("fopen W %s\n", fn_prov); return -1; }
+    int i;
+
+    fprintf(fp, "// txt2abs provenance for %s\n", fn_in);
+    fprintf(fp, "// blk n offset org len first_line last_line\n");
+    for (i = 0; i < c->n_pblks; i++) {
+        prov_blk_t *pb = &c->pblks[i];
+        prov_run_t *r = &c->runs[pb->run0];
+        int first = pb->n_runs? r[0].line : 0, last = pb->n_runs? r[pb->n_runs - 1].line : 0;
+        fprintf(fp, "blk %d %u %06o %06o %d %d\n", i, pb->off, pb->org, pb->len, first, last);
+    }
+
+    // the runs are only needed in address order from here on
+    qsort(c->runs, c->n_runs, sizeof(prov_run_t), run_cmp);
+    fprintf(fp, "// addr bytes line blk\n");
+    for (i = 0; i < c->n_runs; i++) {
+        prov_run_t *r = &c->runs[i];
+        fprintf(fp, "%06o %o %d %d\n", r->addr, r->n, r->line, r->blk);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+struct where_blk_t {
+    u4_t off, org, len;
+    int first, last;
+};
+
+int prov_where(const char *fn_prov, u4_t addr)
+{
+    FILE *fp;
+    if ((fp = fopen(fn_prov, "r")) == NULL) { printf("fopen R %s\n", fn_prov); return -1; }
+
+    char buf[NBUF];
+    int n = 0, alloc = 0, n_blks = 0, alloc_blks = 0;
+    prov_run_t *runs = NULL, r;
+    where_blk_t *blks = NULL, b;
+    int bn;
+
+    while (fgets(buf, NBUF, fp)) {
+        if (sscanf(buf, "blk %d %u %o %o %d %d", &bn, &b.off, &b.org, &b.len, &b.first, &b.last) == 6) {
+            if (n_blks == alloc_blks) {
+                alloc_blks = alloc_blks * 2 + 64;
+                blks = (where_blk_t *) realloc(blks, sizeof(where_blk_t) * alloc_blks);
+            }
+            blks[n_blks++] = b;
+        } else
+        if (sscanf(buf, "%o %o %d %d", &r.addr, &r.n, &r.line, &r.blk) == 4) {
+            if (n == alloc) {
+                alloc = alloc * 2 + 1024;
+                runs = (prov_run_t *) realloc(runs, sizeof(prov_run_t) * alloc);
+            }
+            runs[n++] = r;
+        }
+    }
+    fclose(fp);
+
+    // last run starting at or below addr
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (runs[mid].addr <= addr) lo = mid + 1; else hi = mid;
+    }
+
+    // Runs covering addr (more than one if it is loaded twice) need not be adjacent: a long run
+    // can start well before shorter ones. Walk back while some run up to i still reaches addr.
+    u4_t *reach = (u4_t *) malloc(sizeof(u4_t) * (n + 1));
+    for (int i = 0; i < n; i++) {
+        reach[i] = runs[i].addr + runs[i].n;
+        if (i > 0 && reach[i-1] > reach[i]) reach[i] = reach[i-1];
+    }
+
+    int found = 0;
+    for (int i = lo - 1; i >= 0 && reach[i] > addr; i--) {
+        prov_run_t *rp = &runs[i];
+        if (rp->addr + rp->n <= addr) continue;
+        printf("%06o: line %d", addr, rp->line);
+        if (rp->blk < n_blks) {
+            where_blk_t *bp = &blks[rp->blk];
+            printf(", blk %d (offset %u org %06o len %06o, lines %d-%d)", rp->blk, bp->off, bp->org, bp->len, bp->first, bp->last);
+        }
+        printf("\n");
+        found++;
+    }
+    if (!found) printf("%06o: not loaded by any block\n", addr);
+
+    free(reach);
+    free(runs);
+    free(blks);
+    return found? 0 : -1;
+}
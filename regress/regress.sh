@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# Regression checks (make check), run from the top directory once txt2abs is built
+#
+# Each section checks one feature against known results for the CQKC listing and prints a line
+# per check. The exit status is non-zero if any failed.
+#
+# jks@jks.com
+# 2019-2021
+#
+
+T=./txt2abs
+SRC=CQKC_D_34_40_45.txt
+R=regress
+D=${TMPDIR:-/tmp}/txt2abs_regress.$$
+mkdir -p $D || exit 1
+trap 'rm -rf $D' 0
+fails=0
+
+ok() { echo "ok    $1"; }
+fail() { echo "FAIL  $1"; fails=$((fails + 1)); }
+
+defs() { for d in $1; do [ "$d" = - ] || printf -- "--def %s " "$d"; done; }
+
+# converted images
+while read sum v; do
+    $T $(defs "$v") --in $SRC --out $D/v.abs > /dev/null
+    [ "$(md5sum < $D/v.abs | cut -d' ' -f1)" = "$sum" ] && ok "image $v" || fail "image $v"
+done < $R/abs.md5
+
+# --check-only finds what the converter does, also in a listing with errors: a wrong ":: pc"
+# check, and an odd origin putting every following word line at an odd pc
+sed 's/^    :: 316$/    :: 320/' $SRC > $D/bad1.txt
+sed '3000s/^/= 1\n/' $SRC > $D/bad2.txt
+for t in "$SRC -" "$SRC 11/04" "$SRC PB_11/04" "$D/bad1.txt -" "$D/bad2.txt -"; do
+    set -- $t
+    $T $(defs "$2") --in $1 --out $D/c.abs | grep ERROR > $D/conv.out
+    $T $(defs "$2") --check-only --in $1 | grep ERROR > $D/check.out
+    n=$(wc -l < $D/conv.out)
+    cmp -s $D/conv.out $D/check.out && ok "check-only $(basename $1) $2 ($n errors)" || fail "check-only $(basename $1) $2"
+done
+[ "$(wc -l < $D/conv.out)" -gt 0 ] || fail "check-only: no errors in the bad listing"
+mkdir $D/batch && cp $SRC $D/bad1.txt $D/batch
+$T --check-only --batch $D/batch | grep ERROR > $D/batch.out
+$T --check-only --in $D/bad1.txt | grep ERROR > $D/check.out
+cmp -s $D/batch.out $D/check.out && ok "check-only --batch" || fail "check-only --batch"
+
+# a delta overlays its base (less the base's start block) to give the variant
+for v in 11/20 "11/20 PB_11/04" 11/04 START_TTYCHK; do
+    n=$(echo "_$v" | tr '/ ' '__')
+    $T --delta "$v" --in $SRC --out $D/base.abs > /dev/null
+    { head -c -7 $D/base.abs; cat $D/base$n.delta.abs; } > $D/over.abs
+    $T --mem memh --in $D/over.abs --out $D/over.memh > /dev/null
+    $T $(defs "$v") --mem memh --in $SRC --out $D/var.memh > /dev/null
+    tail -n +2 $D/over.memh > $D/a; tail -n +2 $D/var.memh > $D/b
+    cmp -s $D/a $D/b && ok "delta $v" || fail "delta $v"
+done
+
+# the E0 fix as a patch
+awk '/^#ifdef CQKC_E0_FIX/ { s = 1; next } s && /^#else/ { s = 2; next } s && /^#endif/ { s = 0; next } s != 1' $SRC > $D/nofix.txt
+$T --patch $R/e0.pat --in $D/nofix.txt --out $D/fixed.txt > /dev/null
+$T --in $D/fixed.txt --out $D/fixed.abs > /dev/null
+$T --in $D/nofix.txt --out $D/nofix.abs > /dev/null
+sum=$(sed -n 's/ -$//p' $R/abs.md5)
+[ "$(md5sum < $D/fixed.abs | cut -d' ' -f1)" = "$sum" ] && ! cmp -s $D/nofix.abs $D/fixed.abs && ok "patch e0.pat" || fail "patch e0.pat"
+
+# error call table
+count() { $T $1 $D/t$1 --in $SRC | grep -q "^$D/t$1: $2[ ,]" && ok "$1 $2" || fail "$1 $2"; }
+count --errs "386 error calls"
+$T --errs $D/t--errs --where 11146 | grep -q "^test:  swab1$" && ok "--errs --where 11146" || fail "--errs --where 11146"
+
+# subtest map
+count --subtests "62 subtests"
+
+# console message table
+count --msgs "30 messages"
+
+# define impact with more than 32 define names (a full word of the symbol set)
+{ echo "= 200"; for i in $(seq 0 34); do printf '#ifdef S%d\n000001\n#endif\n' $i; done; } > $D/syms.txt
+$T --impact --in $D/syms.txt > $D/imp.out
+[ $? = 0 ] && [ "$(grep -c ' lines ' $D/imp.out)" = 35 ] && grep -q "^S34 lines 104-106$" $D/imp.out && ok "--impact 35 defines" || fail "--impact 35 defines"
+
+# provenance of an address loaded by a run that starts before a shorter, later loaded one
+printf '= 100\n1 2 3\n= 102\n7\n' > $D/twice.txt
+$T --prov $D/twice.prov --in $D/twice.txt --out $D/twice.abs > /dev/null
+$T --prov $D/twice.prov --where 104 | grep -q "^000104: line 2," && ok "--prov --where past a shorter run" || fail "--prov --where past a shorter run"
+
+[ $fails = 0 ] && echo "all passed" || echo "$fails failed"
+[ $fails = 0 ]
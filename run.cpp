@@ -0,0 +1,139 @@
+//
+// Pass/fail regression run of converted images (txt2abs --run K)
+//
+// Each image is converted in memory and run on the interpreter (see emu.cpp) from its start
+// address (200, the XXDP convention, if the image has none) with the switch register given
+// by "--swreg nnnnnn" (default 14200: inhibit relocation and subtest iteration, end-of-pass
+// typeout). It passes when the end-of-pass message ("--pass-msg", default "DONE") has been
+// typed K times with no errors on the way.
+//
+// Errors are:
+//      error calls: entering the handler the image loads at trap vector 34, by a TRAP or a jump
+//          from another handler (parity, unexpected trap to 4). Tests that expect a TRAP point
+//          the vector elsewhere first.
+//      halt, double bus error or a wait nothing will end
+//      not completing K passes in RUN_INSNS instructions a pass
+//
+// With "--batch dir" every variant of every listing is run, in parallel (see batch.cpp).
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "txt2abs.h"
+
+// entering the error handler, pc0 is the instruction that got there
+static void run_err(emu_t *e)
+{
+    run_t *r = (run_t *) e->arg;
+    if (r->errs++ == 0) r->err_pc = e->pc0;
+}
+
+static void run_out(emu_t *e, int ch)
+{
+    run_t *r = (run_t *) e->arg;
+    if (e->n_out < r->msg_len || memcmp(e->out + e->n_out - r->msg_len, r->opt->pass_msg, r->msg_len) != 0) return;
+    if (e->out[e->n_out-1] != ch) return;       // fill character, already counted
+    if (++r->passes >= r->target) e->stop = EMU_STOP;
+}
+
+// Loads an image ready to run.
+void run_start(emu_t *e, const u1_t *img, int len, const run_opt_t *opt, run_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    emu_init(e, opt->swreg);
+    int start = emu_load(e, img, len);
+    e->r[7] = (start < 0 || (start & 1))? 0200 : start;
+
+    r->opt = opt;
+    r->msg_len = strlen(opt->pass_msg);
+    r->err_vec = e->mem[034] | (e->mem[035] << 8);
+    e->arg = r;
+    e->brk = r->err_vec;
+    e->on_brk = run_err;
+    e->on_out = run_out;
+}
+
+// Runs until the pass count reaches passes, or a failure.
+int run_passes(emu_t *e, run_t *r, int passes)
+{
+    r->target = passes;
+    r->stop = (r->passes >= passes)? EMU_STOP : emu_run(e, (u64_t) RUN_INSNS * (passes - r->passes));
+    r->stop_pc = e->r[7];
+    r->n_insns = e->n_insns;
+    return r->stop;
+}
+
+// Keeps the end of the console output for the report.
+void run_done(emu_t *e, run_t *r)
+{
+    int n = (e->n_out > RUN_OUT_TAIL)? RUN_OUT_TAIL : e->n_out;
+    r->out = (char *) malloc(n + 1);
+    memcpy(r->out, e->out + e->n_out - n, n);
+    r->out[n] = '\0';
+}
+
+// Runs an image. Returns 0 if it completed the passes without error.
+int run_image(const u1_t *img, int len, const run_opt_t *opt, run_t *r)
+{
+    emu_t *e = (emu_t *) malloc(sizeof(emu_t));
+    run_start(e, img, len, opt, r);
+    run_passes(e, r, opt->passes);
+    run_done(e, r);
+    emu_free(e);
+    free(e);
+    return RUN_PASSED(r)? 0 : -1;
+}
+
+const char *run_result(const run_t *r)
+{
+    switch (r->stop) {
+        case EMU_STOP: return r->errs? "errors" : "pass";
+        case EMU_HALT: return "halt";
+        case EMU_LIMIT: return "timeout";
+        case EMU_WAIT: return "hung";
+        case EMU_DBLBUS: return "dblbus";
+    }
+    return "?";
+}
+
+// Prints the details of a failed run.
+void run_report(FILE *fp, const run_t *r)
+{
+    fprintf(fp, "%s after %d pass%s, %llu instructions, pc %06o", run_result(r), r->passes, (r->passes != 1)? "es":"",
+        (unsigned long long) r->n_insns, r->stop_pc);
+    if (r->errs) fprintf(fp, ", %d error call%s, first at %06o", r->errs, (r->errs != 1)? "s":"", r->err_pc);
+    fprintf(fp, "\nconsole output (end):\n");
+    for (const char *cp = r->out; *cp; cp++)
+        if (*cp != '\r') fputc(*cp, fp);
+    fprintf(fp, "\n");
+}
+
+int run_main(const char *fn_in, int n_defs, char **defs, const run_opt_t *opt)
+{
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len), rv = -1;
+
+    if (errs > 0) {
+        printf("%d error%s, not run\n", errs, (errs != 1)? "s":"");
+    } else
+    if (errs == 0) {
+        run_t r;
+        rv = run_image(img, len, opt, &r);
+        if (rv == 0)
+            printf("pass: %d pass%s, %llu instructions\n", r.passes, (r.passes != 1)? "es":"", (unsigned long long) r.n_insns);
+        else
+            run_report(stdout, &r);
+        free(r.out);
+    }
+
+    conv_free(c);
+    return rv;
+}
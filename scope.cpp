@@ -0,0 +1,209 @@
+//
+// Subtest map (txt2abs --subtests outfile.sub --in infile.txt, txt2abs --subtests file.sub [--where nnnnnn])
+//
+// The diagnostic ends each subtest with a call to the scope routine through vector 030, an EMT
+// (104000-104377, "emt 0" in CQKC). The routine loops back to the start of the subtest with the
+// scope switch set, and otherwise returns to the instruction after the call, the start of the next
+// subtest, in r1. So the calls found in the converted image divide it into subtests:
+//
+//      subtest n starts after call n-1 (or the last "mov pc, r1" setting the loop start, for the
+//      first, or when the code between sets it itself) and ends with call n
+//
+// Each is recorded with its number (1-based, in pc order), start pc, the pc of its scope call,
+// the listing line and page it starts at and its name (the first one-word comment in it).
+//
+// The map is a binary sidecar, sorted by start pc, so a pc (from a log, a profile, a halt) finds
+// its subtest with a binary search of the mapped file:
+// sub_hdr_t, sub_ent_t[n_ents] (each with its name, at most 15 characters).
+// Without --where the map is listed.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "txt2abs.h"
+
+#define SUB_MAGIC "T2ASUB1"
+
+#define EMT_LO      0104000
+#define EMT_HI      0104377
+#define MOV_PC_R1   0010701
+#define SCOPE_VEC   030
+#define N_SUB_NAME  16
+
+struct sub_hdr_t {
+    char magic[8];
+    u4_t n_ents;
+    u2_t vec, handler;          // handler 1 if the image doesn't load the vector
+};
+
+struct sub_ent_t {
+    u2_t num, start, end;       // end: pc of the scope call
+    u2_t page;
+    u4_t line;
+    char name[N_SUB_NAME];
+};
+
+static int sub_cmp(const void *a, const void *b)
+{
+    return ((const sub_ent_t *) a)->start - ((const sub_ent_t *) b)->start;
+}
+
+int scope_main(const char *fn_in, const char *fn_sub, int n_defs, char **defs)
+{
+    if (!conv_is_listing(fn_in)) { printf("%s: --subtests needs the listing (.txt)\n", fn_in); return -1; }
+    FILE *fp;
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len), rv = -1;
+    u1_t *mem = (u1_t *) calloc(ABS_MEM, 1);
+    u1_t *loaded = (u1_t *) calloc(ABS_MEM, 1);
+    listing_t lst;
+    listing_init(&lst, n_defs, defs);
+    listing_load(&lst, fn_in);
+    sub_ent_t *ents = NULL;
+    int i, n = 0;
+    sub_hdr_t h;
+
+    if (errs) {
+        if (errs > 0) printf("%d error%s, no map written\n", errs, (errs != 1)? "s":"");
+        goto out;
+    }
+    abs_load(img, len, mem, loaded);
+
+    {
+        ents = (sub_ent_t *) malloc(sizeof(sub_ent_t) * (lst.n + 1));
+        bool pending = false;           // the next instruction starts a subtest
+        int start_i = -1;
+        char name[N_SUB_NAME] = "";
+
+        for (i = 0; i < lst.n; i++) {
+            lline_t *lp = &lst.ln[i];
+            if (!lp->active) continue;
+            if (lp->l.type == L_BLANK) {
+                const char *cp = lp->s;
+                if (cp[0] != '/' || cp[1] != '/') continue;
+                for (cp += 2; *cp == ' ' || *cp == '\t'; cp++)
+                    ;
+                if ((pending || start_i >= 0) && name[0] == '\0' && isalpha(*cp) && !strpbrk(cp, " \t"))
+                    snprintf(name, N_SUB_NAME, "%s", cp);
+                continue;
+            }
+            if (lp->l.type != L_WORDS) continue;
+
+            u2_t w;
+            u4_t pc = listing_pc(&lst, i);
+            if (listing_words(&lst, i, &w, 1) < 1) continue;
+            if (pending) {
+                start_i = i;
+                pending = false;
+            }
+            if (w == MOV_PC_R1) {
+                pending = true;
+                name[0] = '\0';
+                continue;
+            }
+            if (w < EMT_LO || w > EMT_HI) continue;
+            if (pc + 1 >= ABS_MEM || !loaded[pc] || (mem[pc] | (mem[pc+1] << 8)) != w) continue;
+
+            sub_ent_t *e = &ents[n];
+            memset(e, 0, sizeof(*e));
+            if (start_i < 0) start_i = i;
+            e->start = listing_pc(&lst, start_i);
+            e->end = pc;
+            e->line = start_i + 1;
+            int page = listing_page(&lst, start_i);
+            e->page = (page < 0)? 0 : page;
+            strcpy(e->name, name);
+            n++;
+            pending = true;
+            name[0] = '\0';
+        }
+    }
+
+    if (n == 0) { printf("no scope calls (emt instructions) found\n"); goto out; }
+    qsort(ents, n, sizeof(sub_ent_t), sub_cmp);
+    for (i = 0; i < n; i++) ents[i].num = i + 1;
+
+    memset(&h, 0, sizeof(h));
+    strcpy(h.magic, SUB_MAGIC);
+    h.n_ents = n;
+    h.vec = SCOPE_VEC;
+    h.handler = loaded[SCOPE_VEC]? mem[SCOPE_VEC] | (mem[SCOPE_VEC+1] << 8) : 1;
+
+    if ((fp = fopen(fn_sub, "w")) == NULL) { printf("fopen W %s\n", fn_sub); goto out; }
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(ents, sizeof(sub_ent_t), n, fp);
+    if (ferror(fp) | fclose(fp)) { printf("write error %s\n", fn_sub); goto out; }
+    printf("%s: %d subtest%s, %06o-%06o", fn_sub, n, (n != 1)? "s":"", ents[0].start, ents[n-1].end);
+    if (h.handler & 1) printf(", vector %03o not loaded by the image\n", SCOPE_VEC); else printf(", scope routine at %06o\n", h.handler);
+    rv = 0;
+
+out:
+    free(ents);
+    listing_free(&lst);
+    free(mem);
+    free(loaded);
+    conv_free(c);
+    return rv;
+}
+
+static void sub_print(const sub_ent_t *e)
+{
+    printf("%4d %06o-%06o line %d", e->num, e->start, e->end, e->line);
+    if (e->page) printf(" page %d", e->page);
+    if (e->name[0]) printf(" %s", e->name);
+    printf("\n");
+}
+
+// pc < 0: list the map
+int scope_query(const char *fn_sub, int pc)
+{
+    int fd;
+    struct stat st;
+    if ((fd = open(fn_sub, O_RDONLY)) < 0 || fstat(fd, &st) < 0) { printf("open %s\n", fn_sub); return -1; }
+    u1_t *base = (u1_t *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { printf("mmap %s\n", fn_sub); return -1; }
+
+    sub_hdr_t *h = (sub_hdr_t *) base;
+    sub_ent_t *ents = (sub_ent_t *) (h + 1);
+    if ((size_t) st.st_size < sizeof(*h) || strcmp(h->magic, SUB_MAGIC) != 0 ||
+        (size_t) st.st_size != (size_t) ((u1_t *) (ents + h->n_ents) - base)) {
+        printf("%s: not a txt2abs subtest map\n", fn_sub);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    int rv = 0;
+    if (pc < 0) {
+        for (u4_t i = 0; i < h->n_ents; i++) sub_print(&ents[i]);
+    } else {
+        // last subtest starting at or below pc
+        int lo = 0, hi = h->n_ents;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (ents[mid].start <= pc) lo = mid + 1; else hi = mid;
+        }
+        if (lo > 0 && pc <= ents[lo-1].end) {
+            printf("%06o: subtest ", pc);
+            sub_print(&ents[lo-1]);
+        } else {
+            printf("%06o: not in a subtest\n", pc);
+            rv = -1;
+        }
+    }
+    munmap(base, st.st_size);
+    return rv;
+}
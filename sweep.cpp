@@ -0,0 +1,299 @@
+//
+// Switch register sweep in lockstep (txt2abs --run K --sweep "nnnnnn nnnnnn ..." --in infile.txt)
+//
+// Runs the image K passes (as run.cpp) once for each switch register setting, as lanes of a
+// single interpreter rather than one run each. The lanes only differ in what a read of the
+// switch register returns, so while their states are the same one machine (a group) stands
+// for all of them. It stops (EMU_SWR, see emu.cpp) at each instruction that would read the
+// switch register, and that instruction is tried for every setting in the group, in place: the
+// bytes it writes are logged by emu.cpp and put back, with the registers and devices, after each
+// try. Lanes whose tries end up the same stay together, the others peel off into a new group, a
+// copy of the machine that re-executes the instruction with their setting. A group down to one
+// setting runs on without stopping, as a plain run.
+//
+// The display register is write-only (the image can't read back what it put there), so tries
+// that differ only in it are the same; each lane's display register is its group's.
+//
+// The cost is one run of each group plus the tries, so settings that only change a few
+// decisions (typeout, bell, iteration) run in little more than the time of one.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "txt2abs.h"
+
+struct group_t {
+    emu_t *e;
+    run_t r;                    // e->arg
+    int n;
+    int lanes[N_SWEEP];
+    u64_t insns0;               // instruction count it started from
+};
+
+// what one instruction did
+struct try_t {
+    u2_t r[8], psw, rcsr, xcsr, xbuf;
+    int x_busy, stop;
+    u4_t irq, trap_req;
+    bool wait, trc_inhibit;
+    u64_t n_insns;
+    int n_w;                    // bytes changed
+    u4_t w_addr[N_WLOG];
+    u1_t w_val[N_WLOG];
+    int n_typed;
+    char typed[8];
+};
+
+struct sweep_t {
+    const run_opt_t *opt;
+    int n_lanes;
+    u4_t swreg[N_SWEEP];
+    int lane_group[N_SWEEP];
+    group_t groups[N_SWEEP];
+    int n_groups;
+    u64_t reads, tries;
+    u1_t touched[ABS_MEM];      // for emu.cpp's write log, not looked at
+    wlog_t wlog[N_WLOG];
+};
+
+// the part of emu_t after the memory
+#define EMU_TAIL_OFF offsetof(emu_t, mem_top)
+#define EMU_TAIL_LEN (sizeof(emu_t) - EMU_TAIL_OFF)
+
+// Executes the instruction the group stopped at with another switch register, then puts the
+// machine back as it was.
+static void sweep_try(sweep_t *s, emu_t *e, u4_t swreg, try_t *t)
+{
+    u2_t r[8], psw = e->psw;
+    u1_t tail[EMU_TAIL_LEN];
+    memcpy(r, e->r, sizeof(r));
+    memcpy(tail, (u1_t *) e + EMU_TAIL_OFF, EMU_TAIL_LEN);
+    int n_out = e->n_out, i, k;
+
+    e->swreg = swreg;
+    e->swr_stop = false;
+    e->touched = s->touched;
+    e->wlog = s->wlog;
+    e->n_wlog = 0;
+    e->on_out = NULL;
+    e->on_brk = NULL;
+    emu_run(e, 1);
+    if (e->n_wlog > N_WLOG) { printf("sweep: an instruction wrote more than %d bytes\n", N_WLOG); exit(-1); }
+
+    memcpy(t->r, e->r, sizeof(t->r));
+    t->psw = e->psw;
+    t->rcsr = e->rcsr;
+    t->xcsr = e->xcsr;
+    t->xbuf = e->xbuf;
+    t->x_busy = e->x_busy;
+    t->stop = e->stop;
+    t->irq = e->irq;
+    t->trap_req = e->trap_req;
+    t->wait = e->wait;
+    t->trc_inhibit = e->trc_inhibit;
+    t->n_insns = e->n_insns;
+    t->n_typed = e->n_out - n_out;
+    if (t->n_typed > (int) sizeof(t->typed)) t->n_typed = sizeof(t->typed);
+    memcpy(t->typed, e->out + n_out, t->n_typed);
+
+    // the bytes that changed (the first write of each has the original value), then undo
+    t->n_w = 0;
+    for (i = 0; i < e->n_wlog; i++) {
+        u4_t a = s->wlog[i].addr;
+        for (k = 0; k < i && s->wlog[k].addr != a; k++)
+            ;
+        if (k < i || e->mem[a] == s->wlog[i].old) continue;
+        t->w_addr[t->n_w] = a;
+        t->w_val[t->n_w++] = e->mem[a];
+    }
+    for (i = e->n_wlog - 1; i >= 0; i--) e->mem[s->wlog[i].addr] = s->wlog[i].old;
+
+    // the output buffer may have moved
+    char *out = e->out;
+    int alloc_out = e->alloc_out;
+    memcpy(e->r, r, sizeof(r));
+    e->psw = psw;
+    memcpy((u1_t *) e + EMU_TAIL_OFF, tail, EMU_TAIL_LEN);
+    e->out = out;
+    e->alloc_out = alloc_out;
+    if (out) out[n_out] = '\0';
+}
+
+// the same machine after the instruction, apart from the display register
+static bool try_same(const try_t *a, const try_t *b)
+{
+    if (memcmp(a->r, b->r, sizeof(a->r)) != 0 || a->psw != b->psw || a->rcsr != b->rcsr || a->xcsr != b->xcsr ||
+        a->xbuf != b->xbuf || a->x_busy != b->x_busy || a->stop != b->stop || a->irq != b->irq ||
+        a->trap_req != b->trap_req || a->wait != b->wait || a->trc_inhibit != b->trc_inhibit ||
+        a->n_insns != b->n_insns || a->n_typed != b->n_typed || memcmp(a->typed, b->typed, a->n_typed) != 0 ||
+        a->n_w != b->n_w)
+        return false;
+    for (int i = 0; i < a->n_w; i++) {
+        int k;
+        for (k = 0; k < b->n_w && b->w_addr[k] != a->w_addr[i]; k++)
+            ;
+        if (k == b->n_w || b->w_val[k] != a->w_val[i]) return false;
+    }
+    return true;
+}
+
+// A new group for the lanes that peeled off, from the instruction they part at.
+static void sweep_split(sweep_t *s, group_t *g, u4_t swreg, int *lanes, int n)
+{
+    group_t *ng = &s->groups[s->n_groups++];
+    emu_t *e = (emu_t *) malloc(sizeof(emu_t));
+    memcpy(e, g->e, sizeof(emu_t));
+    e->swreg = swreg;
+    e->alloc_out = e->n_out + 1024;
+    e->out = (char *) malloc(e->alloc_out);
+    memcpy(e->out, g->e->out, e->n_out);
+    e->out[e->n_out] = '\0';
+    e->arg = &ng->r;
+
+    ng->e = e;
+    ng->r = g->r;
+    ng->n = n;
+    memcpy(ng->lanes, lanes, sizeof(int) * n);
+    for (int i = 0; i < n; i++) s->lane_group[lanes[i]] = ng - s->groups;
+    ng->insns0 = e->n_insns;
+}
+
+// Runs a group to the end of its passes, splitting it where its lanes part.
+static void sweep_group(sweep_t *s, group_t *g)
+{
+    emu_t *e = g->e;
+    u64_t limit = (u64_t) RUN_INSNS * s->opt->passes;
+    try_t tried[N_SWEEP];
+    u4_t sw[N_SWEEP];
+    int i, j, k, stop;
+
+    for (;;) {
+        // the settings of the group, its own first
+        int n_sw = 0;
+        for (i = 0; i < g->n; i++) {
+            u4_t v = s->swreg[g->lanes[i]];
+            for (j = 0; j < n_sw && sw[j] != v; j++)
+                ;
+            if (j == n_sw) sw[n_sw++] = v;
+        }
+        e->swr_stop = (n_sw > 1);
+
+        if (g->r.passes >= g->r.target) { stop = EMU_STOP; break; }
+        if (e->n_insns >= limit) { stop = EMU_LIMIT; break; }
+        if ((stop = emu_run(e, limit - e->n_insns)) != EMU_SWR) break;
+        s->reads++;
+
+        // try the instruction with each setting, each outcome other than the group's is a new group
+        for (j = 0; j < n_sw; j++) {
+            sweep_try(s, e, sw[j], &tried[j]);
+            s->tries++;
+        }
+        bool done[N_SWEEP];
+        for (j = 0; j < n_sw; j++) done[j] = (j == 0 || try_same(&tried[0], &tried[j]));
+        for (j = 1; j < n_sw; j++) {
+            if (done[j]) continue;
+            int lanes[N_SWEEP], n = 0, keep = 0;
+            for (k = j; k < n_sw; k++) {
+                if (done[k] || !(k == j || try_same(&tried[j], &tried[k]))) continue;
+                done[k] = true;
+                for (i = 0; i < g->n; i++)
+                    if (s->swreg[g->lanes[i]] == sw[k]) lanes[n++] = g->lanes[i];
+            }
+            for (i = 0; i < g->n; i++) {
+                for (k = 0; k < n && lanes[k] != g->lanes[i]; k++)
+                    ;
+                if (k == n) g->lanes[keep++] = g->lanes[i];
+            }
+            g->n = keep;
+            sweep_split(s, g, sw[j], lanes, n);
+        }
+
+        // the instruction again, for real
+        e->swr_at = e->n_insns;
+    }
+
+    g->r.stop = stop;
+    g->r.stop_pc = e->r[7];
+    g->r.n_insns = e->n_insns;
+    run_done(e, &g->r);
+}
+
+int sweep_main(const char *fn_in, int n_defs, char **defs, const run_opt_t *opt, const char *sweep_s)
+{
+    sweep_t *s = (sweep_t *) calloc(1, sizeof(sweep_t));
+    s->opt = opt;
+    char *ep;
+    for (const char *cp = sweep_s; s->n_lanes < N_SWEEP; cp = ep) {
+        u4_t v = strtoul(cp, &ep, 8);
+        if (ep == cp) break;
+        s->swreg[s->n_lanes++] = v & 0177777;
+    }
+    if (s->n_lanes == 0) { printf("--sweep: no switch register settings\n"); free(s); return -1; }
+
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len), rv = -1, i;
+
+    if (errs > 0) {
+        printf("%d error%s, not run\n", errs, (errs != 1)? "s":"");
+    } else
+    if (errs == 0) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        // one group with every lane
+        run_opt_t o = *opt;
+        o.swreg = s->swreg[0];
+        group_t *g = &s->groups[s->n_groups++];
+        g->e = (emu_t *) malloc(sizeof(emu_t));
+        run_start(g->e, img, len, &o, &g->r);
+        g->r.opt = opt;
+        g->r.target = opt->passes;
+        g->n = s->n_lanes;
+        for (i = 0; i < s->n_lanes; i++) g->lanes[i] = i;
+
+        // groups split off are run after the one they left
+        for (i = 0; i < s->n_groups; i++) sweep_group(s, &s->groups[i]);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        u64_t insns = 0, lane_insns = 0;
+        for (i = 0; i < s->n_groups; i++) insns += s->groups[i].r.n_insns - s->groups[i].insns0;
+        rv = 0;
+        printf("swreg  result  passes  instructions  group\n");
+        for (i = 0; i < s->n_lanes; i++) {
+            group_t *lg = &s->groups[s->lane_group[i]];
+            run_t *r = &lg->r;
+            lane_insns += r->n_insns;
+            printf("%06o %-7s %6d %13llu %6d", s->swreg[i], run_result(r), r->passes, (unsigned long long) r->n_insns,
+                s->lane_group[i]);
+            if (r->errs) printf("  %d error call%s, first at %06o", r->errs, (r->errs != 1)? "s":"", r->err_pc);
+            if (r->stop != EMU_STOP) printf("  pc %06o", r->stop_pc);
+            printf("\n");
+            if (!RUN_PASSED(r)) rv = -1;
+        }
+        double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        printf("%d lane%s in %d group%s, %llu switch register reads, %llu tries\n", s->n_lanes, (s->n_lanes != 1)? "s":"",
+            s->n_groups, (s->n_groups != 1)? "s":"", (unsigned long long) s->reads, (unsigned long long) s->tries);
+        printf("%llu instructions for %llu lane instructions (%.1fx) in %.3fs\n", (unsigned long long) insns,
+            (unsigned long long) lane_insns, insns? (double) lane_insns / insns : 0.0, secs);
+
+        for (i = 0; i < s->n_groups; i++) {
+            free(s->groups[i].r.out);
+            emu_free(s->groups[i].e);
+            free(s->groups[i].e);
+        }
+    }
+
+    conv_free(c);
+    free(s);
+    return rv;
+}
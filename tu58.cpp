@@ -0,0 +1,469 @@
+//
+// TU58 cartridge image with a boot block (txt2abs --tu58 outfile.dsk --in infile.txt)
+// and a TU58 stand-in serving an image on a pty (txt2abs --tu58 file.dsk --serve)
+//
+// The cartridge is 512 blocks of 512 bytes, as used by TU58 emulators:
+//      block 0         boot loader, read to 0 and started at 0 by a ROM TU58 bootstrap
+//      block 1..n      memory image from address 0, bytes the image doesn't load are 0
+//
+// The boot loader copies itself above the image (and its stack), then reads blocks 1..n into
+// memory one at a time with RSP (radial serial protocol) READ commands through the DL11 at
+// TU58_CSR and jumps to the image's start address (200 if it has none). A block whose data or
+// end packet has a bad checksum, or whose end packet reports an error, is read again after a
+// BREAK, discarding input until the line is quiet (the rest of the failed transfer), and an
+// INIT; TU58_TRIES failures of the same block halt. The loader is written below in
+// the listing syntax and assembled by the converter itself (see asm.cpp), so it needs nothing
+// beyond the basic instruction set.
+//
+// --serve opens a pty, prints its name and acts as the drive for whatever connects to it:
+// INIT, BOOT, and the NOP, INIT, READ, WRITE, POSITION and DIAGNOSE commands, in single-packet
+// (MRSP-less) mode. Writes go to the image file.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "txt2abs.h"
+
+#define TU58_BLKS   512
+#define TU58_BLK    512
+#define TU58_CSR    0176500
+#define TU58_TRIES  8
+#define TU58_DATA   128         // bytes in a data packet
+
+// packet flags
+#define RSP_DATA    001
+#define RSP_CTRL    002
+#define RSP_INIT    004
+#define RSP_BOOT    010
+#define RSP_CONT    020
+#define RSP_XON     021
+#define RSP_XOFF    023
+
+// opcodes
+#define RSP_NOP     0
+#define RSP_OINIT   1
+#define RSP_READ    2
+#define RSP_WRITE   3
+#define RSP_POS     5
+#define RSP_DIAG    7
+#define RSP_END     0100
+
+// end packet success codes
+#define RSP_OK          0
+#define RSP_BAD_OP      (-48 & 0377)
+#define RSP_BAD_BLK     (-55 & 0377)
+#define RSP_COMM_ERR    (-127 & 0377)
+
+// boot loader, assembled at the address after the image and its stack
+static const char *boot_src[] = {
+    "= %o",                         // loader
+    "mov #340, @#177776",           // running at 0: copy block 0 up
+    "clr r0",
+    "mov #%o, r1",                  // loader
+    "mov #400, r2",
+    "reloc:",
+    "mov (r0)+, (r1)+",
+    "dec r2",
+    "bne reloc",
+    "jmp @#main",
+
+    "main:",
+    "mov #%o, sp",                  // loader
+    "mov #%o, r5",                  // csr
+    "clr addr",
+    "mov #1, cmdblk",
+    "mov #%o, tries",               // tries
+
+    // BREAK, wait for the line to go quiet, two INITs, wait for CONTINUE
+    "init:",
+    "dec tries",
+    "bne init1",
+    "halt",
+    "init1:",
+    "bis #1, 4(r5)",
+    "clr r0",
+    "jsr pc, putc",
+    "jsr pc, putc",
+    "brk:",
+    "tstb 4(r5)",
+    "bpl brk",
+    "bic #1, 4(r5)",
+    "drain:",                       // discard what was already on its way until the line is quiet
+    "clr r2",
+    "drain1:",
+    "tstb (r5)",
+    "bmi drain2",
+    "dec r2",
+    "bne drain1",
+    "br drain3",
+    "drain2:",
+    "tst 2(r5)",
+    "br drain",
+    "drain3:",
+    "mov #4, r0",
+    "jsr pc, putc",
+    "jsr pc, putc",
+    "init2:",
+    "jsr pc, getc",
+    "cmp r0, #20",
+    "bne init2",
+
+    // READ command for block cmdblk
+    "blk:",
+    "mov #cmd, r1",
+    "mov #6, r2",
+    "clr r3",
+    "cks:",
+    "add (r1)+, r3",
+    "adc r3",
+    "dec r2",
+    "bne cks",
+    "mov r3, (r1)",
+    "mov #cmd, r1",
+    "mov #16, r2",
+    "send:",
+    "movb (r1)+, r0",
+    "jsr pc, putc",
+    "dec r2",
+    "bne send",
+
+    // data packets, then the end packet
+    "mov addr, r4",
+    "pkt:",
+    "jsr pc, rdpkt",
+    "bne init",
+    "cmpb @#%o, #2",                // buf
+    "beq end",
+    "clr r2",
+    "bisb @#%o, r2",                // buf+1
+    "mov #%o, r1",                  // buf+2
+    "copy:",
+    "movb (r1)+, (r4)+",
+    "dec r2",
+    "bne copy",
+    "br pkt",
+    "end:",
+    "tstb @#%o",                    // buf+3
+    "bmi init",
+    "add #1000, addr",
+    "inc cmdblk",
+    "mov #%o, tries",               // tries
+    "cmp cmdblk, #%o",              // n+1
+    "bne blk",
+    "jmp @#%o",                     // start
+
+    // reads a packet into buf, skipping anything but a data or control flag: Z set if the checksum is good
+    "rdpkt:",
+    "jsr pc, getc",
+    "cmp r0, #1",
+    "beq rd1",
+    "cmp r0, #2",
+    "bne rdpkt",
+    "rd1:",
+    "mov #%o, r1",                  // buf
+    "movb r0, (r1)+",
+    "jsr pc, getc",
+    "movb r0, (r1)+",
+    "mov r0, r2",
+    "add #2, r2",
+    "rd2:",
+    "jsr pc, getc",
+    "movb r0, (r1)+",
+    "dec r2",
+    "bne rd2",
+    "mov #%o, r1",                  // buf
+    "clr r2",
+    "bisb @#%o, r2",                // buf+1
+    "inc r2",
+    "asr r2",
+    "inc r2",
+    "clr r3",
+    "rd3:",
+    "add (r1)+, r3",
+    "adc r3",
+    "dec r2",
+    "bne rd3",
+    "cmp r3, (r1)",
+    "rts pc",
+
+    "putc:",
+    "tstb 4(r5)",
+    "bpl putc",
+    "movb r0, 6(r5)",
+    "rts pc",
+
+    "getc:",
+    "tstb (r5)",
+    "bpl getc",
+    "mov 2(r5), r0",
+    "bic #177400, r0",
+    "rts pc",
+
+    "addr:",
+    "000000",
+    "tries:",
+    "000000",
+    "cmd:",
+    "005002",                       // flag CONTROL, count 10.
+    "000002",                       // READ, modifier 0
+    "000000",                       // unit 0, switches 0
+    "000000",                       // sequence
+    "001000",                       // byte count 512.
+    "cmdblk:",
+    "000000",                       // block
+    "000000",                       // checksum
+    NULL
+};
+
+// Assembles the boot loader for an image of n blocks. Returns its size, or -1.
+static int boot_build(u1_t *blk0, int n, u4_t start)
+{
+    u4_t loader = n * TU58_BLK + 01000;
+    u4_t buf = loader + TU58_BLK;
+    u4_t args[] = { loader, loader, loader, TU58_CSR, TU58_TRIES, buf, buf+1, buf+2, buf+3, TU58_TRIES, (u4_t) n + 1, start,
+        buf, buf, buf+1 };
+    int ai = 0, len = 0;
+
+    for (int i = 0; boot_src[i]; i++) {
+        len += strlen(boot_src[i]) + 16;
+    }
+    char *text = (char *) malloc(len + 1), *tp = text;
+    for (int i = 0; boot_src[i]; i++) {
+        const char *fp = strchr(boot_src[i], '%');
+        tp += fp? sprintf(tp, boot_src[i], args[ai++]) : sprintf(tp, "%s", boot_src[i]);
+        *tp++ = '\n';
+    }
+    *tp = '\0';
+
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    c->fn_in = "tu58 boot";
+    conv_begin(c, 0, NULL, IMG_SIZE);
+    int errs = conv_text(c, text);
+    free(text);
+    u1_t *mem = (u1_t *) calloc(ABS_MEM, 1);
+    u1_t *loaded = (u1_t *) calloc(ABS_MEM, 1);
+    abs_load(c->img, c->img_len, mem, loaded);
+    conv_free(c);
+
+    int size;
+    for (size = TU58_BLK; size > 0 && !loaded[loader + size - 1]; size--)
+        ;
+    bool ok = (errs == 0 && ai == (int) (sizeof(args) / sizeof(args[0])) && !loaded[loader + TU58_BLK]);
+    if (ok) memcpy(blk0, &mem[loader], TU58_BLK);
+    free(mem);
+    free(loaded);
+    return ok? size : -1;
+}
+
+int tu58_write(const char *fn_in, const char *fn_out, int n_defs, char **defs)
+{
+    FILE *fp;
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len), rv = -1;
+    u1_t *tape = (u1_t *) calloc(TU58_BLKS * TU58_BLK, 1);
+    u1_t *loaded = (u1_t *) calloc(ABS_MEM, 1);
+    int start = abs_load(img, len, &tape[TU58_BLK], loaded);
+    int top, n, size;
+
+    for (top = ABS_MEM; top > 0 && !loaded[top-1]; top--)
+        ;
+    n = (top + TU58_BLK - 1) / TU58_BLK;
+    if (start < 0 || (start & 1)) start = 0200;
+
+    if (errs) {
+        if (errs > 0) printf("%d error%s, not written\n", errs, (errs != 1)? "s":"");
+    } else
+    if (n + 1 > TU58_BLKS || n * TU58_BLK + 01000 + 2 * TU58_BLK > EMU_IO_PAGE) {
+        printf("image too big: %d blocks\n", n);
+    } else
+    if ((size = boot_build(tape, n, start)) < 0) {
+        printf("can't assemble the boot loader\n");
+    } else
+    if ((fp = fopen(fn_out, "w")) == NULL) {
+        printf("fopen W %s\n", fn_out);
+    } else {
+        if (fwrite(tape, 1, TU58_BLKS * TU58_BLK, fp) != TU58_BLKS * TU58_BLK || fclose(fp) != 0)
+            printf("write error %s\n", fn_out);
+        else {
+            printf("%s: boot loader %d bytes at %06o, %d blocks (%06o bytes) from 0, start %06o\n", fn_out, size,
+                n * TU58_BLK + 01000, n, n * TU58_BLK, start);
+            rv = 0;
+        }
+    }
+
+    free(tape);
+    free(loaded);
+    conv_free(c);
+    return rv;
+}
+
+
+// TU58 stand-in
+
+static int rsp_fd;
+
+static int getb()
+{
+    u1_t b;
+    while (true) {
+        int n = read(rsp_fd, &b, 1);
+        if (n == 1) return b;
+        if (n == 0) { usleep(10000); continue; }       // nothing connected
+        return -1;
+    }
+}
+
+static void put(const u1_t *p, int n)
+{
+    while (n > 0) {
+        int w = write(rsp_fd, p, n);
+        if (w <= 0) return;
+        p += w;
+        n -= w;
+    }
+}
+
+// 16-bit end-around carry sum of the packet's words
+static u4_t rsp_sum(const u1_t *p, int n)
+{
+    u4_t sum = 0;
+    for (int i = 0; i < n; i += 2) {
+        sum += p[i] | ((i + 1 < n)? p[i+1] << 8 : 0);
+        if (sum > 0177777) sum = (sum & 0177777) + 1;
+    }
+    return sum;
+}
+
+static void put_pkt(u1_t *p, int n)
+{
+    u4_t sum = rsp_sum(p, n);
+    p[n] = sum;
+    p[n+1] = sum >> 8;
+    put(p, n + 2);
+}
+
+static void put_end(int unit, int success, u4_t seq, u4_t count)
+{
+    u1_t p[14] = { RSP_CTRL, 10, RSP_END, (u1_t) success, (u1_t) unit, 0, (u1_t) seq, (u1_t) (seq >> 8),
+        (u1_t) count, (u1_t) (count >> 8), 0, 0 };
+    put_pkt(p, 12);
+}
+
+// Reads the rest of a packet after its flag into p (TU58_DATA + 4 bytes), false if its count
+// is longer than a data packet or the checksum is bad.
+static bool get_pkt(u1_t *p, int flag)
+{
+    int n, b;
+    p[0] = flag;
+    if ((n = getb()) < 0 || n > TU58_DATA) return false;
+    p[1] = n;
+    for (int i = 0; i < n + 2; i++) {
+        if ((b = getb()) < 0) return false;
+        p[2+i] = b;
+    }
+    return rsp_sum(p, n + 2) == (u4_t) (p[n+2] | (p[n+3] << 8));
+}
+
+int tu58_serve(const char *fn)
+{
+    int ffd;
+    if ((ffd = open(fn, O_RDWR)) < 0) { printf("open %s\n", fn); return -1; }
+    u1_t *tape = (u1_t *) calloc(TU58_BLKS * TU58_BLK, 1);
+    if (read(ffd, tape, TU58_BLKS * TU58_BLK) < 0) { printf("read %s\n", fn); return -1; }
+
+    if ((rsp_fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(rsp_fd) < 0 || unlockpt(rsp_fd) < 0) {
+        printf("can't open a pty\n");
+        return -1;
+    }
+    // keep the slave open (raw) so reads don't fail between connections
+    const char *slave = ptsname(rsp_fd);
+    int sfd = open(slave, O_RDWR | O_NOCTTY);
+    struct termios t;
+    tcgetattr(sfd, &t);
+    cfmakeraw(&t);
+    tcsetattr(sfd, TCSANOW, &t);
+    printf("TU58 %s on %s\n", fn, slave);
+    fflush(stdout);
+
+    u1_t p[TU58_DATA + 4];
+    int b;
+    while ((b = getb()) >= 0) {
+        switch (b) {
+        case RSP_INIT:
+            p[0] = RSP_CONT;
+            put(p, 1);
+            break;
+
+        case RSP_BOOT:
+            if (getb() < 0) break;
+            put(tape, TU58_BLK);
+            break;
+
+        case RSP_CTRL: {
+            if (!get_pkt(p, b) || p[1] != 10) { put_end(0, RSP_COMM_ERR, 0, 0); break; }
+            int op = p[2], unit = p[4];
+            u4_t seq = p[6] | (p[7] << 8), count = p[8] | (p[9] << 8), blk = p[10] | (p[11] << 8);
+            u4_t off = blk * TU58_BLK, n = 0;
+
+            switch (op) {
+            case RSP_NOP: case RSP_OINIT: case RSP_POS: case RSP_DIAG:
+                put_end(unit, RSP_OK, seq, 0);
+                break;
+
+            case RSP_READ:
+                if (off + count > TU58_BLKS * TU58_BLK) { put_end(unit, RSP_BAD_BLK, seq, 0); break; }
+                for (n = 0; n < count; ) {
+                    int len = (count - n > TU58_DATA)? TU58_DATA : count - n;
+                    p[0] = RSP_DATA;
+                    p[1] = len;
+                    memcpy(&p[2], &tape[off + n], len);
+                    put_pkt(p, len + 2);
+                    n += len;
+                }
+                put_end(unit, RSP_OK, seq, count);
+                break;
+
+            case RSP_WRITE:
+                if (off + count > TU58_BLKS * TU58_BLK) { put_end(unit, RSP_BAD_BLK, seq, 0); break; }
+                while (n < count) {
+                    u1_t c = RSP_CONT;
+                    put(&c, 1);
+                    if ((b = getb()) != RSP_DATA || !get_pkt(p, b) || n + p[1] > count) break;
+                    memcpy(&tape[off + n], &p[2], p[1]);
+                    n += p[1];
+                }
+                if (n < count) { put_end(unit, RSP_COMM_ERR, seq, n); break; }
+                pwrite(ffd, &tape[off], count, off);
+                put_end(unit, RSP_OK, seq, count);
+                break;
+
+            default:
+                put_end(unit, RSP_BAD_OP, seq, 0);
+                break;
+            }
+            break;
+        }
+
+        default:        // XON, XOFF, BREAK nulls, noise
+            break;
+        }
+    }
+
+    close(sfd);
+    close(rsp_fd);
+    close(ffd);
+    free(tape);
+    return 0;
+}
@@ -2,7 +2,37 @@
 // Converts a text file describing PDP-11 binary data into
 // a binary file in absolute format (.abs) suitable for use with the absolute loader
 //
-// Usage: txt2abs [--list] [--def xxx] infile.txt outfile.abs
+// Usage: txt2abs [--list] [--def xxx] [--prov outfile.prov] [--deps outfile.deps] infile.txt outfile.abs
+//        txt2abs [--def xxx] --lsp      language server for editing infile.txt (see lsp.cpp)
+//        txt2abs [--def xxx] --patch fixes.pat --in infile.txt --out patched.txt  (see patch.cpp)
+//        txt2abs --prov outfile.prov --where nnnnnn    source line of an address (see prov.cpp)
+//        txt2abs [--def xxx] --delta "xxx ..." --in infile.txt --out base.abs    base plus variant overlays (see delta.cpp)
+//        txt2abs [--def xxx] --check-only [--first-error] --in infile.txt    validate only (see check.cpp)
+//        txt2abs [--def xxx] --impact --in infile.txt  lines and addresses each define affects (see impact.cpp)
+//        txt2abs [--def xxx] [--jobs n] [--index corpus.idx] --batch dir     convert every dir/xxx.txt (see batch.cpp)
+//        txt2abs --index corpus.idx [--where nnnnnn] [--seq "nnnnnn ..."]   find a halt in the corpus (see index.cpp)
+//        txt2abs [--def xxx] --run K [--swreg nnnnnn] [--pass-msg str] --in infile.txt   run K passes (see run.cpp)
+//            (also with --batch dir to run every variant)
+//        txt2abs [--def xxx] [--run K] [--pass-msg str] --sweep "nnnnnn ..." --in infile.txt
+//            run K passes with each switch register setting, in lockstep (see sweep.cpp)
+//        txt2abs [--def xxx] [--run K] [--jobs n] --inject N [--seed n] [--fault spec ...] --in infile.txt
+//            run fault injection scenarios from a booted snapshot (see fault.cpp)
+//        txt2abs [--def xxx] --warm pc[:n] | pass:n [--stub nnnnnn] [--run K] --in infile.txt --out warm.abs
+//            image of the memory and registers once initialized, with a restore stub (see warm.cpp)
+//        txt2abs [--def xxx] --mem memh|memb|coe|mif [--width n] [--base nnnnnn] [--depth n] --in infile.txt --out outfile
+//            memory initialization file for a simulated or FPGA core (see fpga.cpp)
+//        txt2abs [--def xxx] --tu58 outfile.dsk --in infile.txt     TU58 cartridge with a boot block (see tu58.cpp)
+//        txt2abs --tu58 file.dsk --serve       TU58 stand-in on a pty
+//        txt2abs [--def xxx] [--in image] [--cps n] [--baud n] --port dev[=image] [--port ...] --farm
+//            stream images to many boards at once (see farm.cpp)
+//        txt2abs [--def xxx] --loader file[@addr[:start]] --in infile.txt | infile.abs   load through a real
+//            absolute loader on the interpreter (see ldr.cpp), also with --batch dir
+//        txt2abs [--def xxx] --errs outfile.err --in infile.txt    table of error call sites (see errs.cpp)
+//        txt2abs --errs file.err --where nnnnnn     the test and check of an error pc
+//        txt2abs [--def xxx] --subtests outfile.sub --in infile.txt    subtest map from the scope calls (see scope.cpp)
+//        txt2abs --subtests file.sub [--where nnnnnn]    the subtest of a pc, or the whole map
+//        txt2abs [--def xxx] --msgs outfile.msg --in infile.txt | infile.abs    console messages (see msgs.cpp)
+//        txt2abs --msgs file.msg [--match console.log]     find the messages in a console log, or list them
 //
 // Syntax of infile.txt:
 // = address                    set address origin
@@ -11,14 +41,20 @@
 // = nnnnnn                     set pc origin, subsequently incremented by 2/1 for word/byte values
 // : nnnnnn                     consistency check: pc of the previous word must match this value
 // :: nnnnnn                    consistency check: pc of the current word must match this value
+// name:                        label, defined as the current pc
+// &name  %name                 in place of a word value: address of a label, or its pc-relative offset (see label.cpp)
+// mov #1, @#flag              MACRO-11 instruction, assembled in place of its octal words (see asm.cpp)
 //
 // Also supports:
 //      A subset of the usual conditional compilation: (can be nested)
 //      #define xxx, #ifdef xxx, #if 1, #if 0, #else, #endif
+//      #if expr, #elif expr    with defined(xxx), !, &&, || and parentheses (see cond.cpp)
 //      Can also use "--def xxx" argument to program in addition to "#define xxx"
 //
 //      #warning xxx, #error xxx
 //
+//      #include "file"     (can be nested, path is relative to the including file, see inc.cpp)
+//
 // Absolute format block is emitted as each "=" or ":" directive is encountered.
 // A "halt" block is emitted at the end of the file.
 //
@@ -34,107 +70,12 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <unistd.h>
 
-typedef unsigned char   u1_t;
-typedef unsigned int    u4_t;
-
-int lnum, errs;
-bool list = false;
-bool rm = false;
-char *fn_in, *fn_out;
-
-void error(const char *fmt, ...)
-{
-	va_list ap;
-	va_start(ap, fmt);
-	if (list)
-	    printf("line #%d:              | ERROR: ", lnum);
-	else
-	    printf("line %d ERROR: ", lnum);
-	vprintf(fmt, ap);
-	printf("\n");
-	errs++;
-	va_end(ap);
-	
-	if (!rm) {
-	    char *s;
-	    asprintf(&s, "rm %s", fn_out);
-	    system(s);
-	    free(s);
-	    rm = true;
-	}
-}
-
-void note(const char *fmt, ...)
-{
-	va_list ap;
-	va_start(ap, fmt);
-	if (list)
-	    printf("line #%d:              | NOTE: ", lnum);
-	else
-	    printf("line %d NOTE: ", lnum);
-	vprintf(fmt, ap);
-	printf("\n");
-	va_end(ap);
-}
-
-#define write_le(sp, w) *sp++ = (w) & 0xff; *sp++ = ((w) >> 8) & 0xff;
-#define writeHL_le(sp, w) sp ## L = (w) & 0xff; sp ## H = ((w) >> 8) & 0xff;
-
-#define ABS_SIG 1
-#define HDR_LEN 6
-#define CKSUM_LEN 1
-#define NBLK (64 * 1024)
-
-struct blk_t {
-    u1_t sigL, sigH;
-    u1_t lenL, lenH;
-    u1_t addrL, addrH;
-    u1_t data[NBLK];
-};
-blk_t blk;
-
-bool have_blk = false;
-u1_t *sp = blk.data;
-u4_t org, pc;
-FILE *fwp;
-enum abs_t { ABS_BLK, ABS_HALT };
-
-void write_abs(abs_t type)
-{
-    if (type == ABS_BLK) {
-        if (!have_blk) return;
-    } else
-    if (type == ABS_HALT) {
-        org = 1;    // halt if addr of block is odd
-    }
-    
-    writeHL_le(blk.sig, ABS_SIG);
-    int len = (int) (sp - blk.data);
-    int tlen = len + HDR_LEN + CKSUM_LEN;
-    writeHL_le(blk.len, tlen - CKSUM_LEN)
-    writeHL_le(blk.addr, org)
-
-    u4_t cksum = ABS_SIG + blk.lenL + blk.lenH + blk.addrL + blk.addrH;
-    for (int i = 0; i < len; i++) cksum += blk.data[i];
-    cksum = (0x100 - (cksum & 0xff)) & 0xff;
-    *sp = cksum;
-
-    if (fwrite(&blk, 1, tlen, fwp) != tlen) printf("write error\n");
-    if (list)
-        printf("wrote %s org %06o len %06o cksum %04o(0x%02x)\n\n",
-            (type == ABS_BLK)? "BLK" : "HALT", org, len, cksum, cksum);
-
-    have_blk = false;
-    sp = blk.data;
-    org = pc;
-}
+#include "txt2abs.h"
 
 int n_ifdefs;
-#define N_IFDEFS 32
 char *ifdefs[N_IFDEFS];
-
-#define NBUF 256
 char buf[NBUF];
 
 int main(int argc, char *argv[])
@@ -142,9 +83,24 @@ int main(int argc, char *argv[])
     #define ARG(s) (strcmp(argv[ai], "--" s) == 0)
     #define ARGP argv[++ai]
     
-    int i, n;
-    int ai = 0;
-    bool dbg_cond = false, help = false;
+    int i;
+    bool list = false, dbg_cond = false, help = false, lsp = false, impact = false;
+    bool check_only = false, first_error = false;
+    char *fn_in = NULL, *fn_out = NULL, *fn_patch = NULL, *fn_prov = NULL, *fn_deps = NULL, *dir_batch = NULL;
+    char *fn_index = NULL, *seq_s = NULL, *sweep_s = NULL;
+    int where = -1, jobs = 0, n_deltas = 0;
+    run_opt_t run = { 0, 014200, "DONE" };
+    int inject = 0, n_faults = 0, stub_at = -1;
+    char *warm = NULL, *mem_fmt = NULL, *fn_tu58 = NULL;
+    bool serve = false, farm = false;
+    int n_ports = 0, cps = 0, baud = 0;
+    char *ports[N_PORTS];
+    char *loader = NULL, *fn_errs = NULL, *fn_sub = NULL, *fn_msg = NULL, *fn_log = NULL;
+    int mem_width = 16, mem_depth = 0;
+    u4_t mem_base = 0;
+    u4_t seed = 1;
+    char *faults[N_FAULTS];
+    char *deltas[N_IFDEFS];
 
     for (int ai = 1; argv[ai]; ai++) {
         if (ARG("h") || ARG("help")) help = true; else
@@ -152,139 +108,168 @@ int main(int argc, char *argv[])
         if (ARG("out")) fn_out = ARGP; else
         if (ARG("list")) list = true; else
         if (ARG("debug_cond")) dbg_cond = true; else
+        if (ARG("lsp")) lsp = true; else
+        if (ARG("impact")) impact = true; else
+        if (ARG("check-only")) check_only = true; else
+        if (ARG("first-error")) first_error = true; else
+        if (ARG("delta")) { if (n_deltas < N_IFDEFS) deltas[n_deltas++] = ARGP; else ai++; } else
+        if (ARG("patch")) fn_patch = ARGP; else
+        if (ARG("prov")) fn_prov = ARGP; else
+        if (ARG("deps")) fn_deps = ARGP; else
+        if (ARG("where")) where = strtoul(ARGP, NULL, 8); else
+        if (ARG("batch")) dir_batch = ARGP; else
+        if (ARG("jobs")) jobs = strtoul(ARGP, NULL, 10); else
+        if (ARG("index")) fn_index = ARGP; else
+        if (ARG("seq")) seq_s = ARGP; else
+        if (ARG("run")) run.passes = strtoul(ARGP, NULL, 10); else
+        if (ARG("swreg")) run.swreg = strtoul(ARGP, NULL, 8); else
+        if (ARG("pass-msg")) run.pass_msg = ARGP; else
+        if (ARG("sweep")) sweep_s = ARGP; else
+        if (ARG("inject")) inject = strtoul(ARGP, NULL, 10); else
+        if (ARG("seed")) seed = strtoul(ARGP, NULL, 10); else
+        if (ARG("fault")) { if (n_faults < N_FAULTS) faults[n_faults++] = ARGP; else ai++; } else
+        if (ARG("warm")) warm = ARGP; else
+        if (ARG("stub")) stub_at = strtoul(ARGP, NULL, 8); else
+        if (ARG("mem")) mem_fmt = ARGP; else
+        if (ARG("width")) mem_width = strtoul(ARGP, NULL, 10); else
+        if (ARG("base")) mem_base = strtoul(ARGP, NULL, 8); else
+        if (ARG("depth")) mem_depth = strtoul(ARGP, NULL, 10); else
+        if (ARG("tu58")) fn_tu58 = ARGP; else
+        if (ARG("serve")) serve = true; else
+        if (ARG("farm")) farm = true; else
+        if (ARG("port")) { if (n_ports < N_PORTS) ports[n_ports++] = ARGP; else ai++; } else
+        if (ARG("cps")) cps = strtoul(ARGP, NULL, 10); else
+        if (ARG("baud")) baud = strtoul(ARGP, NULL, 10); else
+        if (ARG("loader")) loader = ARGP; else
+        if (ARG("errs")) fn_errs = ARGP; else
+        if (ARG("subtests")) fn_sub = ARGP; else
+        if (ARG("msgs")) fn_msg = ARGP; else
+        if (ARG("match")) fn_log = ARGP; else
         
         if (ARG("def")) {
             ifdefs[n_ifdefs] = ARGP;
-            printf("--def %s\n", ifdefs[n_ifdefs]);
             n_ifdefs++;
         } else
 
         { printf("unknown option: %s\n", argv[ai]); return -1; }
     }
 
+    // stdout is the protocol stream in lsp mode
+    if (lsp) return lsp_server(n_ifdefs, ifdefs);
+    for (i = 0; i < n_ifdefs; i++) printf("--def %s\n", ifdefs[i]);
+
     if (argc < 3 || help) {
-        printf("usage: %s [--list] [--def xxx] [--debug_cond] --in infile.txt --out outfile.abs\n", argv[0]);
+        printf("usage: %s [--list] [--def xxx] [--debug_cond] [--prov outfile.prov] [--deps outfile.deps] --in infile.txt --out outfile.abs\n", argv[0]);
+        printf("       %s [--def xxx] --lsp\n", argv[0]);
+        printf("       %s [--def xxx] --patch fixes.pat --in infile.txt --out patched.txt\n", argv[0]);
+        printf("       %s --prov outfile.prov --where nnnnnn\n", argv[0]);
+        printf("       %s [--def xxx] --delta \"xxx ...\" --in infile.txt --out base.abs\n", argv[0]);
+        printf("       %s [--def xxx] --check-only [--first-error] --in infile.txt\n", argv[0]);
+        printf("       %s [--def xxx] --impact --in infile.txt\n", argv[0]);
+        printf("       %s [--def xxx] [--jobs n] [--index corpus.idx] --batch dir\n", argv[0]);
+        printf("       %s --index corpus.idx [--where nnnnnn] [--seq \"nnnnnn ...\"]\n", argv[0]);
+        printf("       %s [--def xxx] --run K [--swreg nnnnnn] [--pass-msg str] --in infile.txt | --batch dir\n", argv[0]);
+        printf("       %s [--def xxx] [--run K] [--pass-msg str] --sweep \"nnnnnn ...\" --in infile.txt\n", argv[0]);
+        printf("       %s [--def xxx] [--run K] [--jobs n] --inject N [--seed n] [--fault spec ...] --in infile.txt\n", argv[0]);
+        printf("       %s [--def xxx] --warm pc[:n] | pass:n [--stub nnnnnn] [--run K] --in infile.txt --out warm.abs\n", argv[0]);
+        printf("       %s [--def xxx] --mem memh|memb|coe|mif [--width n] [--base nnnnnn] [--depth n] --in infile.txt --out outfile\n", argv[0]);
+        printf("       %s [--def xxx] --tu58 outfile.dsk --in infile.txt\n", argv[0]);
+        printf("       %s --tu58 file.dsk --serve\n", argv[0]);
+        printf("       %s [--def xxx] [--in image] [--cps n] [--baud n] --port dev[=image] [--port ...] --farm\n", argv[0]);
+        printf("       %s [--def xxx] --loader file[@addr[:start]] --in infile.txt | infile.abs | --batch dir\n", argv[0]);
+        printf("       %s [--def xxx] --errs outfile.err --in infile.txt\n", argv[0]);
+        printf("       %s --errs file.err --where nnnnnn\n", argv[0]);
+        printf("       %s [--def xxx] --subtests outfile.sub --in infile.txt\n", argv[0]);
+        printf("       %s --subtests file.sub [--where nnnnnn]\n", argv[0]);
+        printf("       %s [--def xxx] --msgs outfile.msg --in infile.txt | infile.abs\n", argv[0]);
+        printf("       %s --msgs file.msg [--match console.log]\n", argv[0]);
         return -1;
     }
 
-    FILE *frp;
-    if ((frp = fopen(fn_in, "r")) == NULL) { printf("fopen R %s\n", fn_in); return -1; }
-    if ((fwp = fopen(fn_out, "w")) == NULL) { printf("fopen W %s\n", fn_out); return -1; }
-
-    u4_t norg, chk, w0, w1, w2, b;
-    u4_t lvl = 1;
-    u4_t inside_if = 0, ignore_input = 0;
-    
-    while (fgets(buf, NBUF, frp)) {
-        char *bp = buf;
-        lnum++;
-        buf[strlen(buf)-1] = '\0';  // remove \n
-        if (list) {
-            if (dbg_cond)
-                printf("line #%04d: %06o %01x %01x %01x %c %s\n", lnum, pc,
-                    lvl, inside_if, ignore_input, ignore_input? 'X':'|', bp);
-            else
-                printf("line #%04d: %06o %c %s\n", lnum, pc, ignore_input? 'X':'|', bp);
-        }
-        while (*bp != '\0' && isspace(*bp)) bp++;   // remove leading whitespace
-        if (*bp == '\0' || strncmp(bp, "//", 2) == 0)
-            continue;
-        
-        char def_s[64];
-        if (strcmp(bp, "#else") == 0) {
-            if (!(inside_if & lvl))
-                error("#else not inside #if lvl=%x inside_if=%x ignore_input=%x", lvl, inside_if, ignore_input);
-            else
-                ignore_input ^= lvl;
-            if (dbg_cond)
-                note("#else  lvl=%x inside_if=%x ignore_input=%x", lvl, inside_if, ignore_input);
-            continue;
-        }
-
-        if (strcmp(bp, "#endif") == 0) {
-            inside_if &= ~lvl;
-            ignore_input &= ~lvl;
-            lvl >>= 1;
-            if (lvl == 0) error("#endif without corresponding #if");
-            if (dbg_cond)
-                note("#endif lvl=%x inside_if=%x ignore_input=%x", lvl, inside_if, ignore_input);
-            continue;
-        }
-
-        if (strcmp(bp, "#if 1") == 0) { lvl <<= 1; inside_if |= lvl; ignore_input &= ~lvl; continue; }
-        if (strcmp(bp, "#if 0") == 0) { lvl <<= 1; inside_if |= lvl; ignore_input |= lvl; continue; }
-
-        if (sscanf(bp, "#ifdef %s", def_s) == 1) {
-            for (i = 0; i < n_ifdefs; i++) {
-                if (strcmp(def_s, ifdefs[i]) == 0) {
-                    break;
-                }
-            }
-            lvl <<= 1;
-            inside_if |= lvl;
-            if (i == n_ifdefs) ignore_input |= lvl; else ignore_input &= ~lvl;
-            if (dbg_cond)
-                note("#ifdef lvl=%x inside_if=%x ignore_input=%x %s", lvl, inside_if, ignore_input, def_s);
-            continue;
-        }
-        
-        if (ignore_input) continue;     // i.e. ignore if ignoring on any level
-
-        if (sscanf(bp, "#define %s", def_s) == 1) {
-            printf("#define %s\n", def_s);
-            ifdefs[n_ifdefs] = strdup(def_s);
-            n_ifdefs++;
-            continue;
+    if (fn_index && !dir_batch) {
+        u4_t seq[N_SEQ];
+        int n_seq = 0;
+        for (char *cp = seq_s, *ep; cp && n_seq < N_SEQ; cp = ep) {
+            seq[n_seq] = strtoul(cp, &ep, 8);
+            if (ep == cp) break;
+            n_seq++;
         }
+        if (where < 0 && n_seq == 0) { printf("--index requires --where or --seq\n"); return -1; }
+        return idx_query(fn_index, where, n_seq, seq);
+    }
 
-        if (strncmp(bp, "#error", 6) == 0) { error("\"%s\"", bp); continue; }
-        if (strncmp(bp, "#warning", 8) == 0) { note("\"%s\"", bp); continue; }
+    if (fn_errs) return (where >= 0)? errs_query(fn_errs, where) : errs_main(fn_in, fn_errs, n_ifdefs, ifdefs);
+    if (fn_sub) return fn_in? scope_main(fn_in, fn_sub, n_ifdefs, ifdefs) : scope_query(fn_sub, where);
+    if (fn_msg) return fn_in? msgs_main(fn_in, fn_msg, n_ifdefs, ifdefs) : msgs_match(fn_msg, fn_log);
 
-        if (sscanf(bp, "= %o", &norg) == 1) {
-            write_abs(ABS_BLK);
-            if (norg > 0177777) error("range norg=%06o", norg);
-            pc = org = norg;
-        } else
+    if (where >= 0) {
+        if (fn_prov == NULL) { printf("--where requires --prov\n"); return -1; }
+        return prov_where(fn_prov, where);
+    }
 
-        if (sscanf(bp, ":: %o", &chk) == 1) {
-            if (chk > 0177777) error("'::' range chk=%06o", chk);
-            if (pc != chk) error("consistency check, expecting pc=%06o but \":: %06o\" specified", pc, chk);
-            write_abs(ABS_BLK);
-        } else
+    if (check_only && !dir_batch) return check_main(fn_in, n_ifdefs, ifdefs, first_error);
+    if (n_deltas) return delta_main(fn_in, fn_out, n_ifdefs, ifdefs, n_deltas, deltas);
+    if (impact) return impact_main(fn_in, n_ifdefs, ifdefs);
+    if (dir_batch) {
+        ldr_t ldr;
+        if (loader && ldr_open(loader, &ldr) < 0) return -1;
+        int rv = batch_main(dir_batch, n_ifdefs, ifdefs, jobs, fn_index, check_only, run.passes? &run : NULL, loader? &ldr : NULL);
+        if (loader) ldr_close(&ldr);
+        return rv;
+    }
+    if (inject || n_faults) return fault_main(fn_in, n_ifdefs, ifdefs, &run, inject, seed, n_faults, faults, jobs);
+    if (loader) return ldr_main(loader, fn_in, n_ifdefs, ifdefs);
+    if (farm) return farm_main(n_ports, ports, fn_in, n_ifdefs, ifdefs, cps, baud);
+    if (fn_tu58) return serve? tu58_serve(fn_tu58) : tu58_write(fn_in, fn_tu58, n_ifdefs, ifdefs);
+    if (mem_fmt) return fpga_main(fn_in, fn_out, n_ifdefs, ifdefs, mem_fmt, mem_width, mem_base, mem_depth);
+    if (warm) return warm_main(fn_in, fn_out, n_ifdefs, ifdefs, warm, stub_at, &run);
+    if (sweep_s) {
+        if (run.passes == 0) run.passes = 1;
+        return sweep_main(fn_in, n_ifdefs, ifdefs, &run, sweep_s);
+    }
+    if (run.passes) return run_main(fn_in, n_ifdefs, ifdefs, &run);
+    if (fn_patch) return patch_main(fn_patch, fn_in, fn_out, n_ifdefs, ifdefs);
+
+    // output options, so a run asking for other outputs than the last isn't skipped
+    char *opts[3], prov_opt[NPATH + 8];
+    int n_opts = 0;
+    if (list) opts[n_opts++] = (char *) "list";
+    if (dbg_cond) opts[n_opts++] = (char *) "debug_cond";
+    if (fn_prov) { snprintf(prov_opt, sizeof(prov_opt), "prov %s", fn_prov); opts[n_opts++] = prov_opt; }
+
+    if (fn_deps && deps_uptodate(fn_deps, fn_out, fn_in, n_ifdefs, ifdefs, n_opts, opts) &&
+        (fn_prov == NULL || access(fn_prov, F_OK) == 0)) {
+        printf("%s is up to date\n", fn_out);
+        return 0;
+    }
 
-        if (sscanf(bp, ": %o", &chk) == 1) {
-            if (chk > 0177777) error("':' range chk=%06o", chk);
-            int pcm2 = pc - 2;
-            if (pcm2 != chk) error("consistency check, expecting (pc-2)=%06o but \": %06o\" specified", pcm2, chk);
-            write_abs(ABS_BLK);
-        } else
+    FILE *frp, *fwp;
+    if ((frp = fopen(fn_in, "r")) == NULL) { printf("fopen R %s\n", fn_in); return -1; }
+    if ((fwp = fopen(fn_out, "w")) == NULL) { printf("fopen W %s\n", fn_out); return -1; }
 
-        if (sscanf(bp, "b %o", &b) == 1) {
-            if (b > 0377) error("range b=%04o", b);
-            *sp++ = b; pc += 1;
-            have_blk = true;
-        } else {
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    c->list = list;
+    c->dbg_cond = dbg_cond;
+    c->fwp = fwp;
+    c->fn_out = fn_out;
+    c->fn_in = fn_in;
+    c->prov = (fn_prov != NULL);
+    conv_begin(c, n_ifdefs, ifdefs, 0);
 
-            n = sscanf(bp, "%o %o %o", &w0, &w1, &w2);
-            if (n != 1 && n != 2 && n != 3) {
-                error("syntax error \"%s\"", buf);
-            } else {
-                if (w0 > 0177777) error("range w0=%06o", w0);
-                if (n >= 2 && w1 > 0177777) error("range w1=%06o", w1);
-                if (n >= 3 && w2 > 0177777) error("range w2=%06o", w2);
-                if (pc & 1) error("odd pc=%06o", pc);
-                write_le(sp, w0); pc += 2;
-                if (n >= 2) { write_le(sp, w1); pc += 2; }
-                if (n >= 3) { write_le(sp, w2); pc += 2; }
-                have_blk = true;
-            }
-        }
+    while (fgets(buf, NBUF, frp)) {
+        buf[strlen(buf)-1] = '\0';  // remove \n
+        conv_line(c, buf);
     }
     
-    write_abs(ABS_BLK);
-    write_abs(ABS_HALT);
+    int errs = conv_end(c);
     fclose(fwp);
+    if (fn_prov) prov_write(c, fn_prov, fn_in);
+    if (fn_deps) {
+        if (errs == 0) deps_write(c, fn_deps, n_ifdefs, ifdefs, n_opts, opts); else unlink(fn_deps);
+    }
 
     if (list || errs) printf("%d error%s\n", errs, (errs != 1)? "s":"");
+    conv_free(c);
     return 0;
 }
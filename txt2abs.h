@@ -0,0 +1,564 @@
+//
+// txt2abs: declarations shared between the converter and its auxiliary modes
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#ifndef _TXT2ABS_H_
+#define _TXT2ABS_H_
+
+#include <stdio.h>
+#include <setjmp.h>
+
+typedef unsigned char   u1_t;
+typedef unsigned short  u2_t;
+typedef unsigned int    u4_t;
+typedef unsigned long long u64_t;
+
+#define N_IFDEFS 32
+#define N_NAME 64
+#define N_SYMS 1024             // distinct define names per run (see cond.cpp)
+
+// classification of a single line of infile.txt
+enum line_e {
+    L_BLANK,        // empty or comment
+    L_PAGE,         // "// page NN" comment, v[0] = NN
+    L_ELSE, L_ENDIF, L_IF1, L_IF0,
+    L_IF, L_ELIF,   // "#if expr", "#elif expr", v[0] = compiled expression (see cond.cpp)
+    L_IFDEF,        // name
+    L_DEFINE,       // name
+    L_INCLUDE,      // #include "name"
+    L_ERROR, L_WARNING,
+    L_ORG,          // "= nnnnnn", v[0]
+    L_CHK_CUR,      // ":: nnnnnn", v[0]
+    L_CHK_PREV,     // ": nnnnnn", v[0]
+    L_BYTE,         // "b nnn", v[0]
+    L_WORDS,        // one to three words, n = count, v[0..2] (label symbol if the refs bit is set),
+                    // also from an assembled instruction (see asm.cpp)
+    L_LABEL,        // "name:", v[0] = label symbol (see label.cpp)
+    L_SYNTAX
+};
+
+struct line_t {
+    line_e type;
+    int n;
+    u4_t v[3];
+    u1_t refs, rel;         // L_WORDS: bit i set if v[i] is a label reference ("&name"/"%name"), pc-relative
+    u1_t br;                // L_WORDS: word 0 is opc plus the offset to the branch target v[0] (BR_xxx)
+    u2_t opc;
+    char name[N_NAME];
+};
+
+#define BR_8    1           // br, bxx: 8-bit signed word offset
+#define BR_SOB  2           // sob: 6-bit backward word offset
+
+// bp must have leading whitespace removed
+void parse_line(const char *bp, line_t *lp);
+
+// label.cpp
+int lab_sym(const char *name, int len);
+const char *lab_name(int s);
+int lab_count();
+int lab_word(const line_t *l, int i, u4_t pc, u4_t target);
+
+// asm.cpp
+bool asm_line(const char *bp, line_t *lp);
+
+// cond.cpp
+int cond_sym(const char *name);
+int cond_compile(const char *expr);
+bool cond_eval(int p, const u4_t *set);
+bool cond_set_add(u4_t *set, const char *name);
+int cond_syms(int p, int *syms, int max);
+const char *cond_name(int s);
+
+// number of bytes of pc space the line occupies (ignoring conditional compilation)
+static inline int line_size(const line_t *lp)
+{
+    return (lp->type == L_WORDS)? lp->n * 2 : ((lp->type == L_BYTE)? 1 : 0);
+}
+
+
+// conv.cpp
+
+// bump-pointer allocator, released in one shot
+struct arena_t {
+    u1_t *base;
+    int size, used;
+    bool grow;                      // malloc()ed chunks, another added when full
+    struct arena_chunk_t *chunk;    // the current one, linked to those before
+    int total;                      // bytes in all the chunks
+};
+
+void arena_init(arena_t *a, void *mem, int size);
+void arena_release(arena_t *a);
+void arena_free(arena_t *a);
+void *arena_alloc(arena_t *a, int n);
+char *arena_strdup(arena_t *a, const char *s);
+
+#define ABS_SIG 1
+#define HDR_LEN 6
+#define CKSUM_LEN 1
+#define NBLK (64 * 1024)
+
+struct blk_t {
+    u1_t sigL, sigH;
+    u1_t lenL, lenH;
+    u1_t addrL, addrH;
+    u1_t data[NBLK];
+};
+
+enum abs_t { ABS_BLK, ABS_HALT };
+
+#define ABS_MEM (64 * 1024)     // bytes of address space an image can load
+
+// provenance: the source lines each emitted block was built from (see prov.cpp)
+struct prov_run_t {
+    u4_t addr;
+    int n;                  // bytes
+    int line;
+    int page;               // listing page ("// page NN"), 0 if none yet
+    int blk;
+};
+
+struct prov_blk_t {
+    u4_t off;               // file offset of block in .abs
+    u4_t org;
+    int len;
+    int run0, n_runs;
+};
+
+#define N_PROV_RUNS 16384
+#define N_PROV_BLKS 2048
+
+#define NBUF 256
+#define NPATH 1024
+#define N_INC_DEPTH 8
+#define N_DEPS 64
+#define ARENA_CHUNK (1024 * 1024)       // first chunk of a conversion's arena
+#define N_LABELS (32 * 1024)            // hash slots for labels per conversion, power of 2
+#define IMG_SIZE (256 * 1024)
+
+struct conv_t {
+    // options, set before conv_begin()
+    bool list, dbg_cond;
+    bool prov;              // record provenance
+    FILE *fmsg;             // messages and listing, NULL to discard
+    FILE *fwp;              // output file, or NULL for an in-memory image
+    const char *fn_out;     // removed on first error
+    const char *fn_in;      // #include paths are relative to the including file
+
+    arena_t arena;
+
+    int n_defs;
+    char *defs[N_IFDEFS];
+    u4_t def_set[N_SYMS / 32];      // defs as a bitmap over interned symbols
+
+    u1_t *img;              // in-memory output image
+    int img_len, img_size;
+    u4_t abs_off;
+
+    prov_run_t *runs;
+    int n_runs, blk_run0;
+    prov_blk_t *pblks;
+    int n_pblks;
+
+    blk_t *blk;
+    u1_t *sp;
+    bool have_blk;
+    u4_t org, pc;
+    int lnum, errs;
+    int page;
+    bool rm;
+    u4_t lvl, inside_if, ignore_input;
+    u4_t taken;             // a branch of the #if at this level has been taken (for #elif)
+
+    struct lab_t *labs;     // labels, allocated on first use
+    int n_labs, n_fix;
+    struct fix_t *blk_fix;  // forward references in the block being built
+
+    const char *fn_cur;     // included file being processed, NULL at top level
+    int inc_depth;
+    int n_deps;
+    struct inc_t *deps[N_DEPS];     // files included
+};
+
+void error(conv_t *c, const char *fmt, ...);
+void note(conv_t *c, const char *fmt, ...);
+void write_abs(conv_t *c, abs_t type);
+int abs_block(FILE *fp, u4_t addr, const u1_t *data, int n);
+int abs_load(const u1_t *img, int len, u1_t *mem, u1_t *loaded);
+
+// label.cpp, per conversion
+void lab_define(conv_t *c, int sym);
+u4_t lab_ref(conv_t *c, const line_t *l, int i);
+void lab_blk_written(conv_t *c, u4_t off, int tlen, u1_t cksum);
+void lab_end(conv_t *c);
+void conv_init(conv_t *c, void *mem, int size);
+void conv_free(conv_t *c);
+void conv_begin(conv_t *c, int n_defs, char **defs, int img_size);
+void conv_line(conv_t *c, const char *line);
+int conv_end(conv_t *c);
+int conv_text(conv_t *c, const char *text);
+char *file_read(const char *fn, long *len);
+bool conv_is_listing(const char *fn);
+int conv_file(conv_t *c, const char *fn, int n_defs, char **defs, const u1_t **img, long *len);
+void prov_add(conv_t *c, int n);
+
+
+// inc.cpp
+// Included files are read and parsed once per run, then shared by all conversions.
+
+struct inc_t {
+    char *path;
+    u64_t hash;
+    int n;
+    char **lines;
+    line_t *parsed;
+    inc_t *next;
+};
+
+u64_t hash_mem(const void *p, int n);
+int hash_file(const char *path, u64_t *hash);
+void inc_path(char *path, const char *fn_from, const char *name);
+inc_t *inc_load(const char *path);
+int deps_write(conv_t *c, const char *fn_deps, int n_defs, char **defs, int n_opts, char **opts);
+bool deps_uptodate(const char *fn_deps, const char *fn_out, const char *fn_in, int n_defs, char **defs, int n_opts, char **opts);
+
+
+// batch.cpp
+int batch_main(const char *dir, int n_defs, char **defs, int n_threads, const char *fn_index, bool check_only, const struct run_opt_t *run,
+    const struct ldr_t *loader);
+
+// check.cpp
+int check_text(FILE *fp, const char *fn_in, char *text, int n_defs, char **defs, bool first, bool par);
+int check_main(const char *fn_in, int n_defs, char **defs, bool first);
+
+// index.cpp
+struct idx_ent_t {
+    u2_t pc, word;
+    u4_t line;
+    u2_t page, img;
+};
+
+struct idx_img_t {
+    char name[N_NAME], variant[N_NAME];
+    u4_t ent0, n_ents;
+};
+
+#define N_SEQ 16                // words in a --seq query
+
+int idx_build(conv_t *c, idx_ent_t **ents);
+int idx_write(const char *fn_idx, idx_img_t *imgs, idx_ent_t **ents, int n_imgs);
+int idx_query(const char *fn_idx, int pc, int n_seq, u4_t *seq);
+
+// prov.cpp
+int prov_write(conv_t *c, const char *fn_prov, const char *fn_in);
+int prov_where(const char *fn_prov, u4_t addr);
+
+
+// dis.cpp
+enum fmt_e {
+    F_NONE,     // halt
+    F_DD,       // clr dd
+    F_SSDD,     // mov ss, dd
+    F_BR,       // br off8
+    F_R,        // rts r
+    F_RDD,      // jsr r, dd
+    F_SSR,      // mul ss, r
+    F_RDD2,     // xor r, dd
+    F_SOB,      // sob r, off6
+    F_N3,       // spl n
+    F_N6,       // mark n
+    F_N8        // trap n
+};
+
+struct op_t {
+    u2_t code, mask;
+    const char *name;
+    fmt_e fmt;
+};
+
+extern const op_t pdp11_ops[];         // ends with a NULL name
+
+// Disassembles the instruction at pc from the words w[0..nw-1].
+// Returns the number of words the instruction occupies (may exceed nw if operands are missing).
+int dis_pdp11(u4_t pc, const u2_t *w, int nw, char *s, int ns);
+
+
+// listing.cpp
+// In-memory listing kept incrementally up to date as lines are edited.
+// The pc of each line is found from a Fenwick tree of active line sizes relative
+// to the closest preceding active "=" origin.
+
+struct lline_t {
+    char *s;                // text of line (without \n)
+    line_t l;
+    bool active;            // not excluded by conditional compilation
+    u1_t cerr;              // conditional structure error, CERR_xxx
+};
+
+#define CERR_ELSE   1       // #else not inside #if
+#define CERR_ENDIF  2       // #endif without #if
+#define CERR_UNTERM 4       // #if without #endif at end of file
+#define CERR_ELIF   8       // #elif not inside #if
+
+struct listing_t {
+    int n, alloc;
+    lline_t *ln;
+    int *fen;               // Fenwick tree of active line sizes, 1-based
+    int *orgs, n_orgs;      // active "=" lines, ascending
+    int *chks, n_chks;      // active ":" and "::" lines, ascending
+    int *pars, n_pars;      // active "=" and "b" lines (i.e. those that can change pc parity), ascending
+    int *pages, n_pages;    // "// page NN" lines, ascending
+    int n_defs;
+    char *defs[N_IFDEFS];   // defines given externally (#define lines are found by listing_rebuild)
+    const char *undef;      // if set "#define undef" is ignored (see impact.cpp)
+    bool defer, stale;      // postpone rebuilds until listing_sync()
+    int rebuilds;
+};
+
+enum diag_e { DIAG_ERROR = 1, DIAG_WARNING = 2 };
+typedef void (*diag_f)(void *arg, int line, diag_e sev, const char *msg);
+
+void listing_init(listing_t *lst, int n_defs, char **defs);
+void listing_free(listing_t *lst);
+void listing_set(listing_t *lst, const char *text);
+int listing_load(listing_t *lst, const char *fn);
+int listing_write(listing_t *lst, FILE *fp);
+void listing_sync(listing_t *lst);
+void listing_replace(listing_t *lst, int first, int n_old, char **lines, int n_new);
+void listing_edit(listing_t *lst, int l0, int c0, int l1, int c1, const char *text);
+u4_t listing_pc(listing_t *lst, int i);
+int listing_page(listing_t *lst, int i);
+int listing_find_pc(listing_t *lst, u4_t pc, int *wi);
+int listing_words(listing_t *lst, int i, u2_t *w, int nw);
+int listing_diags(listing_t *lst, diag_f fn, void *arg);
+
+
+// delta.cpp
+int delta_main(const char *fn_in, const char *fn_out, int n_defs, char **defs, int n_deltas, char **deltas);
+
+
+// impact.cpp
+int impact_main(const char *fn_in, int n_defs, char **defs);
+
+
+// lsp.cpp
+int lsp_server(int n_defs, char **defs);
+
+
+// patch.cpp
+// Structured patches applied to a listing, located by pc in the unpatched listing.
+
+#define N_PATCH_WORDS 8
+
+enum patch_e {
+    P_REPLACE,      // replace words at pc
+    P_IFDEF,        // line at pc becomes the #else of a new "#ifdef name" holding the block
+    P_INSERT        // block inserted under a new "#ifdef name" before the line at pc
+};
+
+struct patch_t {
+    patch_e op;
+    u4_t pc;
+    char name[N_NAME];
+    int n;
+    u4_t w[N_PATCH_WORDS];
+    int n_block;
+    char **block;
+    int src_line;       // line number in patch file
+    int line, wi;       // resolved location in listing
+};
+
+int patch_read(const char *fn, patch_t **pp, int *np);
+int patch_apply(listing_t *lst, patch_t *p, int np);
+void patch_free(patch_t *p, int np);
+int patch_main(const char *fn_patch, const char *fn_in, const char *fn_out, int n_defs, char **defs);
+
+
+// emu.cpp
+// PDP-11/40 interpreter with a console, for running converted images.
+
+#define EMU_MEM_TOP 0160000     // 28K words of memory
+#define EMU_IO_PAGE 0160000
+
+#define CSR_IE      0100
+#define RCSR_DONE   0200
+#define XCSR_RDY    0200
+#define IRQ_TTI     1
+#define IRQ_TTO     2
+#define IRQ_FAULT   4           // injected spurious interrupt
+#define IRQ_PTR     8
+#define TTO_DELAY   8           // instructions to transmit a console character
+#define PRS_ERR     0100000     // PC11 reader: out of tape
+#define PRS_DONE    0200
+#define PRS_ENB     1
+
+enum emu_stop_e { EMU_RUN, EMU_HALT, EMU_LIMIT, EMU_WAIT, EMU_DBLBUS, EMU_STOP, EMU_SWR };
+
+enum fault_e { FAULT_PAR, FAULT_NXM, FAULT_IRQ };
+
+#define FAULT_NEVER (~0ULL)
+
+// an injected fault: a parity error (trap to 114) or bus timeout (trap to 4) on a memory access,
+// or an interrupt request nothing asked for
+struct fault_t {
+    fault_e type;
+    u64_t at;               // instruction count at which it is armed (the interrupt requested)
+    int addr;               // then hits the first access to this address, -1 for any
+    u2_t vec;               // FAULT_IRQ vector and bus request level
+    u1_t pri;
+    u64_t fired;            // instruction count + 1 when it took effect, 0 if it never did
+    u2_t pc;                // of the instruction it hit (interrupted)
+};
+
+#define N_WLOG 32
+
+struct wlog_t {
+    u4_t addr;
+    u1_t old;
+};
+
+struct emu_t {
+    u2_t r[8];
+    u2_t psw;
+    u1_t mem[ABS_MEM];
+    u4_t mem_top;
+    u1_t *touched;              // if set, touched[a] = 1 for each memory byte written
+    wlog_t *wlog;               // with touched: the first N_WLOG bytes written and their old values,
+    int n_wlog;                 // and the number written (see sweep.cpp)
+    u2_t swreg, dispreg;
+    u2_t rcsr, xcsr, xbuf;
+    int x_busy;                 // instructions until the transmitted character is done
+    const u1_t *ptr;            // PC11 reader tape, the reader is only present if set
+    int ptr_len, ptr_pos;
+    u2_t prs, prb;
+    u4_t irq;                   // IRQ_xxx device requests
+    u4_t trap_req;
+    bool wait, trc_inhibit, in_trap;
+    bool ea_stk;                // last operand address was through sp and stack limit checked
+    u2_t ir, pc0, cc0;          // current instruction, its address and the PSW before it
+    u64_t n_insns;
+    u64_t end;                  // emu_run() stops at this instruction count
+    u64_t ev_at;                // run loop looks past the next instruction from here (see emu.cpp)
+    int stop;                   // EMU_xxx, set to EMU_STOP by a hook to end emu_run()
+    char *out;                  // console output
+    int n_out, alloc_out;
+    fault_t fault;
+    u64_t fault_next;           // instruction count to arm the fault at
+    bool armed;                 // memory fault armed, checked on every access
+    u4_t brk;                   // on_brk() is called before executing the instruction here
+    void (*on_brk)(emu_t *e);
+    void (*on_trap)(emu_t *e, u4_t vec);
+    void (*on_out)(emu_t *e, int ch);
+    void *arg;
+    bool swr_stop;              // stop with EMU_SWR at the start of an instruction reading the switch register,
+    u64_t swr_at;               // unless it is this one (see sweep.cpp)
+    u2_t r0[8];                 // state at the start of the instruction, while swr_stop
+    u4_t trap_req0;
+    bool trc0;
+    jmp_buf jb;
+};
+
+void emu_init(emu_t *e, u4_t swreg);
+int emu_load(emu_t *e, const u1_t *img, int len);
+int emu_run(emu_t *e, u64_t n);
+void emu_fault(emu_t *e, const fault_t *f);
+void emu_free(emu_t *e);
+
+// run.cpp
+#define RUN_INSNS       10000000        // instructions allowed a pass
+#define RUN_OUT_TAIL    1024            // console output kept for the report
+
+struct run_opt_t {
+    int passes;
+    u4_t swreg;
+    const char *pass_msg;
+};
+
+struct run_t {
+    int passes, errs;
+    u4_t err_pc;            // first error call
+    int stop;               // EMU_xxx, EMU_STOP when the passes completed
+    u4_t stop_pc;
+    u64_t n_insns;
+    char *out;              // end of the console output
+
+    const run_opt_t *opt;
+    int msg_len, target;
+    u4_t err_vec;           // error call handler the image loads at 34
+};
+
+#define RUN_PASSED(r) ((r)->stop == EMU_STOP && (r)->errs == 0)
+
+void run_start(emu_t *e, const u1_t *img, int len, const run_opt_t *opt, run_t *r);
+int run_passes(emu_t *e, run_t *r, int passes);
+void run_done(emu_t *e, run_t *r);
+int run_image(const u1_t *img, int len, const run_opt_t *opt, run_t *r);
+const char *run_result(const run_t *r);
+void run_report(FILE *fp, const run_t *r);
+int run_main(const char *fn_in, int n_defs, char **defs, const run_opt_t *opt);
+
+// sweep.cpp
+#define N_SWEEP 64              // switch register settings
+
+int sweep_main(const char *fn_in, int n_defs, char **defs, const run_opt_t *opt, const char *sweep_s);
+
+// fault.cpp
+#define N_FAULTS 64             // --fault specs
+
+int fault_main(const char *fn_in, int n_defs, char **defs, const run_opt_t *opt, int n_gen, u4_t seed,
+    int n_specs, char **specs, int n_threads);
+
+// warm.cpp
+int warm_main(const char *fn_in, const char *fn_out, int n_defs, char **defs, const char *spec, int stub_at, const run_opt_t *opt);
+
+// fpga.cpp
+int fpga_main(const char *fn_in, const char *fn_out, int n_defs, char **defs, const char *fmt_s, int width, u4_t base, int depth);
+
+// tu58.cpp
+int tu58_write(const char *fn_in, const char *fn_out, int n_defs, char **defs);
+int tu58_serve(const char *fn);
+
+// farm.cpp
+#define N_PORTS 256
+
+int farm_main(int n_ports, char **port_s, const char *fn_in, int n_defs, char **defs, int cps, int baud);
+
+// ldr.cpp
+struct ldr_t {
+    u1_t *mem, *loaded;     // the loader's code
+    int lo, hi;             // range it occupies
+    int start;
+};
+
+struct ldr_res_t {
+    int blks, bytes;        // in the image
+    int overlap, overlap_at;
+    int stop, pc, tape_pos, start;
+    u64_t n_insns;
+    int diffs, diff_at;     // bytes not loaded as abs_load() does
+    const char *why;        // NULL if it conforms
+};
+
+int ldr_open(const char *spec, ldr_t *l);
+void ldr_close(ldr_t *l);
+int ldr_check(const ldr_t *l, const u1_t *img, int len, ldr_res_t *res);
+void ldr_report(FILE *fp, const ldr_res_t *r);
+int ldr_main(const char *spec, const char *fn_in, int n_defs, char **defs);
+
+// errs.cpp
+int errs_main(const char *fn_in, const char *fn_errs, int n_defs, char **defs);
+int errs_query(const char *fn_errs, u4_t pc);
+
+// scope.cpp
+int scope_main(const char *fn_in, const char *fn_sub, int n_defs, char **defs);
+int scope_query(const char *fn_sub, int pc);
+
+// msgs.cpp
+int msgs_main(const char *fn_in, const char *fn_msg, int n_defs, char **defs);
+int msgs_match(const char *fn_msg, const char *fn_log);
+
+#endif
@@ -0,0 +1,238 @@
+//
+// Warm-start image (txt2abs --warm pc[:n] | pass:n --in infile.txt --out warm.abs)
+//
+// The listing is converted in memory and run on the interpreter (see emu.cpp) until the
+// instruction at pc (octal) is about to execute for the n'th time (default 1), or until the
+// end-of-pass message has been typed n times (see run.cpp for "--swreg" and "--pass-msg").
+// The memory and processor state at that point are then written as a new absolute format image,
+// so a board can skip the initialization (memory sizing, cpu probing, stack and vector setup)
+// of every start.
+//
+// The image holds every byte the original loaded or the run wrote, plus a restore stub which
+// is its start address:
+//
+//      mov     #340, @#177776          ; no interrupts until the rti
+//      mov     #ie, @#177560           ; console interrupt enables
+//      mov     #ie, @#177564
+//      movb    #ch, @#177566           ; only if a character was being transmitted
+//      mov     #disp, @#177570
+//      mov     #r0, r0                 ; ... r5
+//      mov     #sp, sp
+//      mov     #psw, -(sp)
+//      mov     #pc, -(sp)
+//      rti
+//
+// The stub goes in the lowest free area above the vectors, bytes neither loaded nor written
+// by the run (or at "--stub nnnnnn"), and costs the two words below the stack pointer. A run
+// stopped in a WAIT resumes at the WAIT. The warm image is then itself run ("--run K",
+// default 1 pass) to check it.
+//
+// jks@jks.com
+// 2019-2021
+//
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "txt2abs.h"
+
+// a gap shorter than this is cheaper to send than to start a new block
+#define GAP_MAX (HDR_LEN + CKSUM_LEN)
+
+#define N_STUB 40               // words
+#define STUB_MIN 01000          // above the vectors
+
+struct warm_t {
+    run_t r;                    // first: e->arg is also the run_t of run.cpp's hooks
+    int hits, n;
+};
+
+static void warm_brk(emu_t *e)
+{
+    warm_t *w = (warm_t *) e->arg;
+    if (++w->n >= w->hits) e->stop = EMU_STOP;
+}
+
+// Assembles one line of the stub.
+static int stub_asm(u2_t *stub, int n, const char *fmt, ...)
+{
+    char s[NBUF];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(s, NBUF, fmt, ap);
+    va_end(ap);
+    line_t l;
+    if (!asm_line(s, &l) || l.type != L_WORDS || n + l.n > N_STUB) { printf("stub: can't assemble \"%s\"\n", s); exit(-1); }
+    for (int i = 0; i < l.n; i++) stub[n++] = l.v[i];
+    return n;
+}
+
+static int stub_build(emu_t *e, u2_t *stub)
+{
+    int n = 0;
+    u4_t pc = e->r[7];
+    if (e->wait) pc -= 2;
+    n = stub_asm(stub, n, "mov #340, @#177776");
+    n = stub_asm(stub, n, "mov #%o, @#177560", e->rcsr & CSR_IE);
+    n = stub_asm(stub, n, "mov #%o, @#177564", e->xcsr & CSR_IE);
+    if (e->x_busy) n = stub_asm(stub, n, "movb #%o, @#177566", e->xbuf);
+    n = stub_asm(stub, n, "mov #%o, @#177570", e->dispreg);
+    for (int i = 0; i < 6; i++)
+        n = stub_asm(stub, n, "mov #%o, r%d", e->r[i], i);
+    n = stub_asm(stub, n, "mov #%o, sp", e->r[6]);
+    n = stub_asm(stub, n, "mov #%o, -(sp)", e->psw);
+    n = stub_asm(stub, n, "mov #%o, -(sp)", pc);
+    n = stub_asm(stub, n, "rti");
+    return n;
+}
+
+// lowest free area of n bytes, or -1
+static int stub_find(const u1_t *keep, u4_t top, int n, u4_t sp)
+{
+    for (u4_t a = STUB_MIN, e; a + n <= top; a = e + 2) {
+        for (e = a; e < a + n && !keep[e] && !keep[e+1] && (e < sp - 4 || e >= sp); e += 2)
+            ;
+        if (e == a + n) return a;
+    }
+    return -1;
+}
+
+static int warm_write(const char *fn, const u1_t *mem, const u1_t *keep, u4_t top, u4_t start, int *n_blks, int *n_bytes)
+{
+    FILE *fp;
+    if ((fp = fopen(fn, "w")) == NULL) { printf("fopen W %s\n", fn); return -1; }
+    u4_t a, e, g;
+    int err = 0;
+    *n_blks = *n_bytes = 0;
+
+    for (a = 0; a < top; a++) {
+        if (!keep[a]) continue;
+
+        // extend over short gaps
+        for (e = a + 1; e < top; ) {
+            if (keep[e]) { e++; continue; }
+            for (g = e; g < top && g - e < GAP_MAX && !keep[g]; g++)
+                ;
+            if (g < top && g - e < GAP_MAX) e = g; else break;
+        }
+        if (abs_block(fp, a, &mem[a], e - a) < 0) err = -1;
+        (*n_blks)++;
+        *n_bytes += e - a;
+        a = e;
+    }
+    if (abs_block(fp, start, NULL, 0) < 0) err = -1;
+    if (fclose(fp) != 0) err = -1;
+    if (err) printf("write error %s\n", fn);
+    return err;
+}
+
+int warm_main(const char *fn_in, const char *fn_out, int n_defs, char **defs, const char *spec, int stub_at, const run_opt_t *opt)
+{
+    int pass = 0, hits = 1, rv = -1;
+    u4_t pc = 0;
+    char *ep;
+    if (strncmp(spec, "pass:", 5) == 0) {
+        pass = strtoul(spec + 5, &ep, 10);
+    } else {
+        pc = strtoul(spec, &ep, 8);
+        if (*ep == ':') hits = strtoul(ep + 1, &ep, 10);
+    }
+    if (ep == spec || *ep != '\0' || (pass == 0 && (pc & 1)) || hits < 1 || pass < 0 || pc >= EMU_MEM_TOP) {
+        printf("bad --warm \"%s\": pc[:n] or pass:n\n", spec);
+        return -1;
+    }
+    if (fn_out == NULL) { printf("--warm requires --out\n"); return -1; }
+
+    conv_t conv, *c = &conv;
+    conv_init(c, NULL, 0);
+    const u1_t *img;
+    long len;
+    int errs = conv_file(c, fn_in, n_defs, defs, &img, &len);
+    emu_t *e = (emu_t *) calloc(1, sizeof(emu_t));     // zeroed for emu_free() on the error path
+    u1_t *keep = (u1_t *) calloc(ABS_MEM, 1);
+    u1_t *touched = (u1_t *) calloc(ABS_MEM, 1);
+    warm_t w;
+
+    if (errs) {
+        if (errs > 0) printf("%d error%s, not run\n", errs, (errs != 1)? "s":"");
+        goto out;
+    }
+
+    // cold start to the capture point
+    abs_load(img, len, NULL, keep);
+    run_start(e, img, len, opt, &w.r);
+    e->touched = touched;
+    e->arg = &w;
+    if (pass) {
+        run_passes(e, &w.r, pass);
+    } else {
+        w.hits = hits;
+        w.n = 0;
+        w.r.target = ~0U >> 1;     // don't stop at the end of a pass
+        e->brk = pc;
+        e->on_brk = warm_brk;
+        w.r.stop = emu_run(e, RUN_INSNS);
+        w.r.stop_pc = e->r[7];
+        w.r.n_insns = e->n_insns;
+    }
+    if (w.r.stop != EMU_STOP || w.r.errs) {
+        printf("capture point not reached: ");
+        run_done(e, &w.r);
+        run_report(stdout, &w.r);
+        free(w.r.out);
+        goto out;
+    }
+
+    // take any trap already requested, so the state is at an instruction boundary
+    emu_run(e, 0);
+
+    if (e->r[6] < 0404 || (e->r[6] & 1)) {
+        printf("can't restore with sp %06o\n", e->r[6]);
+        goto out;
+    }
+
+    {
+        for (u4_t a = 0; a < ABS_MEM; a++) keep[a] |= touched[a];
+        u2_t stub[N_STUB];
+        int n = stub_build(e, stub);
+        int at = (stub_at >= 0)? stub_at : stub_find(keep, e->mem_top, n * 2, e->r[6]);
+        if (at < 0 || (at & 1) || at + n * 2 > (int) e->mem_top) { printf("no room for the %d byte restore stub\n", n * 2); goto out; }
+        for (int i = 0; i < n; i++) {
+            e->mem[at + i*2] = stub[i];
+            e->mem[at + i*2 + 1] = stub[i] >> 8;
+            keep[at + i*2] = keep[at + i*2 + 1] = 1;
+        }
+
+        int n_blks, n_bytes;
+        if (warm_write(fn_out, e->mem, keep, e->mem_top, at, &n_blks, &n_bytes) < 0) goto out;
+        printf("%s: captured at pc %06o psw %06o sp %06o after %llu instructions%s\n", fn_out, e->r[7], e->psw, e->r[6],
+            (unsigned long long) e->n_insns, e->wait? " (waiting)" : "");
+        printf("%d block%s, %d bytes, restore stub at %06o\n", n_blks, (n_blks != 1)? "s":"", n_bytes, at);
+        u64_t cold = e->n_insns;
+
+        // check the warm image runs
+        if (conv_file(c, fn_out, 0, NULL, &img, &len) < 0) goto out;
+        run_opt_t wopt = *opt;
+        if (wopt.passes == 0) wopt.passes = 1;
+        run_t r;
+        rv = run_image(img, len, &wopt, &r);
+        if (rv == 0)
+            printf("warm start: %d pass%s, %llu instructions (cold start %llu to the capture point)\n", r.passes,
+                (r.passes != 1)? "es":"", (unsigned long long) r.n_insns, (unsigned long long) cold);
+        else {
+            printf("warm start: ");
+            run_report(stdout, &r);
+        }
+        free(r.out);
+    }
+
+out:
+    emu_free(e);
+    free(e);
+    free(keep);
+    free(touched);
+    conv_free(c);
+    return rv;
+}